@@ -0,0 +1,428 @@
+/*
+   american fuzzy lop - packed store and queue state exporter
+   ----------------------------------------------------------
+
+   Copyright 2013, 2014, 2015 Google Inc. All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at:
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Turns the records appended to <out_dir>/store/ by afl-fuzz running with
+   AFL_PACKED_STORE back into the usual one-file-per-seed layout (queue/,
+   crashes/, hangs/, and the -path/ directories), for tools that still expect
+   it. The number of records already exported is kept in store/export_cursor,
+   so the tool can be re-run, or left running with -F, while afl-fuzz works.
+
+   With -M, it instead rebuilds the queue/.state/favored_edges/ and
+   redundant_edges/ marker directories from the queue state file.
+
+ */
+
+#define AFL_MAIN
+
+#include "config.h"
+#include "types.h"
+#include "debug.h"
+#include "alloc-inl.h"
+#include "store.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#include <dirent.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+static u8* out_dir;                   /* afl-fuzz output directory         */
+
+static u8 follow_mode,                /* Keep polling for new records?     */
+          marker_mode;                /* Rebuild marker directories?       */
+
+static s32 seg_fd = -1;               /* Currently open segment            */
+static u32 seg_num;                   /* ...and its number                 */
+
+
+/* Read the export cursor; a missing file means nothing was exported yet. */
+
+static u32 read_cursor(void) {
+
+  u8* fn = alloc_printf("%s/store/export_cursor", out_dir);
+  FILE* f = fopen(fn, "r");
+  u32 ret = 0;
+
+  if (f) {
+    if (fscanf(f, "%u", &ret) != 1) FATAL("Malformed '%s'", fn);
+    fclose(f);
+  } else if (errno != ENOENT) PFATAL("Unable to open '%s'", fn);
+
+  ck_free(fn);
+  return ret;
+
+}
+
+
+/* Atomically replace the export cursor. */
+
+static void write_cursor(u32 val) {
+
+  u8* fn  = alloc_printf("%s/store/export_cursor", out_dir);
+  u8* tmp = alloc_printf("%s/store/export_cursor.tmp", out_dir);
+  FILE* f = fopen(tmp, "w");
+
+  if (!f) PFATAL("Unable to create '%s'", tmp);
+  fprintf(f, "%u\n", val);
+  fclose(f);
+
+  if (rename(tmp, fn)) PFATAL("Unable to rename '%s'", tmp);
+
+  ck_free(fn);
+  ck_free(tmp);
+
+}
+
+
+/* Legacy file name for a record; tag is the name tag stored with it. */
+
+static u8* legacy_name(struct store_rec* r, u8* tag) {
+
+  switch (r->kind) {
+
+    case STORE_EQ:
+      return alloc_printf("%s/queue/id:%08u_%d", out_dir, r->id, r->source);
+
+    case STORE_PQ:
+      return alloc_printf("%s-path/_queue/id:%08u_%d", out_dir, r->id,
+                          r->source);
+
+    case STORE_EC:
+      return alloc_printf("%s/crashes/id:%08u_%d", out_dir, r->id, r->source);
+
+    case STORE_PC:
+      return alloc_printf("%s-path/_crashes/id:%08u_%d", out_dir, r->id,
+                          r->source);
+
+    case STORE_HANG:
+      if (!r->tag_len) return alloc_printf("%s/hangs/id:%08u", out_dir, r->id);
+      return alloc_printf("%s/hangs/id:%08u,%.*s", out_dir, r->id,
+                          (int)r->tag_len, tag);
+
+  }
+
+  FATAL("Unknown record kind %u", r->kind);
+
+}
+
+
+/* Write out a single record. Files that already exist are left alone, so
+   that an export interrupted before the cursor was updated can be re-run;
+   trimmed copies (STORE_F_TRIMMED) instead atomically replace the file
+   written for the record they supersede. */
+
+static void export_rec(struct store_rec* r) {
+
+  u8* fn;
+  u8* mem;
+  s32 fd;
+
+  if (seg_fd < 0 || seg_num != r->seg) {
+
+    u8* sfn = alloc_printf("%s/store/seg_%06u", out_dir, r->seg);
+
+    if (seg_fd >= 0) close(seg_fd);
+
+    seg_fd = open(sfn, O_RDONLY);
+    if (seg_fd < 0) PFATAL("Unable to open '%s'", sfn);
+
+    seg_num = r->seg;
+    ck_free(sfn);
+
+  }
+
+  mem = ck_alloc_nozero(r->len + r->tag_len);
+
+  if (pread(seg_fd, mem, r->len + r->tag_len, r->off) != r->len + r->tag_len)
+    PFATAL("Short read from segment %u", r->seg);
+
+  fn = legacy_name(r, mem + r->len);
+
+  if (r->flags & STORE_F_TRIMMED) {
+
+    u8* tmp = alloc_printf("%.*s/.trim_tmp", (int)((u8*)strrchr(fn, '/') - fn),
+                           fn);
+
+    fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) PFATAL("Unable to create '%s'", tmp);
+
+    ck_write(fd, mem, r->len, tmp);
+    close(fd);
+
+    if (rename(tmp, fn)) PFATAL("Unable to rename '%s'", tmp);
+    ck_free(tmp);
+
+  } else {
+
+    fd = open(fn, O_WRONLY | O_CREAT | O_EXCL, 0600);
+
+    if (fd < 0) {
+      if (errno != EEXIST) PFATAL("Unable to create '%s'", fn);
+    } else {
+      ck_write(fd, mem, r->len, fn);
+      close(fd);
+    }
+
+  }
+
+  ck_free(mem);
+  ck_free(fn);
+
+}
+
+
+/* Export everything committed since the last run. Returns the number of
+   records written out. */
+
+static u32 export_new(s32 idx_fd) {
+
+  struct store_hdr hdr;
+  struct store_rec r;
+  u32 cur = read_cursor(), start = cur;
+
+  if (pread(idx_fd, &hdr, sizeof(hdr), 0) != sizeof(hdr))
+    PFATAL("Short read from the store index");
+
+  if (hdr.magic != STORE_MAGIC || hdr.version != STORE_VERSION)
+    FATAL("Bad or unsupported store index in '%s/store'", out_dir);
+
+  while (cur < hdr.rec_count) {
+
+    if (pread(idx_fd, &r, sizeof(r), STORE_REC_OFF(cur)) != sizeof(r))
+      PFATAL("Short read from the store index");
+
+    export_rec(&r);
+    cur++;
+
+  }
+
+  if (cur != start) write_cursor(cur);
+
+  return cur - start;
+
+}
+
+
+/* Remove all marker files from a .state subdirectory. */
+
+static void clear_markers(u8* dir) {
+
+  DIR* d = opendir(dir);
+  struct dirent* de;
+
+  if (!d) PFATAL("Unable to open '%s'", dir);
+
+  while ((de = readdir(d))) {
+
+    u8* fn;
+
+    if (de->d_name[0] == '.') continue;
+
+    fn = alloc_printf("%s/%s", dir, de->d_name);
+    if (unlink(fn)) PFATAL("Unable to delete '%s'", fn);
+    ck_free(fn);
+
+  }
+
+  closedir(d);
+
+}
+
+
+/* Create an empty marker file. */
+
+static void touch_marker(u8* fn) {
+
+  s32 fd = open(fn, O_WRONLY | O_CREAT | O_EXCL, 0600);
+
+  if (fd < 0) PFATAL("Unable to create '%s'", fn);
+  close(fd);
+
+}
+
+
+/* Rebuild favored_edges/ and redundant_edges/ from the queue state file,
+   using the same names afl-fuzz used to create the markers under. Returns
+   the number of queue entries covered. */
+
+static u32 export_markers(void) {
+
+  u8* fn   = alloc_printf("%s/queue/.state/markers", out_dir);
+  u8* fdir = alloc_printf("%s/queue/.state/favored_edges", out_dir);
+  u8* rdir = alloc_printf("%s/queue/.state/redundant_edges", out_dir);
+
+  struct state_hdr* hdr;
+  struct state_chunk* chunks;
+  struct stat st;
+  u32 i, entries;
+  s32 fd;
+
+  fd = open(fn, O_RDONLY);
+  if (fd < 0) PFATAL("Unable to open '%s'", fn);
+
+  if (fstat(fd, &st)) PFATAL("fstat() failed");
+
+  if (st.st_size < sizeof(struct state_hdr))
+    FATAL("Truncated queue state file '%s'", fn);
+
+  hdr = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  if (hdr == MAP_FAILED) PFATAL("Unable to mmap '%s'", fn);
+
+  if (hdr->magic != STATE_MAGIC || hdr->version != STATE_VERSION)
+    FATAL("Bad or unsupported queue state file '%s'", fn);
+
+  chunks  = (struct state_chunk*)(hdr + 1);
+  entries = hdr->entries;
+
+  if (STATE_CHUNK_OFF((entries + STATE_CHUNK - 1) / STATE_CHUNK) > st.st_size)
+    FATAL("Truncated queue state file '%s'", fn);
+
+  clear_markers(fdir);
+  clear_markers(rdir);
+
+  for (i = 0; i < entries; i++) {
+
+    struct state_chunk* c = chunks + i / STATE_CHUNK;
+    u32 slot = i % STATE_CHUNK;
+    u8* mfn;
+
+    if (c->favored[slot >> 3] & (1 << (slot & 7))) {
+
+      mfn = alloc_printf("%s/id:%08u_%d,ref:%u", fdir, c->id[slot],
+                         c->source[slot], c->ref[slot]);
+      touch_marker(mfn);
+      ck_free(mfn);
+
+    }
+
+    if (c->redundant[slot >> 3] & (1 << (slot & 7))) {
+
+      mfn = alloc_printf("%s/id:%08u_%d", rdir, c->id[slot], c->source[slot]);
+      touch_marker(mfn);
+      ck_free(mfn);
+
+    }
+
+  }
+
+  munmap(hdr, st.st_size);
+  close(fd);
+
+  ck_free(fn);
+  ck_free(fdir);
+  ck_free(rdir);
+
+  return entries;
+
+}
+
+
+/* Display usage hints. */
+
+static void usage(u8* argv0) {
+
+  SAYF("\n%s [ options ] -o out_dir\n\n"
+
+       "Required parameters:\n\n"
+
+       "  -o dir        - afl-fuzz output directory\n\n"
+
+       "Optional parameters:\n\n"
+
+       "  -F            - keep running and export new records as they appear\n"
+       "  -M            - rebuild the queue marker directories instead\n\n",
+
+       argv0);
+
+  exit(1);
+
+}
+
+
+/* Main entry point */
+
+int main(int argc, char** argv) {
+
+  s32 opt, idx_fd;
+  u8* fn;
+  u32 total = 0;
+
+  SAYF(cCYA "afl-export " cBRI VERSION cRST " by <lcamtuf@google.com>\n");
+
+  while ((opt = getopt(argc, argv, "+o:FM")) > 0)
+
+    switch (opt) {
+
+      case 'o':
+
+        if (out_dir) FATAL("Multiple -o options not supported");
+        out_dir = optarg;
+        break;
+
+      case 'F':
+
+        follow_mode = 1;
+        break;
+
+      case 'M':
+
+        marker_mode = 1;
+        break;
+
+      default:
+
+        usage(argv[0]);
+
+    }
+
+  if (optind != argc || !out_dir) usage(argv[0]);
+
+  if (marker_mode) {
+
+    if (follow_mode) FATAL("-F and -M are mutually exclusive");
+
+    total = export_markers();
+
+    OKF("Rebuilt markers for %u queue entr%s.", total, total == 1 ? "y" : "ies");
+    exit(0);
+
+  }
+
+  fn = alloc_printf("%s/store/index", out_dir);
+
+  idx_fd = open(fn, O_RDONLY);
+  if (idx_fd < 0) PFATAL("Unable to open '%s'", fn);
+
+  ck_free(fn);
+
+  do {
+
+    u32 cnt = export_new(idx_fd);
+
+    total += cnt;
+    if (follow_mode && !cnt) sleep(1);
+
+  } while (follow_mode);
+
+  OKF("Exported %u record%s.", total, total == 1 ? "" : "s");
+
+  close(idx_fd);
+  exit(0);
+
+}
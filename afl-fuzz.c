@@ -31,6 +31,7 @@
 #include "debug.h"
 #include "alloc-inl.h"
 #include "hash.h"
+#include "store.h"
 
 #include <stdio.h>
 #include <unistd.h>
@@ -43,6 +44,7 @@
 #include <ctype.h>
 #include <fcntl.h>
 #include <termios.h>
+#include <poll.h>
 
 #include <sys/fcntl.h>
 #include <sys/wait.h>
@@ -57,6 +59,11 @@
 
 #include <sys/socket.h>
 
+#ifdef __linux__
+#  include <sched.h>
+#  include <sys/inotify.h>
+#endif /* __linux__ */
+
 #if defined(__APPLE__) || defined(__FreeBSD__) || defined (__OpenBSD__)
 #  include <sys/sysctl.h>
 #endif /* __APPLE__ || __FreeBSD__ || __OpenBSD__ */
@@ -72,6 +79,35 @@
 int sync_times = 0;
 int sync_count = 0;
 int sync_count_crashes = 0;
+static u32 spool_drained;             /* Spool slots handed back so far   */
+
+static u32 sync_backlog,              /* Seeds waiting in producer dirs   */
+           backlog_hwm = BACKLOG_HWM; /* Backlog high-water mark          */
+static u8  bp_throttle;               /* Asking producers to slow down?   */
+
+static u32 ovl_backlog,               /* Backlog that means overload      */
+           ovl_latency,               /* ...or seed age (ms); 0 = off     */
+           ovl_keep = OVERLOAD_KEEP,  /* Seeds per task always run        */
+           ovl_defer_max = OVERLOAD_DEFER_MAX; /* Seeds kept in deferred/ */
+
+static u8  overloaded;                /* Shedding load right now?         */
+static u32 ovl_entered,               /* Times overload mode kicked in    */
+           ovl_deferred,              /* Seeds moved to deferred/         */
+           ovl_dropped,               /* Seeds dropped                    */
+           deferred_cnt,              /* Seeds waiting in deferred/       */
+           deferred_seq;              /* Next ID to use there             */
+static u64 sync_latency;              /* Age of the last seed picked (ms) */
+
+static s32 ino_fd = -1;               /* inotify fd for the producer dirs */
+
+static s32 job_rfd = -1,              /* CPU token pipe from -J (read)    */
+           job_wfd = -1;              /* ...and (write)                   */
+static u8  job_held;                  /* Holding a token?                 */
+static u32 job_slice = JOB_SLICE_MS;  /* How long to hold it (ms)         */
+static u64 job_since;                 /* When it was taken                */
+
+static struct arena seed_arena,       /* Scratch memory for a single seed */
+                    sync_arena;       /* ...and for a whole sync pass     */
 float rareness;
 
 int sync_max_seeds_per = 20;
@@ -138,13 +174,85 @@ static s32 forksrv_pid,               /* PID of the fork server           */
 
 static u8 is_qemu_log = 0;
 static u8 is_trim_case = 0;
+static u8 packed_store = 0;           /* Save seeds to the packed store?  */
+static u8 resuming = 0;               /* Resuming from a checkpoint?      */
+static u32 replay_jobs;               /* Executors for corpus replay (-R) */
+static u32 trim_jobs;                 /* Executors for minimization (-r)  */
+
+/* Seeds waiting to be trimmed in the background (-r), kept as a max-heap on
+   rareness so that the rarest ones get trimmed first. */
+
+struct trim_item {
+
+  float rareness;                     /* Rareness at save time            */
+  u32 qidx,                           /* Queue entry                      */
+      rec;                            /* Store record, with the store     */
+
+};
+
+static struct trim_item* trim_heap;   /* Pending seeds                    */
+static u32 trim_cnt,                  /* ...how many of them              */
+           trim_budget = TRIM_BUDGET, /* Time share for trimming (%)      */
+           trimmed_seeds;             /* Seeds made smaller so far        */
+static u64 trim_us,                   /* Time spent trimming              */
+           trim_saved;                /* Bytes cut off so far             */
+
+static s32 ckpt_pid = -1;             /* Checkpoint writer, if running    */
+static u64 last_ckpt_ms,              /* Time of the last checkpoint      */
+           last_ckpt_execs;           /* total_execs at that point        */
+
+/* Keys added to one of the novelty sets since the last checkpoint, on
+   their way to its journal (see write_checkpoint()). */
+
+struct ckpt_log {
+
+  u64* keys;                          /* Keys not journaled yet           */
+  u32 cnt,                            /* ...how many                      */
+      size,                           /* ...room allocated                */
+      taken;                          /* ...taken by the running writer   */
+  u64 base;                           /* Journal index of keys[0]         */
+
+};
+
+static struct ckpt_log path_log,      /* hash_value_set                   */
+                       var_log,       /* var_cksum_set                    */
+                       crash_log;     /* crash_bucket_set                 */
+
+static s32 store_idx_fd = -1,         /* Packed store index fd            */
+           store_seg_fd = -1;         /* Current store segment fd         */
+
+static struct store_hdr* store_hdr;   /* mmap()ed packed store index      */
+static struct store_rec* store_recs;  /* Records following the header     */
+
+static s32 state_fd = -1;             /* Queue state file fd              */
+
+static struct state_hdr* state_hdr;   /* mmap()ed queue state file        */
+static struct state_chunk*
+  state_chunks;                       /* Chunks following the header      */
 
 static u8* trace_bits;                /* SHM with instrumentation bitmap  */
 
-static short overall_bits[MAP_SIZE];
-static u8  virgin_bits[MAP_SIZE],     /* Regions yet untouched by fuzzing */
-           virgin_hang[MAP_SIZE],     /* Bits we haven't seen in hangs    */
-           virgin_crash[MAP_SIZE];    /* Bits we haven't seen in crashes  */
+static short* overall_bits;           /* Hit counts used by get_rare()    */
+static u8  *virgin_bits,              /* Regions yet untouched by fuzzing */
+           *virgin_hang,              /* Bits we haven't seen in hangs    */
+           *virgin_crash;             /* Bits we haven't seen in crashes  */
+
+static u8  huge_pages,                /* Huge pages requested?            */
+           huge_shm,                  /* ...trace SHM on huge pages?      */
+           huge_maps;                 /* ...virgin maps on huge pages?    */
+
+static u64 total_exec_us,             /* Time spent in run_target() (us)  */
+           last_exec_us;              /* ...by the last run               */
+
+static u8  early_exit;                /* Stop reruns on unexpected edges? */
+static u64 early_exits;               /* Reruns stopped that way          */
+
+static u8  adaptive_tmout = 1;        /* Adapt timeouts of synced seeds?  */
+static u32 hang_cache_hits,           /* Seeds given the short budget     */
+           short_hangs;               /* Hangs caught before -t           */
+
+static u8  crash_buckets = 1;         /* Bucket crashes by PC and stack?  */
+static u32 crash_dups;                /* Crashes dropped as duplicates    */
 
 static s32 shm_id;                    /* ID of the SHM region             */
 
@@ -217,49 +325,151 @@ static u64 total_cal_us,              /* Total calibration time (us)      */
 static u64 total_bitmap_size,         /* Total bit count for all bitmaps  */
            total_bitmap_entries;      /* Number of bitmaps counted        */
 
+/* Saved seeds waiting for deferred calibration, oldest first; when the ring
+   is full, the oldest ones are dropped. */
+
+struct cal_item {
+
+  u32 qidx,                           /* Queue entry                      */
+      rec;                            /* Store record, with the store     */
+
+};
+
+static struct cal_item cal_ring[CAL_QUEUE_SIZE];
+static u32 cal_head,                  /* Oldest pending seed              */
+           cal_cnt,                   /* Pending seeds                    */
+           cal_cycles = CAL_DEFER_CYCLES, /* Reruns per seed              */
+           cal_budget = CAL_BUDGET,   /* Time share for calibration (%)   */
+           cal_dropped;               /* Seeds dropped from a full ring   */
+
+static u8  var_bytes[MAP_SIZE];       /* Edges seen to vary between runs  */
+static u32 var_edges,                 /* ...how many of them              */
+           paths_suppressed;          /* Path finds differing only there  */
+
 static u32 cpu_core_count;            /* CPU core count                   */
 
 static FILE* plot_file;               /* Gnuplot output file              */
 
-struct queue_entry {
+/* Queue entries are stored as a structure of arrays indexed by their u32
+   position in the queue (which is also their slot in the queue state file).
+   The fields looked at by the scoring and culling passes are packed into
+   queue_hot[], two entries per cache line; the rest lives in queue_cold[].
 
-  u8* fname;                          /* File name for the test case      */
-  u32 len;                            /* Input length                     */
+   Both arrays (and the id lookup tables) are mmap()ed from files in
+   queue/.state/, so that the parts of the queue that are of no further use
+   can be dropped from memory and read back in on demand (queue_evict()).
+   File names are not kept at all; queue_fname() derives them from the kind
+   and ID in the queue state file. */
 
-  u8  cal_failed,                     /* Calibration failed?              */
-      trim_done,                      /* Trimmed?                         */
-      // was_fuzzed,                     /* Had any fuzzing done yet?        */
+#define QUEUE_NONE          0xffffffff
+
+struct queue_hot {
+
+  u64 exec_us;                        /* Execution time (us)              */
+
+  u32 len,                            /* Input length                     */
+      exec_cksum,                     /* Checksum of the execution trace  */
+      paths,                          /* getPaths(exec_cksum), last seen  */
+      tc_ref,                         /* Trace bytes ref count            */
+      fuzz_level;                     /* Number of fuzzing iterations     */
+
+  u8  favored,                        /* Currently favored?               */
+      fs_favored,                     /* Marked as favored in the state?  */
+      fs_redundant,                   /* Marked as redundant in the state?*/
+      has_new_cov;                    /* Triggers new coverage?           */
+
+};
+
+struct queue_cold {
+
+  u8  var_behavior,                   /* Variable behavior?               */
       passed_det,                     /* Deterministic stages passed?     */
-      has_new_cov,                    /* Triggers new coverage?           */
-      var_behavior,                   /* Variable behavior?               */
-      favored,                        /* Currently favored?               */
-      fs_redundant,                  /* Marked as redundant in the fs?   */
-      fs_favored;
+      trim_done,                      /* Trimmed?                         */
+      cal_failed;                     /* Calibration failed?              */
 
   u32 bitmap_size,                    /* Number of bits set in bitmap     */
-      fuzz_level,                     /* Number of fuzzing iterations     */      
-      exec_cksum;                     /* Checksum of the execution trace  */
+      mini,                           /* mini_tab[] slot + 1, if any      */
+      reserved;
 
-  u64 exec_us,                        /* Execution time (us)              */
-      handicap,                       /* Number of queue cycles behind    */
+  u64 handicap,                       /* Number of queue cycles behind    */
       depth;                          /* Path depth                       */
 
-  u8* trace_mini;                     /* Trace bytes, if kept             */
-  u32 tc_ref;                         /* Trace bytes ref count            */
-  u32 tc_prev_ref;                    /* Trace bytes prevous ref count    */
+};
+
+/* A file backing one of the queue arrays. */
+
+struct queue_file {
+
+  s32 fd;                             /* Open file                        */
+  u8* mem;                            /* Where it is mapped               */
+  u64 size;                           /* Bytes mapped (= file size)       */
+
+};
+
+/* Compacted traces (trace_mini) of top_rated[] winners. Like a roaring
+   bitmap container, a trace is kept as a sorted array of bitmap offsets
+   while that is smaller than the dense bitmap, and as the bitmap otherwise.
+   With the default map size, that means up to 4096 edges in at most 8 kB
+   plus a small header, rather than 8 kB for every trace. */
+
+#if MAP_SIZE_POW2 <= 16
+typedef u16 mini_edge_t;
+#else
+typedef u32 mini_edge_t;
+#endif /* ^MAP_SIZE_POW2 <= 16 */
+
+#define MINI_MAX_SPARSE     ((MAP_SIZE >> 3) / sizeof(mini_edge_t))
 
-  struct queue_entry *next;           /* Next element, if any             */
-                     // *next_100;       /* 100 elements ahead               */
+struct trace_mini {
+
+  u32 count;                          /* Number of bytes set in the trace */
+  u8  dense;                          /* data[] is a bitmap, not an array */
+  u8  data[];                         /* mini_edge_t[count] or bitmap     */
 
 };
 
-static struct queue_entry *queue,     /* Fuzzing queue (linked list)      */
-                          *queue_cur, /* Current offset within the queue  */
-                          *queue_top; /* Top of the list                  */
-                          // *q_prev100; /* Previous 100 marker              */
+static struct queue_hot* queue_hot;   /* Hot queue fields, by index       */
+static struct queue_cold* queue_cold; /* Cold queue fields, by index      */
+static u32 queue_cap;                 /* Entries allocated in both        */
+
+static u32 queue_cur = QUEUE_NONE;    /* Current offset within the queue  */
+
+static u32* queue_by_id[2];           /* Queue index + 1 by id, eq and pq */
+static u32 queue_by_id_cap[2];        /* Allocated size of those          */
+
+static struct queue_file qf_hot,      /* Backing file of queue_hot[]      */
+                         qf_cold,     /* ...of queue_cold[]               */
+                         qf_ids[2];   /* ...and of queue_by_id[]          */
+
+static u16* queue_live;               /* Entries with tc_ref, per block   */
+static u32  queue_live_cap;           /* Blocks allocated in queue_live   */
+static u8*  queue_gone;               /* Blocks already evicted           */
+static u64  queue_ids_gone[2];        /* Id table bytes already evicted   */
+
+static u64 queue_mem_cap = QUEUE_MEM_MB * 1024 * 1024; /* AFL_QUEUE_MEM   */
+static u64 queue_rss_base;            /* Resident memory before the queue */
 
-static struct queue_entry*
-  top_rated[MAP_SIZE];                /* Top entries for bitmap bytes     */
+static struct trace_mini*
+  mini_tab[MAP_SIZE];                 /* Traces of top_rated[] winners    */
+static u32 mini_free[MAP_SIZE],       /* Free mini_tab[] slots            */
+           mini_free_cnt,             /* ...how many                      */
+           mini_used;                 /* Slots ever handed out            */
+
+static u32 top_rated[MAP_SIZE];       /* Top entries for bitmap bytes     */
+
+static u32 touched[MAP_SIZE],         /* Non-zero trace_bits[] offsets    */
+           touched_cnt;               /* ...as of the last classify_counts */
+
+static u32 cover_cnt[MAP_SIZE];       /* Favored entries hitting each byte */
+
+static u32 cull_dirty[MAP_SIZE],      /* Bytes whose winner may change    */
+           cull_dirty_cnt;            /* ...and how many there are        */
+static u8  cull_dirty_map[MAP_SIZE >> 3]; /* Bitmap of cull_dirty[]       */
+
+static u32* cull_flipped;             /* Entries with stale markers       */
+static u32  cull_flipped_cnt,         /* ...count                         */
+            cull_flipped_cap,         /* ...and allocated size            */
+            culled_paths;             /* Entries cull_queue() has seen    */
 
 
 
@@ -309,19 +519,75 @@ enum {
 };
 
 #include "khash.h"
-KHASH_MAP_INIT_INT(32,u32)
-khash_t(32) *cksum2paths;
 
 KHASH_SET_INIT_INT64(p64)
 khash_t(p64) *hash_value_set;
+khash_t(p64) *var_cksum_set;          /* Masked checksums of saved seeds  */
+khash_t(p64) *crash_bucket_set;       /* Crash buckets (PC, stack hash)   */
+khash_t(p64) *prefilter_cksum_set;    /* Native trace checksums seen      */
+
+static struct ckt_hdr* ckt_hdr;       /* mmap()ed path count table        */
+static struct ckt_slot* ckt_slots;    /* Slots following the header       */
+static u32 ckt_mask,                  /* Number of slots - 1              */
+           ckt_max_used;              /* Fill limit for new checksums     */
+static u8  ckt_shared;                /* Table shared (AFL_CKSUM_TABLE)?  */
+
+
+/* Find the path count table slot of a trace checksum. With create set, a
+   slot is claimed for it if there is none yet. Returns NULL if the checksum
+   is not in the table (or the table is full). */
+
+static struct ckt_slot* ckt_lookup(u32 cksum, u8 create) {
+
+  static u8 full_warned;
+
+  u32 key = cksum ? cksum : 1, i = key & ckt_mask, n;
+
+  for (n = 0; n <= ckt_mask; n++, i = (i + 1) & ckt_mask) {
+
+    u32 cur = ((volatile struct ckt_slot*)ckt_slots)[i].cksum;
+
+    if (cur == key) return ckt_slots + i;
+    if (cur) continue;
+
+    if (!create) return NULL;
+
+    if (ckt_hdr->used >= ckt_max_used) {
+
+      if (!full_warned) {
+        WARNF("Path count table is full, not adding new checksums (start a "
+              "new one with AFL_CKSUM_BITS above %u).", ckt_hdr->size_pow2);
+        full_warned = 1;
+      }
+
+      return NULL;
+
+    }
+
+    cur = __sync_val_compare_and_swap(&ckt_slots[i].cksum, 0, key);
+
+    if (!cur) {
+      __sync_fetch_and_add(&ckt_hdr->used, 1);
+      return ckt_slots + i;
+    }
+
+    if (cur == key) return ckt_slots + i;
 
-static u32 getPaths(u32 key_cksum){
-  khiter_t k = kh_get(32, cksum2paths, key_cksum);
-  if (k != kh_end(cksum2paths)){
-    return kh_value(cksum2paths, k);
-  } else {
-    return 0;
   }
+
+  return NULL;
+
+}
+
+
+/* Number of times a trace checksum has been seen. */
+
+static u32 getPaths(u32 key_cksum) {
+
+  struct ckt_slot* slot = ckt_lookup(key_cksum, 0);
+
+  return slot ? slot->count : 0;
+
 }
 
 
@@ -533,15 +799,34 @@ static u8* DTD(u64 cur_ms, u64 event_ms) {
 
 
 
+/* Get the file name of a queue entry, as saved by save_if_interesting(). The
+   caller has to ck_free() it. */
+
+static u8* queue_fname(u32 idx) {
+
+  struct state_chunk* c = state_chunks + idx / STATE_CHUNK;
+  u32 slot = idx % STATE_CHUNK;
+
+  if (c->kind[slot] == STORE_PQ)
+    return alloc_printf("%s-path/_queue/id:%08u_%d", out_dir, c->id[slot],
+                        c->source[slot]);
+
+  return alloc_printf("%s/queue/id:%08u_%d", out_dir, c->id[slot],
+                      c->source[slot]);
+
+}
+
+
 /* Mark as variable. Create symlinks if possible to make it easier to examine
    the files. */
 
-static void mark_as_variable(struct queue_entry* q) {
+static void mark_as_variable(u32 idx) {
 
-  u8 *fn = strrchr(q->fname, '/') + 1, *ldest;
+  u8 *qfn = queue_fname(idx), *fn = strrchr(qfn, '/') + 1, *ldest;
 
   ldest = alloc_printf("../../%s", fn);
   fn = alloc_printf("%s/queue/.state/variable_behavior/%s", out_dir, fn);
+  ck_free(qfn);
 
   if (symlink(ldest, fn)) {
 
@@ -554,72 +839,125 @@ static void mark_as_variable(struct queue_entry* q) {
   ck_free(ldest);
   ck_free(fn);
 
-  q->var_behavior = 1;
+  queue_cold[idx].var_behavior = 1;
 
 }
 
 
-/* Mark / unmark as redundant (edge-only). This is not used for restoring state,
-   but may be useful for post-processing datasets. */
+/* (Re)map the queue state file with room for the given number of chunks. */
 
-static void mark_as_redundant(struct queue_entry* q, u8 state) {
+static void state_map(u32 chunks) {
 
-  u8* fn;
-  s32 fd;
+  if (state_hdr) munmap(state_hdr, STATE_CHUNK_OFF(state_hdr->chunks));
 
-  if (state == q->fs_redundant) return;
+  if (ftruncate(state_fd, STATE_CHUNK_OFF(chunks)))
+    PFATAL("ftruncate() failed");
 
-  q->fs_redundant = state;
+  state_hdr = mmap(0, STATE_CHUNK_OFF(chunks), PROT_READ | PROT_WRITE,
+                   MAP_SHARED, state_fd, 0);
 
-  fn = strrchr(q->fname, '/');
-  fn = alloc_printf("%s/queue/.state/redundant_edges/%s", out_dir, fn + 1);
+  if (state_hdr == MAP_FAILED) PFATAL("Unable to mmap the queue state file");
 
+  state_chunks = (struct state_chunk*)(state_hdr + 1);
+  state_hdr->chunks = chunks;
 
-  if (state) {
+}
 
-    fd = open(fn, O_WRONLY | O_CREAT | O_EXCL, 0600);
-    if (fd < 0) PFATAL("Unable to create '%s'", fn);
-    close(fd);
 
-  } else {
+/* Create an empty queue state file in <out_dir>/queue/.state/markers, or
+   pick up the existing one when resuming. */
+
+static void setup_state(void) {
+
+  u8* fn = alloc_printf("%s/queue/.state/markers", out_dir);
+  struct state_hdr hdr;
+
+  if (resuming && (state_fd = open(fn, O_RDWR)) >= 0) {
+
+    if (pread(state_fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+        hdr.magic != STATE_MAGIC || hdr.version != STATE_VERSION)
+      FATAL("Bad or unsupported queue state file '%s'", fn);
 
-    if (unlink(fn)) PFATAL("Unable to remove '%s'", fn);
+    ck_free(fn);
+
+    state_map(hdr.chunks);
+    return;
 
   }
 
+  state_fd = open(fn, O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (state_fd < 0) PFATAL("Unable to create '%s'", fn);
+
   ck_free(fn);
 
+  state_map(1);
+
+  state_hdr->magic   = STATE_MAGIC;
+  state_hdr->version = STATE_VERSION;
+
 }
 
 
-static void mark_as_favored(struct queue_entry* q, u8 state)
-{
-  u8* fn;
-  s32 fd;
+/* Register a new queue entry in the state file. */
 
-  // printf("%s,%d,%d,%d,%d\n",q->fname, state, q->fs_favored, q->tc_prev_ref, q->tc_ref);
+static void state_add(u32 idx, u8 kind, u32 id) {
 
-  if (state == q->fs_favored)  return;
+  struct state_chunk* c;
+  u32 slot = idx % STATE_CHUNK;
 
-  q->fs_favored = state;
+  if (idx / STATE_CHUNK >= state_hdr->chunks)
+    state_map(state_hdr->chunks + 1);
 
-  fn = strrchr(q->fname, '/');
+  c = state_chunks + idx / STATE_CHUNK;
 
+  c->id[slot]     = id;
+  c->kind[slot]   = kind;
+  c->source[slot] = filter_index;
 
-  if (state) {
-    fn = alloc_printf("%s/queue/.state/favored_edges/%s,ref:%d", out_dir, fn + 1, q->tc_ref);
-    fd = open(fn, O_WRONLY | O_CREAT | O_EXCL, 0600);
-    if (fd < 0) PFATAL("Unable to create '%s'", fn);
-    q->tc_prev_ref = q->tc_ref;
-    close(fd);
+  state_hdr->entries = idx + 1;
 
-  } else {
-    fn = alloc_printf("%s/queue/.state/favored_edges/%s,ref:%d", out_dir, fn + 1, q->tc_prev_ref);
-    if (unlink(fn)) PFATAL("Unable to remove '%s'", fn);
+}
 
-  }
 
-  ck_free(fn);
+/* Set or clear the bit for a queue entry in one of the state bit arrays. */
+
+static inline void state_set_bit(u8* bits, u32 slot, u8 state) {
+
+  if (state) bits[slot >> 3] |= 1 << (slot & 7);
+  else bits[slot >> 3] &= ~(1 << (slot & 7));
+
+}
+
+
+/* Mark / unmark as redundant (edge-only). This is not used for restoring state,
+   but may be useful for post-processing datasets; afl-export -M turns the
+   state file back into the redundant_edges/ marker directory. */
+
+static void mark_as_redundant(u32 idx, u8 state) {
+
+  if (state == queue_hot[idx].fs_redundant) return;
+
+  queue_hot[idx].fs_redundant = state;
+
+  state_set_bit(state_chunks[idx / STATE_CHUNK].redundant,
+                idx % STATE_CHUNK, state);
+
+}
+
+
+/* Mark / unmark as favored, recording the current ref count alongside. */
+
+static void mark_as_favored(u32 idx, u8 state) {
+
+  struct state_chunk* c = state_chunks + idx / STATE_CHUNK;
+
+  if (state) c->ref[idx % STATE_CHUNK] = queue_hot[idx].tc_ref;
+
+  if (state == queue_hot[idx].fs_favored) return;
+
+  queue_hot[idx].fs_favored = state;
+
+  state_set_bit(c->favored, idx % STATE_CHUNK, state);
 
 }
 
@@ -657,3066 +995,6610 @@ static void extra_blocks(u32 path_id, int q_or_c)
   close(fd);
 
 }
-/* Append new test case to the queue. */
+/* Create (or truncate) the file backing a queue array. */
 
-static void add_to_queue(u8* fname, u32 len, u8 passed_det) {
+static void queue_file_open(struct queue_file* qf, u8* name) {
 
-  struct queue_entry* q = ck_alloc(sizeof(struct queue_entry));
+  u8* fn = alloc_printf("%s/queue/.state/%s", out_dir, name);
 
-  q->fname        = fname;
-  q->len          = len;
-  q->depth        = cur_depth + 1;
-  q->passed_det   = passed_det;
+  qf->fd = open(fn, O_RDWR | O_CREAT | O_TRUNC, 0600);
+  if (qf->fd < 0) PFATAL("Unable to create '%s'", fn);
 
-  if (q->depth > max_depth) max_depth = q->depth;
+  qf->mem  = NULL;
+  qf->size = 0;
 
-  if (queue_top) {
+  ck_free(fn);
 
-    queue_top->next = q;
-    queue_top = q;
+}
 
-  } else { //q_prev100 = 
-      queue = queue_top = q;
-  }
-  queued_paths++;
-  pending_not_fuzzed++;
 
-  // if (!(queued_paths % 100)) {
+/* Grow the file backing a queue array to at least the given size, and map
+   it again. The new part reads as zeroes. */
 
-  //   q_prev100->next_100 = q;
-  //   q_prev100 = q;
+static void queue_file_grow(struct queue_file* qf, u64 need) {
 
-  // }
+  u64 size;
 
-  last_path_time = get_cur_time();
+  if (need <= qf->size) return;
 
-}
+  size = MAX(need, qf->size * 2);
+  size = (size + QUEUE_FILE_GROW - 1) / QUEUE_FILE_GROW * QUEUE_FILE_GROW;
 
+  if (qf->mem) munmap(qf->mem, qf->size);
 
-/* Destroy the entire queue. */
+  if (ftruncate(qf->fd, size)) PFATAL("ftruncate() failed");
 
-static void destroy_queue(void) {
+  qf->mem = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, qf->fd, 0);
+  if (qf->mem == MAP_FAILED) PFATAL("Unable to mmap a queue file");
 
-  struct queue_entry *q = queue, *n;
+  qf->size = size;
 
-  while (q) {
+}
 
-    n = q->next;
-    ck_free(q->fname);
-    ck_free(q->trace_mini);
-    ck_free(q);
-    q = n;
 
-  }
+/* Get the resident memory of the process (bytes), or 0 if we cannot tell. */
 
-}
+static u64 get_rss(void) {
 
+#ifdef __linux__
 
-/* Write bitmap to file. The bitmap is useful mostly for the secret
-   -B option, to focus a separate fuzzing session on a particular
-   interesting input without rediscovering all the others. */
+  FILE* f = fopen("/proc/self/statm", "r");
+  u64 size, res = 0;
 
-static void write_bitmap(void) {
+  if (!f) return 0;
 
-  u8* fname;
-  s32 fd;
+  if (fscanf(f, "%llu %llu", &size, &res) != 2) res = 0;
 
-  if (!bitmap_changed) return;
-  bitmap_changed = 0;
+  fclose(f);
 
-  fname = alloc_printf("%s/fuzz_bitmap", out_dir);
-  fd = open(fname, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  return res * sysconf(_SC_PAGESIZE);
 
-  if (fd < 0) PFATAL("Unable to open '%s'", fname);
+#else
 
-  ck_write(fd, virgin_bits, MAP_SIZE, fname);
-  close(fd);
-  ck_free(fname);
+  return 0;
+
+#endif /* ^__linux__ */
 
 }
 
 
-/* Read bitmap from file. This is for the -B option again. */
+/* Set up the files backing the queue arrays. This is called once the output
+   directory is in place. */
 
-static void read_bitmap(u8* fname) {
+static void setup_queue_files(void) {
 
-  s32 fd = open(fname, O_RDONLY);
+  u8* x = getenv("AFL_QUEUE_MEM");
 
-  if (fd < 0) PFATAL("Unable to open '%s'", fname);
+  if (x) {
 
-  ck_read(fd, virgin_bits, MAP_SIZE, fname);
+    queue_mem_cap = atoi(x);
+    if (!queue_mem_cap) FATAL("Bad value of AFL_QUEUE_MEM");
 
-  close(fd);
+    queue_mem_cap <<= 20;
 
-}
+  }
 
+  queue_rss_base = get_rss();
 
-/* Check if the current execution path brings anything new to the table.
-   Update virgin bits to reflect the finds. Returns 1 if the only change is
-   the hit-count for a particular tuple; 2 if there are new tuples seen. 
-   Updates the map, so subsequent calls will always return 0.
+  queue_file_open(&qf_hot, "queue_hot");
+  queue_file_open(&qf_cold, "queue_cold");
+  queue_file_open(&qf_ids[STORE_EQ], "ids_eq");
+  queue_file_open(&qf_ids[STORE_PQ], "ids_pq");
 
-   This function is called after every exec() on a fairly large buffer, so
-   it needs to be fast. We do this in 32-bit and 64-bit flavors. */
+}
 
-#define FFL(_b) (0xffULL << ((_b) << 3))
-#define FF(_b)  (0xff << ((_b) << 3))
 
-static inline u8 has_new_bits(u8* virgin_map) {
+/* Make room for at least the given number of queue entries. New entries are
+   zeroed; when resuming, the ones that were queued before the restart stay
+   that way, as their traces are gone anyway. */
 
-#ifdef __x86_64__
+static void queue_grow(u32 need) {
 
-  u64* current = (u64*)trace_bits;
-  u64* virgin  = (u64*)virgin_map;
+  u32 blocks = (need + STATE_CHUNK - 1) / STATE_CHUNK;
 
-  u32  i = (MAP_SIZE >> 3);
+  if (need <= queue_cap) return;
 
-#else
+  queue_file_grow(&qf_hot, (u64)need * sizeof(struct queue_hot));
+  queue_file_grow(&qf_cold, (u64)need * sizeof(struct queue_cold));
 
-  u32* current = (u32*)trace_bits;
-  u32* virgin  = (u32*)virgin_map;
+  queue_hot  = (struct queue_hot*)qf_hot.mem;
+  queue_cold = (struct queue_cold*)qf_cold.mem;
+  queue_cap  = MIN(qf_hot.size / sizeof(struct queue_hot),
+                   qf_cold.size / sizeof(struct queue_cold));
 
-  u32  i = (MAP_SIZE >> 2);
+  if (blocks > queue_live_cap) {
 
-#endif /* ^__x86_64__ */
+    queue_live_cap = MAX(blocks, queue_live_cap * 2);
+    queue_live = ck_realloc(queue_live, queue_live_cap * sizeof(u16));
+    queue_gone = ck_realloc(queue_gone, queue_live_cap);
 
-  u8   ret = 0;
+  }
 
-  while (i--) {
+}
 
-#ifdef __x86_64__
 
-    u64 cur = *current;
-    u64 vir = *virgin;
+/* Append new test case to the queue. Edge and path queue entries (kind is
+   STORE_EQ or STORE_PQ) can then be looked up by their id with queue_find().
+   Returns the queue index of the new entry. */
 
-#else
+static u32 add_to_queue(u32 len, u8 passed_det, u8 kind, u32 id) {
 
-    u32 cur = *current;
-    u32 vir = *virgin;
+  u32 idx = queued_paths;
 
-#endif /* ^__x86_64__ */
+  queue_grow(idx + 1);
 
-    /* Optimize for *current == ~*virgin, since this will almost always be the
-       case. */
+  if (kind == STORE_EQ || kind == STORE_PQ) {
 
-    if (cur & vir) {
+    if (id >= queue_by_id_cap[kind]) {
 
-      if (ret < 2) {
+      queue_file_grow(&qf_ids[kind], (u64)(id + 1) * sizeof(u32));
 
-        /* This trace did not have any new bytes yet; see if there's any
-           current[] byte that is non-zero when virgin[] is 0xff. */
+      queue_by_id[kind]     = (u32*)qf_ids[kind].mem;
+      queue_by_id_cap[kind] = qf_ids[kind].size / sizeof(u32);
 
-#ifdef __x86_64__
+    }
 
-        if (((cur & FFL(0)) && (vir & FFL(0)) == FFL(0)) ||
-            ((cur & FFL(1)) && (vir & FFL(1)) == FFL(1)) ||
-            ((cur & FFL(2)) && (vir & FFL(2)) == FFL(2)) ||
-            ((cur & FFL(3)) && (vir & FFL(3)) == FFL(3)) ||
-            ((cur & FFL(4)) && (vir & FFL(4)) == FFL(4)) ||
-            ((cur & FFL(5)) && (vir & FFL(5)) == FFL(5)) ||
-            ((cur & FFL(6)) && (vir & FFL(6)) == FFL(6)) ||
-            ((cur & FFL(7)) && (vir & FFL(7)) == FFL(7))) ret = 2;
-        else ret = 1;
+    queue_by_id[kind][id] = idx + 1;
 
-#else
+  }
 
-        if (((cur & FF(0)) && (vir & FF(0)) == FF(0)) ||
-            ((cur & FF(1)) && (vir & FF(1)) == FF(1)) ||
-            ((cur & FF(2)) && (vir & FF(2)) == FF(2)) ||
-            ((cur & FF(3)) && (vir & FF(3)) == FF(3))) ret = 2;
-        else ret = 1;
+  queue_cold[idx].depth = cur_depth + 1;
+  queue_cold[idx].passed_det = passed_det;
+  queue_hot[idx].len         = len;
 
-#endif /* ^__x86_64__ */
+  if (queue_cold[idx].depth > max_depth) max_depth = queue_cold[idx].depth;
 
-      }
+  queued_paths++;
+  pending_not_fuzzed++;
 
-      *virgin = vir & ~cur;
+  last_path_time = get_cur_time();
 
-    }
+  return idx;
 
-    current++;
-    virgin++;
+}
 
-  }
 
-  if (ret && virgin_map == virgin_bits) bitmap_changed = 1;
+/* Look up the queue index of an edge or path queue entry by its id. Returns
+   QUEUE_NONE if there is no such entry (e.g. from before a resume). */
 
-  return ret;
-
-}
+static inline u32 queue_find(u8 kind, u32 id) {
 
+  if (id >= queue_by_id_cap[kind] || !queue_by_id[kind][id]) return QUEUE_NONE;
+  return queue_by_id[kind][id] - 1;
 
-/* Count the number of bits set in the provided bitmap. Used for the status
-   screen several times every second, does not have to be fast. */
+}
 
-static u32 count_bits(u8* mem) {
 
-  u32* ptr = (u32*)mem;
-  u32  i   = (MAP_SIZE >> 2);
-  u32  ret = 0;
+/* Drop the whole pages within a range of a queue file mapping from memory. */
 
-  while (i--) {
+static void queue_evict_range(void* mem, u64 off, u64 len) {
 
-    u32 v = *(ptr++);
+  u64 page  = sysconf(_SC_PAGESIZE),
+      start = (off + page - 1) & ~(page - 1),
+      end   = (off + len) & ~(page - 1);
 
-    /* This gets called on the inverse, virgin bitmap; optimize for sparse
-       data. */
+  if (end > start) madvise((u8*)mem + start, end - start, MADV_DONTNEED);
 
-    if (v == 0xffffffff) {
-      ret += 32;
-      continue;
-    }
+}
 
-    v -= ((v >> 1) & 0x55555555);
-    v = (v & 0x33333333) + ((v >> 2) & 0x33333333);
-    ret += (((v + (v >> 4)) & 0xF0F0F0F) * 0x01010101) >> 24;
 
-  }
+/* Give back the memory of the parts of the queue that are not going to be
+   looked at again, once we have grown by more than AFL_QUEUE_MEM of resident
+   memory since the queue was set up (or, where we cannot tell, once the
+   queue files are that big). That is every block of STATE_CHUNK entries (but
+   the last one, which is still being filled) where no entry holds a
+   top_rated[] slot: such entries can never win a slot again, since only new
+   entries are scored, so each block only needs to be dropped once. The
+   pages are still in the files and come back if something does touch them. */
 
-  return ret;
+static void queue_evict(void) {
 
-}
+  u64 used = get_rss();
+  u32 b, last;
+  u8  k;
 
+  if (used) used = used > queue_rss_base ? used - queue_rss_base : 0;
+  else used = qf_hot.size + qf_cold.size + qf_ids[STORE_EQ].size +
+              qf_ids[STORE_PQ].size + STATE_CHUNK_OFF(state_hdr->chunks);
 
-/* Count the number of bytes set in the bitmap. Called fairly sporadically,
-   mostly to update the status screen or calibrate and examine confirmed
-   new paths. */
+  if (used <= queue_mem_cap || !queued_paths) return;
 
-static u32 count_bytes(u8* mem) {
+  last = (queued_paths - 1) / STATE_CHUNK;
 
-  u32* ptr = (u32*)mem;
-  u32  i   = (MAP_SIZE >> 2);
-  u32  ret = 0;
+  for (b = 0; b < last; b++) {
 
-  while (i--) {
+    if (queue_live[b] || queue_gone[b]) continue;
 
-    u32 v = *(ptr++);
+    queue_gone[b] = 1;
 
-    if (!v) continue;
-    if (v & FF(0)) ret++;
-    if (v & FF(1)) ret++;
-    if (v & FF(2)) ret++;
-    if (v & FF(3)) ret++;
+    queue_evict_range(queue_hot, (u64)b * STATE_CHUNK * sizeof(struct queue_hot),
+                      STATE_CHUNK * sizeof(struct queue_hot));
+    queue_evict_range(queue_cold, (u64)b * STATE_CHUNK *
+                      sizeof(struct queue_cold),
+                      STATE_CHUNK * sizeof(struct queue_cold));
+    queue_evict_range(state_hdr, STATE_CHUNK_OFF(b), sizeof(struct state_chunk));
 
   }
 
-  return ret;
+  /* The id tables are only used for lookups; keep the tail. */
 
-}
+  for (k = STORE_EQ; k <= STORE_PQ; k++)
+    if (qf_ids[k].size > QUEUE_FILE_GROW &&
+        qf_ids[k].size - QUEUE_FILE_GROW > queue_ids_gone[k]) {
 
+      queue_evict_range(qf_ids[k].mem, queue_ids_gone[k],
+                        qf_ids[k].size - QUEUE_FILE_GROW - queue_ids_gone[k]);
+      queue_ids_gone[k] = qf_ids[k].size - QUEUE_FILE_GROW;
 
-/* Count the number of non-255 bytes set in the bitmap. Used strictly for the
-   status screen, several calls per second or so. */
+    }
 
-static u32 count_non_255_bytes(u8* mem) {
+}
 
-  u32* ptr = (u32*)mem;
-  u32  i   = (MAP_SIZE >> 2);
-  u32  ret = 0;
 
-  while (i--) {
+/* Destroy the entire queue. */
 
-    u32 v = *(ptr++);
+static void destroy_queue(void) {
 
-    /* This is called on the virgin bitmap, so optimize for the most likely
-       case. */
+  u32 i;
+  u8  k;
 
-    if (v == 0xffffffff) continue;
-    if ((v & FF(0)) != FF(0)) ret++;
-    if ((v & FF(1)) != FF(1)) ret++;
-    if ((v & FF(2)) != FF(2)) ret++;
-    if ((v & FF(3)) != FF(3)) ret++;
+  for (i = 0; i < mini_used; i++) ck_free(mini_tab[i]);
+
+  munmap(qf_hot.mem, qf_hot.size);
+  munmap(qf_cold.mem, qf_cold.size);
+  close(qf_hot.fd);
+  close(qf_cold.fd);
 
+  for (k = STORE_EQ; k <= STORE_PQ; k++) {
+    if (qf_ids[k].mem) munmap(qf_ids[k].mem, qf_ids[k].size);
+    close(qf_ids[k].fd);
   }
 
-  return ret;
+  ck_free(queue_live);
+  ck_free(queue_gone);
+  ck_free(cull_flipped);
 
 }
 
 
+/* (Re)map the packed store index with room for cap records. The file only
+   ever grows, so existing records stay where they were. */
 
-/* Destructively simplify trace by eliminating hit count information
-   and replacing it with 0x80 or 0x01 depending on whether the tuple
-   is hit or not. Called on every new crash or hang, should be
-   reasonably fast. */
+static void store_map_index(u32 cap) {
 
-#define AREP4(_sym)   (_sym), (_sym), (_sym), (_sym)
-#define AREP8(_sym)   AREP4(_sym), AREP4(_sym)
-#define AREP16(_sym)  AREP8(_sym), AREP8(_sym)
-#define AREP32(_sym)  AREP16(_sym), AREP16(_sym)
-#define AREP64(_sym)  AREP32(_sym), AREP32(_sym)
-#define AREP128(_sym) AREP64(_sym), AREP64(_sym)
+  if (store_hdr) munmap(store_hdr, STORE_REC_OFF(store_hdr->rec_cap));
 
-static u8 simplify_lookup[256] = { 
-  /*    4 */ 1, 128, 128, 128,
-  /*   +4 */ AREP4(128),
-  /*   +8 */ AREP8(128),
-  /*  +16 */ AREP16(128),
-  /*  +32 */ AREP32(128),
-  /*  +64 */ AREP64(128),
-  /* +128 */ AREP128(128)
-};
+  if (ftruncate(store_idx_fd, STORE_REC_OFF(cap)))
+    PFATAL("ftruncate() failed");
 
-#ifdef __x86_64__
+  store_hdr = mmap(0, STORE_REC_OFF(cap), PROT_READ | PROT_WRITE, MAP_SHARED,
+                   store_idx_fd, 0);
 
-static void simplify_trace(u64* mem) {
+  if (store_hdr == MAP_FAILED) PFATAL("Unable to mmap the store index");
 
-  u32 i = MAP_SIZE >> 3;
+  store_recs = (struct store_rec*)(store_hdr + 1);
+  store_hdr->rec_cap = cap;
 
-  while (i--) {
+}
 
-    /* Optimize for sparse bitmaps. */
 
-    if (*mem) {
+/* Open store segment #seg for appending. */
 
-      u8* mem8 = (u8*)mem;
+static void store_open_seg(u32 seg) {
 
-      mem8[0] = simplify_lookup[mem8[0]];
-      mem8[1] = simplify_lookup[mem8[1]];
-      mem8[2] = simplify_lookup[mem8[2]];
-      mem8[3] = simplify_lookup[mem8[3]];
-      mem8[4] = simplify_lookup[mem8[4]];
-      mem8[5] = simplify_lookup[mem8[5]];
-      mem8[6] = simplify_lookup[mem8[6]];
-      mem8[7] = simplify_lookup[mem8[7]];
+  u8* fn = alloc_printf("%s/store/seg_%06u", out_dir, seg);
 
-    } else *mem = 0x0101010101010101ULL;
+  if (store_seg_fd >= 0) close(store_seg_fd);
 
-    mem++;
+  store_seg_fd = open(fn, O_WRONLY | O_CREAT, 0600);
+  if (store_seg_fd < 0) PFATAL("Unable to create '%s'", fn);
 
-  }
+  ck_free(fn);
 
 }
 
-#else
 
-static void simplify_trace(u32* mem) {
+/* Create an empty packed store in <out_dir>/store/, or keep appending to
+   the existing one when resuming. */
 
-  u32 i = MAP_SIZE >> 2;
+static void setup_store(void) {
 
-  while (i--) {
+  u8* fn = alloc_printf("%s/store/index", out_dir);
+  struct store_hdr hdr;
 
-    /* Optimize for sparse bitmaps. */
+  if (resuming && (store_idx_fd = open(fn, O_RDWR)) >= 0) {
 
-    if (*mem) {
+    if (pread(store_idx_fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+        hdr.magic != STORE_MAGIC || hdr.version != STORE_VERSION)
+      FATAL("Bad or unsupported store index '%s'", fn);
 
-      u8* mem8 = (u8*)mem;
+    ck_free(fn);
 
-      mem8[0] = simplify_lookup[mem8[0]];
-      mem8[1] = simplify_lookup[mem8[1]];
-      mem8[2] = simplify_lookup[mem8[2]];
-      mem8[3] = simplify_lookup[mem8[3]];
+    store_map_index(hdr.rec_cap);
+    store_open_seg(store_hdr->cur_seg);
 
-    } else *mem = 0x01010101;
+    OKF("Appending to the packed store in '%s/store'.", out_dir);
+    return;
 
-    mem++;
   }
 
-}
-
-#endif /* ^__x86_64__ */
-
-/* Destructively classify execution counts in a trace. This is used as a
-   preprocessing step for any newly acquired traces. Called on every exec,
-   must be fast. */
-
-static u8 count_class_lookup[256] = {
-
-  /* 0 - 3:       4 */ 0, 1, 2, 4,
-  /* 4 - 7:      +4 */ AREP4(8),
-  /* 8 - 15:     +8 */ AREP8(16),
-  /* 16 - 31:   +16 */ AREP16(32),
-  /* 32 - 127:  +96 */ AREP64(64), AREP32(64),
-  /* 128+:     +128 */ AREP128(128)
-
-};
-
-#ifdef __x86_64__
+  ck_free(fn);
 
-static inline void classify_counts(u64* mem) {
+  fn = alloc_printf("%s/store", out_dir);
 
-  u32 i = MAP_SIZE >> 3;
+  if (mkdir(fn, 0700)) PFATAL("Unable to create '%s'", fn);
+  ck_free(fn);
 
-  while (i--) {
+  fn = alloc_printf("%s/store/index", out_dir);
 
-    /* Optimize for sparse bitmaps. */
+  store_idx_fd = open(fn, O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (store_idx_fd < 0) PFATAL("Unable to create '%s'", fn);
 
-    if (*mem) {
+  ck_free(fn);
 
-      u8* mem8 = (u8*)mem;
+  store_map_index(STORE_IDX_GROW);
 
-      mem8[0] = count_class_lookup[mem8[0]];
-      mem8[1] = count_class_lookup[mem8[1]];
-      mem8[2] = count_class_lookup[mem8[2]];
-      mem8[3] = count_class_lookup[mem8[3]];
-      mem8[4] = count_class_lookup[mem8[4]];
-      mem8[5] = count_class_lookup[mem8[5]];
-      mem8[6] = count_class_lookup[mem8[6]];
-      mem8[7] = count_class_lookup[mem8[7]];
+  store_hdr->version     = STORE_VERSION;
+  store_hdr->rec_count   = 0;
+  store_hdr->cur_seg     = 0;
+  store_hdr->cur_seg_off = 0;
 
-    }
+  MEM_BARRIER();
+  store_hdr->magic = STORE_MAGIC;
 
-    mem++;
+  store_open_seg(0);
 
-  }
+  OKF("Saving test cases to the packed store in '%s/store'.", out_dir);
 
 }
 
-#else
 
-static inline void classify_counts(u32* mem) {
+/* Append a test case to the packed store. The data (and the name tag, if
+   any) go to the current segment first; the record becomes visible to
+   readers only once it is complete. If orig is given, the new record is a
+   trimmed copy of it and takes its metadata. Returns the record number. */
 
-  u32 i = MAP_SIZE >> 2;
+static u32 store_append(u8 kind, u32 id, void* mem, u32 len, u8* tag,
+                        struct store_rec* orig) {
 
-  while (i--) {
+  struct store_rec* r;
+  u32 n = store_hdr->rec_count, tag_len = tag ? strlen(tag) : 0;
 
-    /* Optimize for sparse bitmaps. */
+  if (store_hdr->cur_seg_off &&
+      store_hdr->cur_seg_off + len + tag_len > STORE_SEG_SIZE) {
 
-    if (*mem) {
+    store_hdr->cur_seg++;
+    store_hdr->cur_seg_off = 0;
+    store_open_seg(store_hdr->cur_seg);
 
-      u8* mem8 = (u8*)mem;
+  }
 
-      mem8[0] = count_class_lookup[mem8[0]];
-      mem8[1] = count_class_lookup[mem8[1]];
-      mem8[2] = count_class_lookup[mem8[2]];
-      mem8[3] = count_class_lookup[mem8[3]];
+  if (n == store_hdr->rec_cap) store_map_index(n + STORE_IDX_GROW);
+
+  lseek(store_seg_fd, store_hdr->cur_seg_off, SEEK_SET);
+  ck_write(store_seg_fd, mem, len, "store segment");
+  if (tag_len) ck_write(store_seg_fd, tag, tag_len, "store segment");
+
+  r = store_recs + n;
+
+  r->id        = id;
+  r->kind      = kind;
+  r->flags     = 0;
+  r->tag_len   = tag_len;
+  r->source    = filter_index;
+  r->seg       = store_hdr->cur_seg;
+  r->off       = store_hdr->cur_seg_off;
+  r->len       = len;
+  r->rareness  = rareness;
+  r->path_hash = *(u64*)(trace_bits + MAP_SIZE);
+
+  if (orig) {
+    r->flags     = STORE_F_TRIMMED;
+    r->source    = orig->source;
+    r->rareness  = orig->rareness;
+    r->path_hash = orig->path_hash;
+  }
 
-    }
+  store_hdr->cur_seg_off += len + tag_len;
 
-    mem++;
+  MEM_BARRIER();
+  store_hdr->rec_count = n + 1;
 
-  }
+  return n;
 
 }
 
-#endif /* ^__x86_64__ */
 
+/* Write out a saved test case: either as a file of its own, or, with the
+   packed store enabled, as a store record (fn is then just a label, and
+   for hangs, the part of the name past the id becomes the record tag). */
 
-/* Get rid of shared memory (atexit handler). */
+static void save_case(u8* fn, u8 kind, u32 id, void* mem, u32 len) {
 
-static void remove_shm(void) {
+  s32 fd;
 
-  shmctl(shm_id, IPC_RMID, NULL);
+  if (packed_store) {
 
-}
+    u8* tag = kind == STORE_HANG ? strchr(strrchr(fn, '/'), ',') : NULL;
 
-/* Compact trace bytes into a smaller bitmap. We effectively just drop the
-   count information here. This is called only sporadically, for some
-   new paths. */
+    store_append(kind, id, mem, len, tag ? tag + 1 : NULL, NULL);
+    return;
 
-static void minimize_bits(u8* dst, u8* src) {
+  }
 
-  u32 i = 0;
+  fd = open(fn, O_WRONLY | O_CREAT | O_EXCL, 0600);
+  if (fd < 0) PFATAL("Unable to create '%s'", fn);
+  ck_write(fd, mem, len, fn);
+  close(fd);
 
-  while (i < MAP_SIZE) {
+}
 
-    if (*(src++)) dst[i >> 3] |= 1 << (i & 7);
-    i++;
 
-  }
+/* Write bitmap to file. The bitmap is useful mostly for the secret
+   -B option, to focus a separate fuzzing session on a particular
+   interesting input without rediscovering all the others. */
 
-}
+static void write_bitmap(void) {
 
+  u8* fname;
+  s32 fd;
 
-/* When we bump into a new path, we call this to see if the path appears
-   more "favorable" than any of the existing ones. The purpose of the
-   "favorables" is to have a minimal set of paths that trigger all the bits
-   seen in the bitmap so far, and focus on fuzzing them at the expense of
-   the rest.
+  if (!bitmap_changed) return;
+  bitmap_changed = 0;
 
-   The first step of the process is to maintain a list of top_rated[] entries
-   for every byte in the bitmap. We win that slot if there is no previous
-   contender, or if the contender has a more favorable speed x size factor. */
+  fname = alloc_printf("%s/fuzz_bitmap", out_dir);
+  fd = open(fname, O_WRONLY | O_CREAT | O_TRUNC, 0600);
 
-static void update_bitmap_score(struct queue_entry* q) {
-  u32 i;
-  u32 fuzz_level = q->fuzz_level;
-  u32 paths = getPaths(q->exec_cksum);
-  u64 fav_factor = q->exec_us * q->len;
-  
-  for (i = 0; i < MAP_SIZE; i++)
+  if (fd < 0) PFATAL("Unable to open '%s'", fname);
 
-    if (trace_bits[i]) {
+  ck_write(fd, virgin_bits, MAP_SIZE, fname);
+  close(fd);
+  ck_free(fname);
 
-      if (top_rated[i]) {
-         u32 top_rated_fuzz_level = top_rated[i]->fuzz_level;
-         u32 top_rated_paths = getPaths(top_rated[i]->exec_cksum);
-         u64 top_rated_fav_factor = top_rated[i]->exec_us * top_rated[i]->len;
-         
-         if (fuzz_level > top_rated_fuzz_level) continue;
-         else if (fuzz_level == top_rated_fuzz_level) {
-           if (paths > top_rated_paths) continue;
-           else if ( paths == top_rated_paths) {
-             if (fav_factor > top_rated_fav_factor) continue;
-           }
-         }
-         //if (fav_factor > top_rated[i]->exec_us * top_rated[i]->len ) continue;
-         
-         /* Looks like we're going to win. Decrease ref count for the
-            previous winner, discard its trace_bits[] if necessary. */
+}
 
-         if (!--top_rated[i]->tc_ref) {
-           ck_free(top_rated[i]->trace_mini);
-           top_rated[i]->trace_mini = 0;
-         }
 
-       }
+/* Read bitmap from file. This is for the -B option again. */
 
-       /* Insert ourselves as the new winner. */
+static void read_bitmap(u8* fname) {
 
-       top_rated[i] = q;
-       q->tc_ref++;
+  s32 fd = open(fname, O_RDONLY);
 
-       if (!q->trace_mini) {
-         q->trace_mini = ck_alloc(MAP_SIZE >> 3);
-         // ACTF("minimizing...");
-         minimize_bits(q->trace_mini, trace_bits);
-       }
+  if (fd < 0) PFATAL("Unable to open '%s'", fname);
 
-       score_changed = 1;
+  ck_read(fd, virgin_bits, MAP_SIZE, fname);
 
-     }
+  close(fd);
 
 }
 
 
-/* The second part of the mechanism discussed above is a routine that
-   goes over top_rated[] entries, and then sequentially grabs winners for
-   previously-unseen bytes (temp_v) and marks them as favored, at least
-   until the next run. The favored entries are given more air time during
-   all fuzzing steps. */
+/* Check if the current execution path brings anything new to the table.
+   Update virgin bits to reflect the finds. Returns 1 if the only change is
+   the hit-count for a particular tuple; 2 if there are new tuples seen. 
+   Updates the map, so subsequent calls will always return 0.
 
-static void cull_queue(void) {
+   This function is called after every exec() on a fairly large buffer, so
+   it needs to be fast. We do this in 32-bit and 64-bit flavors. */
 
-  struct queue_entry* q;
-  static u8 temp_v[MAP_SIZE >> 3];
-  u32 i;
+#define FFL(_b) (0xffULL << ((_b) << 3))
+#define FF(_b)  (0xff << ((_b) << 3))
 
-  if (dumb_mode || !score_changed) return;
+static inline u8 has_new_bits(u8* virgin_map) {
 
-  score_changed = 0;
+#ifdef __x86_64__
 
-  memset(temp_v, 255, MAP_SIZE >> 3);
+  u64* current = (u64*)trace_bits;
+  u64* virgin  = (u64*)virgin_map;
 
-  queued_favored  = 0;
-  pending_favored = 0;
+  u32  i = (MAP_SIZE >> 3);
 
-  q = queue;
+#else
 
+  u32* current = (u32*)trace_bits;
+  u32* virgin  = (u32*)virgin_map;
 
-  while (q) {
-    q->favored = 0;
-    q = q->next;
-  }
+  u32  i = (MAP_SIZE >> 2);
 
-  /* Let's see if anything in the bitmap isn't captured in temp_v.
-     If yes, and if it has a top_rated[] contender, let's use it. */
+#endif /* ^__x86_64__ */
 
-  for (i = 0; i < MAP_SIZE; i++)
-    if (top_rated[i] && (temp_v[i >> 3] & (1 << (i & 7)))) {
+  u8   ret = 0;
 
-      u32 j = MAP_SIZE >> 3;
+  while (i--) {
 
-      /* Remove all bits belonging to the current entry from temp_v. */
+#ifdef __x86_64__
 
-      while (j--) 
-        if (top_rated[i]->trace_mini[j])
-          temp_v[j] &= ~top_rated[i]->trace_mini[j];
+    u64 cur = *current;
+    u64 vir = *virgin;
 
-      top_rated[i]->favored = 1;
-      queued_favored++;
+#else
 
-      //if (!top_rated[i]->was_fuzzed) pending_favored++;
-      if (!top_rated[i]->fuzz_level == 0) pending_favored++;
-    }
+    u32 cur = *current;
+    u32 vir = *virgin;
 
-    q = queue;
-    while (q) {
-      mark_as_favored(q, q->favored);
-      mark_as_redundant(q, !q->favored);
-      q = q->next;
-    }
+#endif /* ^__x86_64__ */
 
-}
+    /* Optimize for *current == ~*virgin, since this will almost always be the
+       case. */
 
+    if (cur & vir) {
 
-/* Configure shared memory and virgin_bits. This is called at startup. */
+      if (ret < 2) {
 
-static void setup_shm(void) {
+        /* This trace did not have any new bytes yet; see if there's any
+           current[] byte that is non-zero when virgin[] is 0xff. */
 
-  u8* shm_str;
+#ifdef __x86_64__
 
-  if (!in_bitmap) memset(virgin_bits, 255, MAP_SIZE);
+        if (((cur & FFL(0)) && (vir & FFL(0)) == FFL(0)) ||
+            ((cur & FFL(1)) && (vir & FFL(1)) == FFL(1)) ||
+            ((cur & FFL(2)) && (vir & FFL(2)) == FFL(2)) ||
+            ((cur & FFL(3)) && (vir & FFL(3)) == FFL(3)) ||
+            ((cur & FFL(4)) && (vir & FFL(4)) == FFL(4)) ||
+            ((cur & FFL(5)) && (vir & FFL(5)) == FFL(5)) ||
+            ((cur & FFL(6)) && (vir & FFL(6)) == FFL(6)) ||
+            ((cur & FFL(7)) && (vir & FFL(7)) == FFL(7))) ret = 2;
+        else ret = 1;
 
-  memset(virgin_hang, 255, MAP_SIZE);
-  memset(virgin_crash, 255, MAP_SIZE);
+#else
 
-  shm_id = shmget(IPC_PRIVATE, MAP_SIZE + 8, IPC_CREAT | IPC_EXCL | 0600);
+        if (((cur & FF(0)) && (vir & FF(0)) == FF(0)) ||
+            ((cur & FF(1)) && (vir & FF(1)) == FF(1)) ||
+            ((cur & FF(2)) && (vir & FF(2)) == FF(2)) ||
+            ((cur & FF(3)) && (vir & FF(3)) == FF(3))) ret = 2;
+        else ret = 1;
 
-  if (shm_id < 0) PFATAL("shmget() failed");
+#endif /* ^__x86_64__ */
 
-  atexit(remove_shm);
+      }
 
-  shm_str = alloc_printf("%d", shm_id);
+      *virgin = vir & ~cur;
 
-  /* If somebody is asking us to fuzz instrumented binaries in dumb mode,
-     we don't want them to detect instrumentation, since we won't be sending
-     fork server commands. This should be replaced with better auto-detection
-     later on, perhaps? */
+    }
 
-  if (dumb_mode != 1)
-    setenv(SHM_ENV_VAR, shm_str, 1);
+    current++;
+    virgin++;
 
-  ck_free(shm_str);
+  }
 
-  trace_bits = shmat(shm_id, NULL, 0);
-  
-  if (!trace_bits) PFATAL("shmat() failed");
+  if (ret && virgin_map == virgin_bits) bitmap_changed = 1;
 
-    ACTF("shm_id: %i", (int)shm_id);
-#ifdef __x86_64__
-    ACTF("trace_bits@ 0x%016lx", (unsigned long)trace_bits);
-    ACTF("virgin_bits@ 0x%016lx", (unsigned long)virgin_bits);
-    ACTF("virgin_hang@ 0x%016lx", (unsigned long)virgin_hang);
-    ACTF("virgin_crash@ 0x%016lx", (unsigned long)virgin_crash);
-#else
-    ACTF("trace_bits@ 0x%08x", (unsigned int)trace_bits);
-    ACTF("virgin_bits@ 0x%08x", (unsigned int)virgin_bits);
-    ACTF("virgin_hang@ 0x%08x", (unsigned int)virgin_hang);
-    ACTF("virgin_crash@ 0x%08x", (unsigned int)virgin_crash);
-#endif /* ^__x86_64__ */
-  
-}
+  return ret;
 
+}
 
 
+/* Count the number of bits set in the provided bitmap. Used for the status
+   screen several times every second, does not have to be fast. */
 
+static u32 count_bits(u8* mem) {
 
+  u32* ptr = (u32*)mem;
+  u32  i   = (MAP_SIZE >> 2);
+  u32  ret = 0;
 
+  while (i--) {
 
+    u32 v = *(ptr++);
 
+    /* This gets called on the inverse, virgin bitmap; optimize for sparse
+       data. */
 
+    if (v == 0xffffffff) {
+      ret += 32;
+      continue;
+    }
 
-/* Helper function for maybe_add_auto() */
+    v -= ((v >> 1) & 0x55555555);
+    v = (v & 0x33333333) + ((v >> 2) & 0x33333333);
+    ret += (((v + (v >> 4)) & 0xF0F0F0F) * 0x01010101) >> 24;
 
-static inline u8 memcmp_nocase(u8* m1, u8* m2, u32 len) {
+  }
 
-  while (len--) if (tolower(*(m1++)) ^ tolower(*(m2++))) return 1;
-  return 0;
+  return ret;
 
 }
 
 
-/* Spin up fork server (instrumented mode only). The idea is explained here:
+/* Count the number of bytes set in the bitmap. Called fairly sporadically,
+   mostly to update the status screen or calibrate and examine confirmed
+   new paths. */
 
-   http://lcamtuf.blogspot.com/2014/10/fuzzing-binaries-without-execve.html
+static u32 count_bytes(u8* mem) {
 
-   In essence, the instrumentation allows us to skip execve(), and just keep
-   cloning a stopped child. So, we just execute once, and then send commands
-   through a pipe. The other part of this logic is in afl-as.h. */
+  u32* ptr = (u32*)mem;
+  u32  i   = (MAP_SIZE >> 2);
+  u32  ret = 0;
 
-static void init_forkserver(char** argv) {
+  while (i--) {
 
-  static struct itimerval it;
-  int st_pipe[2], ctl_pipe[2];
-  int status;
-  s32 rlen;
+    u32 v = *(ptr++);
 
-  ACTF("Spinning up the fork server ");
+    if (!v) continue;
+    if (v & FF(0)) ret++;
+    if (v & FF(1)) ret++;
+    if (v & FF(2)) ret++;
+    if (v & FF(3)) ret++;
 
-  if (pipe(st_pipe) || pipe(ctl_pipe)) PFATAL("pipe() failed");
+  }
 
-  forksrv_pid = fork();
+  return ret;
 
-  if (forksrv_pid < 0) PFATAL("fork() failed");
+}
 
-  if (!forksrv_pid) {
 
-    struct rlimit r;
+/* Count the number of non-255 bytes set in the bitmap. Used strictly for the
+   status screen, several calls per second or so. */
 
-    /* Umpf. On OpenBSD, the default fd limit for root users is set to
-      soft 128. Let's try to fix that... */
+static u32 count_non_255_bytes(u8* mem) {
 
-    if (!getrlimit(RLIMIT_NOFILE, &r) && r.rlim_cur < FORKSRV_FD + 2) {
+  u32* ptr = (u32*)mem;
+  u32  i   = (MAP_SIZE >> 2);
+  u32  ret = 0;
 
-      r.rlim_cur = FORKSRV_FD + 2;
-      setrlimit(RLIMIT_NOFILE, &r); /* Ignore errors */
+  while (i--) {
 
-    }
+    u32 v = *(ptr++);
 
-    if (mem_limit) {
+    /* This is called on the virgin bitmap, so optimize for the most likely
+       case. */
 
-      r.rlim_max = r.rlim_cur = ((rlim_t)mem_limit) << 20;
+    if (v == 0xffffffff) continue;
+    if ((v & FF(0)) != FF(0)) ret++;
+    if ((v & FF(1)) != FF(1)) ret++;
+    if ((v & FF(2)) != FF(2)) ret++;
+    if ((v & FF(3)) != FF(3)) ret++;
 
-#ifdef RLIMIT_AS
+  }
 
-      setrlimit(RLIMIT_AS, &r); /* Ignore errors */
+  return ret;
 
-#else
+}
 
-      /* This takes care of OpenBSD, which doesn't have RLIMIT_AS, but
-         according to reliable sources, RLIMIT_DATA covers anonymous
-         maps - so we should be getting good protection against OOM bugs. */
 
-      setrlimit(RLIMIT_DATA, &r); /* Ignore errors */
 
-#endif /* ^RLIMIT_AS */
+/* Destructively simplify trace by eliminating hit count information
+   and replacing it with 0x80 or 0x01 depending on whether the tuple
+   is hit or not. Called on every new crash or hang, should be
+   reasonably fast. */
 
+#define AREP4(_sym)   (_sym), (_sym), (_sym), (_sym)
+#define AREP8(_sym)   AREP4(_sym), AREP4(_sym)
+#define AREP16(_sym)  AREP8(_sym), AREP8(_sym)
+#define AREP32(_sym)  AREP16(_sym), AREP16(_sym)
+#define AREP64(_sym)  AREP32(_sym), AREP32(_sym)
+#define AREP128(_sym) AREP64(_sym), AREP64(_sym)
 
-    }
+static u8 simplify_lookup[256] = { 
+  /*    4 */ 1, 128, 128, 128,
+  /*   +4 */ AREP4(128),
+  /*   +8 */ AREP8(128),
+  /*  +16 */ AREP16(128),
+  /*  +32 */ AREP32(128),
+  /*  +64 */ AREP64(128),
+  /* +128 */ AREP128(128)
+};
 
-    /* Dumping cores is slow and can lead to anomalies if SIGKILL is delivered
-       before the dump is complete. */
+#ifdef __x86_64__
 
-    r.rlim_max = r.rlim_cur = 0;
+static void simplify_trace(u64* mem) {
 
-    setrlimit(RLIMIT_CORE, &r); /* Ignore errors */
+  u32 i = MAP_SIZE >> 3;
 
-    /* Isolate the process and configure standard descriptors. If out_file is
-       specified, stdin is /dev/null; otherwise, out_fd is cloned instead. */
+  while (i--) {
 
-    setsid();
+    /* Optimize for sparse bitmaps. */
 
-    dup2(dev_null_fd, 1);
-    
-    if(!is_qemu_log)
-      dup2(dev_null_fd, 2);
-    else
-      dup2(qemu_log_fd, 2);
+    if (*mem) {
 
-    if (out_file) {
+      u8* mem8 = (u8*)mem;
 
-        dup2(dev_null_fd, 0);
+      mem8[0] = simplify_lookup[mem8[0]];
+      mem8[1] = simplify_lookup[mem8[1]];
+      mem8[2] = simplify_lookup[mem8[2]];
+      mem8[3] = simplify_lookup[mem8[3]];
+      mem8[4] = simplify_lookup[mem8[4]];
+      mem8[5] = simplify_lookup[mem8[5]];
+      mem8[6] = simplify_lookup[mem8[6]];
+      mem8[7] = simplify_lookup[mem8[7]];
 
-      } else {
+    } else *mem = 0x0101010101010101ULL;
 
-        dup2(out_fd, 0);
-        close(out_fd);
+    mem++;
 
-    }
-    dup2(out_cb_info_fd, CODE_BLOCK_INFO_FD);
-    close(out_cb_info_fd);
+  }
 
-    /* Set up control and status pipes, close the unneeded original fds. */
+}
 
-    if (dup2(ctl_pipe[0], FORKSRV_FD ) < 0) PFATAL("dup2() failed");
-    if (dup2(st_pipe[1], FORKSRV_FD + 1) < 0) PFATAL("dup2() failed");
+#else
 
-    close(ctl_pipe[0]);
-    close(ctl_pipe[1]);
-    close(st_pipe[0]);
-    close(st_pipe[1]);
+static void simplify_trace(u32* mem) {
 
-    close(dev_null_fd);
-    close(dev_urandom_fd);
-    close(fileno(plot_file));
-    /* This should improve performance a bit, since it stops the linker from
-       doing extra work post-fork(). */
+  u32 i = MAP_SIZE >> 2;
 
-    setenv("LD_BIND_NOW", "1", 0);
+  while (i--) {
 
-    /* Set sane defaults for ASAN if nothing else specified. */
+    /* Optimize for sparse bitmaps. */
 
-    setenv("ASAN_OPTIONS", "abort_on_error=1:"
-                           "detect_leaks=0:"
-                           "allocator_may_return_null=1", 0);
+    if (*mem) {
 
-    /* MSAN is tricky, because it doesn't support abort_on_error=1 at this
-       point. So, we do this in a very hacky way. */
+      u8* mem8 = (u8*)mem;
 
-    setenv("MSAN_OPTIONS", "exit_code=" STRINGIFY(MSAN_ERROR) ":"
-                           "msan_track_origins=0", 0);
+      mem8[0] = simplify_lookup[mem8[0]];
+      mem8[1] = simplify_lookup[mem8[1]];
+      mem8[2] = simplify_lookup[mem8[2]];
+      mem8[3] = simplify_lookup[mem8[3]];
 
-    execv(target_path, argv);
-
-    /* Use a distinctive bitmap signature to tell the parent about execv()
-       falling through. */
-
-    *(u32*)trace_bits = EXEC_FAIL_SIG;
-    exit(0);
+    } else *mem = 0x01010101;
 
+    mem++;
   }
 
-  /* Close the unneeded endpoints. */
-
-  close(ctl_pipe[0]);
-  close(st_pipe[1]);
+}
 
-  fsrv_ctl_fd = ctl_pipe[1];
-  fsrv_st_fd = st_pipe[0];
+#endif /* ^__x86_64__ */
 
+/* Destructively classify execution counts in a trace. This is used as a
+   preprocessing step for any newly acquired traces. Called on every exec,
+   must be fast. */
 
-  /* Wait for the fork server to come up, but don't wait too long. */
+static u8 count_class_lookup[256] = {
 
-  it.it_value.tv_sec = ((exec_tmout * FORK_WAIT_MULT) / 1000);
-  it.it_value.tv_usec = ((exec_tmout * FORK_WAIT_MULT) % 1000) * 1000;
+  /* 0 - 3:       4 */ 0, 1, 2, 4,
+  /* 4 - 7:      +4 */ AREP4(8),
+  /* 8 - 15:     +8 */ AREP8(16),
+  /* 16 - 31:   +16 */ AREP16(32),
+  /* 32 - 127:  +96 */ AREP64(64), AREP32(64),
+  /* 128+:     +128 */ AREP128(128)
 
-  setitimer(ITIMER_REAL, &it, NULL);
+};
 
-  rlen = read(fsrv_st_fd, &status, 4);
+#ifdef __x86_64__
 
-  it.it_value.tv_sec = 0;
-  it.it_value.tv_usec = 0;
+static inline void classify_counts(u64* mem) {
 
-  setitimer(ITIMER_REAL, &it, NULL);
+  u32 i = MAP_SIZE >> 3;
 
-  /* If we have a four-byte "hello" message from the server, we're all set.
-     Otherwise, try to figure out what went wrong. */
+  touched_cnt = 0;
 
-  if (rlen == 4) {
-    OKF("All right - fork server is up.");
-    return;
-    // continue;
-  }
+  while (i--) {
 
-  if (child_timed_out)
-    FATAL("Timeout while initializing fork server (adjusting -t may help)");
+    /* Optimize for sparse bitmaps. */
 
-  if (waitpid(forksrv_pid, &status, WUNTRACED) <= 0)
-    PFATAL("waitpid() failed");
+    if (*mem) {
 
-  if (WIFSIGNALED(status)) {
+      u8* mem8 = (u8*)mem;
+      u32 base = ((MAP_SIZE >> 3) - 1 - i) << 3, j;
 
-    if (mem_limit && mem_limit < 500 && uses_asan) {
+      for (j = 0; j < 8; j++)
+        if (mem8[j]) {
+          mem8[j] = count_class_lookup[mem8[j]];
+          touched[touched_cnt++] = base + j;
+        }
 
-      SAYF("\n" cLRD "[-] " cRST
-           "Whoops, the target binary crashed suddenly, before receiving any input\n"
-           "    from the fuzzer! Since it seems to be built with ASAN and you have a\n"
-           "    restrictive memory limit configured, this is expected; please read\n"
-           "    %s/notes_for_asan.txt for help.\n", doc_path);
+    }
 
-    } else if (!mem_limit) {
+    mem++;
 
-      SAYF("\n" cLRD "[-] " cRST
-           "Whoops, the target binary crashed suddenly, before receiving any input\n"
-           "    from the fuzzer! There are several probable explanations:\n\n"
+  }
 
-           "    - The binary is just buggy and explodes entirely on its own. If so, you\n"
-           "      need to fix the underlying problem or find a better replacement.\n\n"
+}
 
-#ifdef __APPLE__
+#else
 
-           "    - On MacOS X, the semantics of fork() syscalls are non-standard and may\n"
-           "      break afl-fuzz performance optimizations when running platform-specific\n"
-           "      targets. To fix this, set AFL_NO_FORKSRV=1 in the environment.\n\n"
+static inline void classify_counts(u32* mem) {
 
-#endif /* __APPLE__ */
+  u32 i = MAP_SIZE >> 2;
 
-           "    - Less likely, there is a horrible bug in the fuzzer. If other options\n"
-           "      fail, poke <lcamtuf@coredump.cx> for troubleshooting tips.\n");
+  touched_cnt = 0;
 
-    } else {
+  while (i--) {
 
-      SAYF("\n" cLRD "[-] " cRST
-           "Whoops, the target binary crashed suddenly, before receiving any input\n"
-           "    from the fuzzer! There are several probable explanations:\n\n"
+    /* Optimize for sparse bitmaps. */
 
-           "    - The current memory limit (%s) is too restrictive, causing the\n"
-           "      target to hit an OOM condition in the dynamic linker. Try bumping up\n"
-           "      the limit with the -m setting in the command line. A simple way confirm\n"
-           "      this diagnosis would be:\n\n"
+    if (*mem) {
 
-#ifdef RLIMIT_AS
-          "      ( ulimit -Sv $[%llu << 10]; /path/to/fuzzed_app )\n\n"
-#else
-          "      ( ulimit -Sd $[%llu << 10]; /path/to/fuzzed_app )\n\n"
-#endif /* ^RLIMIT_AS */
+      u8* mem8 = (u8*)mem;
+      u32 base = ((MAP_SIZE >> 2) - 1 - i) << 2, j;
 
-           "      Tip: you can use ppvm (http://jwilk.net/software/ppvm) to quickly\n"
-           "      estimate the required amount of virtual memory for the binary.\n\n"
+      for (j = 0; j < 4; j++)
+        if (mem8[j]) {
+          mem8[j] = count_class_lookup[mem8[j]];
+          touched[touched_cnt++] = base + j;
+        }
 
-           "    - The binary is just buggy and explodes entirely on its own. If so, you\n"
-           "      need to fix the underlying problem or find a better replacement.\n\n"
+    }
 
-#ifdef __APPLE__
+    mem++;
 
-           "    - On MacOS X, the semantics of fork() syscalls are non-standard and may\n"
-           "      break afl-fuzz performance optimizations when running platform-specific\n"
-           "      targets. To fix this, set AFL_NO_FORKSRV=1 in the environment.\n\n"
+  }
 
-#endif /* __APPLE__ */
+}
 
-           "    - Less likely, there is a horrible bug in the fuzzer. If other options\n"
-           "      fail, poke <lcamtuf@coredump.cx> for troubleshooting tips.\n",
-           DMS(mem_limit << 20), mem_limit - 1);
+#endif /* ^__x86_64__ */
 
-    }
 
-    FATAL("Fork server crashed with signal %d", WTERMSIG(status));
+/* Get rid of shared memory (atexit handler). */
 
-  }
+static void remove_shm(void) {
 
-  if (*(u32*)trace_bits == EXEC_FAIL_SIG)
-    FATAL("Unable to execute target application ('%s')", argv[0]);
+  shmctl(shm_id, IPC_RMID, NULL);
 
-  if (mem_limit && mem_limit < 500 && uses_asan) {
+}
 
-    SAYF("\n" cLRD "[-] " cRST
-           "Hmm, looks like the target binary terminated before we could complete a\n"
-           "    handshake with the injected code. Since it seems to be built with ASAN and\n"
-           "    you have a restrictive memory limit configured, this is expected; please\n"
-           "    read %s/notes_for_asan.txt for help.\n", doc_path);
+/* The trace_mini of a queue entry, or NULL if it has none. Only entries that
+   hold a top_rated[] slot have one, so there are at most MAP_SIZE of them. */
 
-  } else if (!mem_limit) {
+static inline struct trace_mini* queue_mini(u32 idx) {
 
-    SAYF("\n" cLRD "[-] " cRST
-         "Hmm, looks like the target binary terminated before we could complete a\n"
-         "    handshake with the injected code. Perhaps there is a horrible bug in the\n"
-         "    fuzzer. Poke <lcamtuf@coredump.cx> for troubleshooting tips.\n");
+  u32 m = queue_cold[idx].mini;
 
-  } else {
+  return m ? mini_tab[m - 1] : NULL;
 
-    SAYF("\n" cLRD "[-] " cRST
-         "Hmm, looks like the target binary terminated before we could complete a\n"
-         "    handshake with the injected code. There are two probable explanations:\n\n"
+}
 
-         "    - The current memory limit (%s) is too restrictive, causing an OOM\n"
-         "      fault in the dynamic linker. This can be fixed with the -m option. A\n"
-         "      simple way to confirm the diagnosis may be:\n\n"
 
-#ifdef RLIMIT_AS
-        "      ( ulimit -Sv $[%llu << 10]; /path/to/fuzzed_app )\n\n"
-#else
-        "      ( ulimit -Sd $[%llu << 10]; /path/to/fuzzed_app )\n\n"
-#endif /* ^RLIMIT_AS */
+/* Attach a trace_mini to a queue entry, or (with NULL) free the one it has. */
 
-        "      Tip: you can use ppvm (http://jwilk.net/software/ppvm) to quickly\n"
-        "      estimate the required amount of virtual memory for the binary.\n\n"
+static void queue_set_mini(u32 idx, struct trace_mini* mini) {
 
-        "    - Less likely, there is a horrible bug in the fuzzer. If other options\n"
-        "      fail, poke <lcamtuf@coredump.cx> for troubleshooting tips.\n",
-        DMS(mem_limit << 20), mem_limit - 1);
+  u32 m = queue_cold[idx].mini;
 
+  if (m) {
+    ck_free(mini_tab[m - 1]);
+    mini_tab[m - 1] = NULL;
+    mini_free[mini_free_cnt++] = m - 1;
+    queue_cold[idx].mini = 0;
   }
 
-  FATAL("Fork server handshake failed");
+  if (!mini) return;
 
-}
+  m = mini_free_cnt ? mini_free[--mini_free_cnt] : mini_used++;
+
+  mini_tab[m] = mini;
+  queue_cold[idx].mini = m + 1;
 
-float get_rare(u8* trace_map) {
-  int i;
-  float score = 0;
-  for (i = 0; i < MAP_SIZE; i++) {
-    if(overall_bits[i] >= 1024) {
-      continue; // optimization for frequently visited edge. 
-    }
-    else if (trace_map[i] > 0) { 
-      overall_bits[i] = trace_map[i] + overall_bits[i];
-      score += (1.0 * trace_map[i] / overall_bits[i]);
-    }
-  }
-  return score;
 }
-/* Execute target application, monitoring for timeouts. Return status
-   information. The called program will update trace_bits[]. */
 
-static u8 run_target(char** argv) {
 
-  static struct itimerval it;
-  int status = 0;
-  u32 tb4;
+/* Compact trace bytes into a trace_mini. We effectively just drop the
+   count information here. This is called only sporadically, for some
+   new paths, and works off the touched[] list left by classify_counts(),
+   which is already sorted. */
 
-  
-  child_timed_out = 0;
+static struct trace_mini* minimize_bits(void) {
 
-  /* After this memset, trace_bits[] are effectively volatile, so we
-     must prevent any earlier operations from venturing into that
-     territory. */
+  struct trace_mini* m;
+  u32 i;
 
-  memset(trace_bits, 0, MAP_SIZE + 8);
-  MEM_BARRIER();
+  if (touched_cnt <= MINI_MAX_SPARSE) {
 
-  /* If we're running in "dumb" mode, we can't rely on the fork server
-     logic compiled into the target program, so we will just keep calling
-     execve(). There is a bit of code duplication between here and 
-     init_forkserver(), but c'est la vie. */
+    mini_edge_t* e;
 
-  if (dumb_mode == 1 || no_forkserver) {
+    m = ck_alloc_nozero(sizeof(struct trace_mini) +
+                        touched_cnt * sizeof(mini_edge_t));
+    e = (mini_edge_t*)m->data;
 
-    child_pid= fork();
+    for (i = 0; i < touched_cnt; i++) e[i] = touched[i];
 
-    if (child_pid < 0) PFATAL("fork() failed");
+    m->dense = 0;
 
-    if (!child_pid) {
+  } else {
 
-      struct rlimit r;
+    m = ck_alloc(sizeof(struct trace_mini) + (MAP_SIZE >> 3));
 
-      if (mem_limit) {
+    for (i = 0; i < touched_cnt; i++)
+      m->data[touched[i] >> 3] |= 1 << (touched[i] & 7);
 
-        r.rlim_max = r.rlim_cur = ((rlim_t)mem_limit) << 20;
+    m->dense = 1;
 
-#ifdef RLIMIT_AS
+  }
 
-        setrlimit(RLIMIT_AS, &r); /* Ignore errors */
+  m->count = touched_cnt;
+  return m;
 
-#else
+}
 
-        setrlimit(RLIMIT_DATA, &r); /* Ignore errors */
 
-#endif /* ^RLIMIT_AS */
+/* Call _fn(offset) for each byte set in a trace_mini, in ascending order. */
 
-      }
+#define MINI_FOREACH(_m, _fn) do { \
+    u32 _i, _j; \
+    if (!(_m)->dense) { \
+      mini_edge_t* _e = (mini_edge_t*)(_m)->data; \
+      for (_i = 0; _i < (_m)->count; _i++) _fn(_e[_i]); \
+    } else for (_i = 0; _i < (MAP_SIZE >> 3); _i++) { \
+      u8 _b = (_m)->data[_i]; \
+      for (_j = 0; _b; _j++, _b >>= 1) \
+        if (_b & 1) _fn((_i << 3) + _j); \
+    } \
+  } while (0)
 
-      r.rlim_max = r.rlim_cur = 0;
 
-      setrlimit(RLIMIT_CORE, &r); /* Ignore errors */
+/* Queue up a bitmap byte for re-evaluation by the next cull_queue(). */
 
-      /* Isolate the process and configure standard descriptors. If out_file is
-         specified, stdin is /dev/null; otherwise, out_fd is cloned instead. */
+static inline void cull_mark_dirty(u32 i) {
 
-      setsid();
+  if (cull_dirty_map[i >> 3] & (1 << (i & 7))) return;
 
-      dup2(dev_null_fd, 1);
-      dup2(dev_null_fd, 2);
+  cull_dirty_map[i >> 3] |= 1 << (i & 7);
+  cull_dirty[cull_dirty_cnt++] = i;
 
-      if (out_file) {
+}
 
-        dup2(dev_null_fd, 0);
 
-      } else {
+/* Remember that the markers of a queue entry need to be written out by the
+   next cull_queue(). Duplicates are harmless. */
 
-        dup2(out_fd, 0);
-        close(out_fd);
+static void cull_mark_flipped(u32 idx) {
 
-      }
+  if (cull_flipped_cnt == cull_flipped_cap) {
 
-      close(dev_null_fd);
+    cull_flipped_cap = cull_flipped_cap ? cull_flipped_cap * 2 : 64;
+    cull_flipped = ck_realloc(cull_flipped, cull_flipped_cap * sizeof(u32));
 
-      /* Set sane defaults for ASAN if nothing else specified. */
+  }
 
-      setenv("ASAN_OPTIONS", "abort_on_error=1:"
-                             "detect_leaks=0:"
-                             "allocator_may_return_null=1", 0);
+  cull_flipped[cull_flipped_cnt++] = idx;
 
-      setenv("MSAN_OPTIONS", "exit_code=" STRINGIFY(MSAN_ERROR) ":"
-                             "msan_track_origins=0", 0);
+}
 
-      execv(target_path, argv);
 
-      /* Use a distinctive bitmap value to tell the parent about execv()
-         falling through. */
+/* Count a bitmap byte as covered by one more, or one fewer, favored entry. */
 
-      *(u32*)trace_bits = EXEC_FAIL_SIG;
-      exit(0);
+static inline void cover_add(u32 i) {
 
-    }
+  cover_cnt[i]++;
 
-  } else {
+}
 
-    s32 res;
+static inline void cover_sub(u32 i) {
 
-    /* In non-dumb mode, we have the fork server up and running, so simply
-       tell it to have at it, and then read back PID. */
+  if (!--cover_cnt[i] && top_rated[i] != QUEUE_NONE) cull_mark_dirty(i);
 
-    if ((res = write(fsrv_ctl_fd, &status, 4)) != 4) {
+}
 
-      if (stop_soon) return 0;
-      RPFATAL(res, "Unable to request new process from fork server (OOM?)");
 
-    }
+/* Add a queue entry to the favored set, or take it out. The bytes set in its
+   trace_mini are counted in cover_cnt[]; when taking an entry out, bytes no
+   longer covered by anything favored are queued up for re-evaluation. */
 
-    if ((res = read(fsrv_st_fd, &child_pid, 4)) != 4) {
+static void set_favored(u32 idx, u8 state) {
 
-      if (stop_soon) return 0;
-      RPFATAL(res, "Unable to request new process from fork server (OOM?)");
+  struct queue_hot* q = queue_hot + idx;
+  struct trace_mini* mini = queue_mini(idx);
 
-    }
+  if (q->favored == state) return;
 
-    if (child_pid <= 0) FATAL("Fork server is misbehaving (OOM?)");
+  q->favored = state;
 
+  if (state) {
+    queued_favored++;
+    if (!q->fuzz_level == 0) pending_favored++;
+  } else {
+    queued_favored--;
+    if (!q->fuzz_level == 0) pending_favored--;
   }
-  
 
-  /* Configure timeout, as requested by user, then wait for child to terminate. */
+  if (state) MINI_FOREACH(mini, cover_add);
+  else MINI_FOREACH(mini, cover_sub);
 
-  it.it_value.tv_sec = (exec_tmout / 1000);
-  it.it_value.tv_usec = (exec_tmout % 1000) * 1000;
+  cull_mark_flipped(idx);
 
-  setitimer(ITIMER_REAL, &it, NULL);
+}
+
+
+/* When we bump into a new path, we call this to see if the path appears
+   more "favorable" than any of the existing ones. The purpose of the
+   "favorables" is to have a minimal set of paths that trigger all the bits
+   seen in the bitmap so far, and focus on fuzzing them at the expense of
+   the rest.
+
+   The first step of the process is to maintain a list of top_rated[] entries
+   for every byte in the bitmap. We win that slot if there is no previous
+   contender, or if the contender has a more favorable speed x size factor.
+   Every byte that changes hands is queued up for cull_queue().
+
+   Only the bytes in touched[] are looked at, so trace_bits must still be
+   the classified trace of this entry. Path counts are taken from the paths
+   cached in each entry when it was scored, rather than looked up again. */
+
+static void update_bitmap_score(u32 idx) {
+
+  struct queue_hot* q = queue_hot + idx;
+  u32 n, i;
+  u32 fuzz_level = q->fuzz_level;
+  u32 paths = q->paths = getPaths(q->exec_cksum);
+  u64 fav_factor = q->exec_us * q->len;
+  
+  for (n = 0; n < touched_cnt; n++) {
+
+       i = touched[n];
+
+       if (top_rated[i] != QUEUE_NONE) {
+         u32 t_idx = top_rated[i];
+         struct queue_hot* t = queue_hot + t_idx;
+         u32 top_rated_fuzz_level = t->fuzz_level;
+         u32 top_rated_paths;
+         u64 top_rated_fav_factor = t->exec_us * t->len;
+         
+         if (t_idx == idx) continue;
+
+         if (fuzz_level > top_rated_fuzz_level) continue;
+         else if (fuzz_level == top_rated_fuzz_level) {
+
+           /* Path counts only go up, so the holder's is looked up again
+              rather than taken from when it was scored. */
+
+           top_rated_paths = t->paths = getPaths(t->exec_cksum);
+
+           if (paths > top_rated_paths) continue;
+           else if ( paths == top_rated_paths) {
+             if (fav_factor > top_rated_fav_factor) continue;
+           }
+         }
+         
+         /* Looks like we're going to win. Decrease ref count for the
+            previous winner, discard its trace_bits[] if necessary. A
+            favored entry that no longer wins anything is evicted from
+            the favored set first. */
+
+         if (!--t->tc_ref) {
+           set_favored(t_idx, 0);
+           queue_set_mini(t_idx, NULL);
+           queue_live[t_idx / STATE_CHUNK]--;
+         } else if (t->favored) cull_mark_flipped(t_idx);
+
+       }
+
+       /* Insert ourselves as the new winner. */
+
+       top_rated[i] = idx;
+
+       if (!q->tc_ref++) {
+         queue_set_mini(idx, minimize_bits());
+         queue_live[idx / STATE_CHUNK]++;
+       }
+
+       cull_mark_dirty(i);
+       score_changed = 1;
+
+  }
+
+  if (q->favored) cull_mark_flipped(idx);
+
+}
+
+
+/* The second part of the mechanism discussed above is a routine that
+   goes over the top_rated[] entries that changed hands since the last call,
+   and grabs winners for bytes not covered by any favored entry (cover_cnt)
+   and marks them as favored. Entries leave the favored set when they stop
+   winning anything (see update_bitmap_score()). The favored entries are
+   given more air time during all fuzzing steps.
+
+   Only the state file markers of entries whose status or ref count changed,
+   and of entries queued since the last call, are written out. */
+
+static void cull_queue(void) {
+
+  u32 i;
+
+  if (dumb_mode || !score_changed) return;
+
+  score_changed = 0;
+
+  for (i = 0; i < cull_dirty_cnt; i++) {
+
+    u32 e = cull_dirty[i];
+
+    cull_dirty_map[e >> 3] &= ~(1 << (e & 7));
+
+    if (top_rated[e] == QUEUE_NONE || cover_cnt[e]) continue;
+
+    set_favored(top_rated[e], 1);
+
+  }
+
+  cull_dirty_cnt = 0;
+
+  for (i = 0; i < cull_flipped_cnt; i++) {
+
+    u32 idx = cull_flipped[i];
+
+    mark_as_favored(idx, queue_hot[idx].favored);
+    mark_as_redundant(idx, !queue_hot[idx].favored);
+
+  }
+
+  cull_flipped_cnt = 0;
+
+  for (i = culled_paths; i < queued_paths; i++) {
+    mark_as_favored(i, queue_hot[i].favored);
+    mark_as_redundant(i, !queue_hot[i].favored);
+  }
+
+  culled_paths = queued_paths;
+
+  queue_evict();
+
+}
+
+
+#define HUGE_ROUND(_s) (((_s) + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1))
+
+/* Allocate the virgin maps and the get_rare() hit counts. They all go into
+   a single mapping, which with AFL_HUGE_PAGES is backed by one huge page if
+   the system has any to spare, or is at least offered to transparent huge
+   pages. This must be called before -B is processed. */
+
+static void setup_maps(void) {
+
+  u32 size = MAP_SIZE * (3 + sizeof(short));
+  u8* mem = MAP_FAILED;
+
+  huge_pages = !!getenv("AFL_HUGE_PAGES");
+
+  if (huge_pages) {
+
+#ifdef MAP_HUGETLB
+
+    mem = mmap(0, HUGE_ROUND(size), PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+
+#endif /* MAP_HUGETLB */
+
+    if (mem != MAP_FAILED) huge_maps = 1;
+
+  }
+
+  if (mem == MAP_FAILED) {
+
+    mem = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+               -1, 0);
+
+    if (mem == MAP_FAILED) PFATAL("Unable to allocate the virgin maps");
+
+#ifdef MADV_HUGEPAGE
+    if (huge_pages) madvise(mem, size, MADV_HUGEPAGE);
+#endif /* MADV_HUGEPAGE */
+
+  }
+
+  virgin_bits  = mem;
+  virgin_hang  = mem + MAP_SIZE;
+  virgin_crash = mem + MAP_SIZE * 2;
+  overall_bits = (short*)(mem + MAP_SIZE * 3);
+
+}
+
+
+/* Create a SHM region for a trace map. With AFL_HUGE_PAGES, try huge pages
+   first; if the system has none to give, say so once and stick to normal
+   pages from then on. */
+
+static s32 create_trace_shm(void) {
+
+  static u8 huge_failed;
+  s32 ret;
+
+#ifdef SHM_HUGETLB
+
+  if (huge_pages && !huge_failed) {
+
+    ret = shmget(IPC_PRIVATE, HUGE_ROUND(TRACE_SHM_SIZE),
+                 IPC_CREAT | IPC_EXCL | SHM_HUGETLB | 0600);
+
+    if (ret >= 0) {
+      huge_shm = 1;
+      return ret;
+    }
+
+    WARNF("No huge pages for the trace map, falling back to normal pages.");
+    huge_failed = 1;
+    huge_shm    = 0;
+
+  }
+
+#endif /* SHM_HUGETLB */
+
+  ret = shmget(IPC_PRIVATE, TRACE_SHM_SIZE, IPC_CREAT | IPC_EXCL | 0600);
+
+  if (ret < 0) PFATAL("shmget() failed");
+
+  return ret;
+
+}
+
+
+/* Configure shared memory and virgin_bits. This is called at startup. */
+
+static void setup_shm(void) {
+
+  u8* shm_str;
+
+  if (!in_bitmap) memset(virgin_bits, 255, MAP_SIZE);
+
+  memset(virgin_hang, 255, MAP_SIZE);
+  memset(virgin_crash, 255, MAP_SIZE);
+
+  shm_id = create_trace_shm();
+
+  atexit(remove_shm);
+
+  shm_str = alloc_printf("%d", shm_id);
+
+  /* If somebody is asking us to fuzz instrumented binaries in dumb mode,
+     we don't want them to detect instrumentation, since we won't be sending
+     fork server commands. This should be replaced with better auto-detection
+     later on, perhaps? */
+
+  if (dumb_mode != 1)
+    setenv(SHM_ENV_VAR, shm_str, 1);
+
+  ck_free(shm_str);
+
+  trace_bits = shmat(shm_id, NULL, 0);
+  
+  if (!trace_bits) PFATAL("shmat() failed");
+
+    ACTF("shm_id: %i", (int)shm_id);
+#ifdef __x86_64__
+    ACTF("trace_bits@ 0x%016lx", (unsigned long)trace_bits);
+    ACTF("virgin_bits@ 0x%016lx", (unsigned long)virgin_bits);
+    ACTF("virgin_hang@ 0x%016lx", (unsigned long)virgin_hang);
+    ACTF("virgin_crash@ 0x%016lx", (unsigned long)virgin_crash);
+#else
+    ACTF("trace_bits@ 0x%08x", (unsigned int)trace_bits);
+    ACTF("virgin_bits@ 0x%08x", (unsigned int)virgin_bits);
+    ACTF("virgin_hang@ 0x%08x", (unsigned int)virgin_hang);
+    ACTF("virgin_crash@ 0x%08x", (unsigned int)virgin_crash);
+#endif /* ^__x86_64__ */
+  
+}
+
+
+
+
+
+
+
+
+
+
+/* Helper function for maybe_add_auto() */
+
+static inline u8 memcmp_nocase(u8* m1, u8* m2, u32 len) {
+
+  while (len--) if (tolower(*(m1++)) ^ tolower(*(m2++))) return 1;
+  return 0;
+
+}
+
+
+/* Spin up fork server (instrumented mode only). The idea is explained here:
+
+   http://lcamtuf.blogspot.com/2014/10/fuzzing-binaries-without-execve.html
+
+   In essence, the instrumentation allows us to skip execve(), and just keep
+   cloning a stopped child. So, we just execute once, and then send commands
+   through a pipe. The other part of this logic is in afl-as.h. */
+
+static void init_forkserver(char** argv) {
+
+  static struct itimerval it;
+  int st_pipe[2], ctl_pipe[2];
+  int status;
+  s32 rlen;
+
+  ACTF("Spinning up the fork server ");
+
+  if (pipe(st_pipe) || pipe(ctl_pipe)) PFATAL("pipe() failed");
+
+  forksrv_pid = fork();
+
+  if (forksrv_pid < 0) PFATAL("fork() failed");
+
+  if (!forksrv_pid) {
+
+    struct rlimit r;
+
+    /* Umpf. On OpenBSD, the default fd limit for root users is set to
+      soft 128. Let's try to fix that... */
+
+    if (!getrlimit(RLIMIT_NOFILE, &r) && r.rlim_cur < FORKSRV_FD + 2) {
+
+      r.rlim_cur = FORKSRV_FD + 2;
+      setrlimit(RLIMIT_NOFILE, &r); /* Ignore errors */
+
+    }
+
+    if (mem_limit) {
+
+      r.rlim_max = r.rlim_cur = ((rlim_t)mem_limit) << 20;
+
+#ifdef RLIMIT_AS
+
+      setrlimit(RLIMIT_AS, &r); /* Ignore errors */
+
+#else
+
+      /* This takes care of OpenBSD, which doesn't have RLIMIT_AS, but
+         according to reliable sources, RLIMIT_DATA covers anonymous
+         maps - so we should be getting good protection against OOM bugs. */
+
+      setrlimit(RLIMIT_DATA, &r); /* Ignore errors */
+
+#endif /* ^RLIMIT_AS */
+
+
+    }
+
+    /* Dumping cores is slow and can lead to anomalies if SIGKILL is delivered
+       before the dump is complete. */
+
+    r.rlim_max = r.rlim_cur = 0;
+
+    setrlimit(RLIMIT_CORE, &r); /* Ignore errors */
+
+    /* Isolate the process and configure standard descriptors. If out_file is
+       specified, stdin is /dev/null; otherwise, out_fd is cloned instead. */
+
+    setsid();
+
+    dup2(dev_null_fd, 1);
+    
+    if(!is_qemu_log)
+      dup2(dev_null_fd, 2);
+    else
+      dup2(qemu_log_fd, 2);
+
+    if (out_file) {
+
+        dup2(dev_null_fd, 0);
+
+      } else {
+
+        dup2(out_fd, 0);
+        close(out_fd);
+
+    }
+    dup2(out_cb_info_fd, CODE_BLOCK_INFO_FD);
+    close(out_cb_info_fd);
+
+    /* Set up control and status pipes, close the unneeded original fds. */
+
+    if (dup2(ctl_pipe[0], FORKSRV_FD ) < 0) PFATAL("dup2() failed");
+    if (dup2(st_pipe[1], FORKSRV_FD + 1) < 0) PFATAL("dup2() failed");
+
+    close(ctl_pipe[0]);
+    close(ctl_pipe[1]);
+    close(st_pipe[0]);
+    close(st_pipe[1]);
+
+    close(dev_null_fd);
+    close(dev_urandom_fd);
+    close(fileno(plot_file));
+    /* This should improve performance a bit, since it stops the linker from
+       doing extra work post-fork(). */
+
+    setenv("LD_BIND_NOW", "1", 0);
+
+    /* Set sane defaults for ASAN if nothing else specified. */
+
+    setenv("ASAN_OPTIONS", "abort_on_error=1:"
+                           "detect_leaks=0:"
+                           "allocator_may_return_null=1", 0);
+
+    /* MSAN is tricky, because it doesn't support abort_on_error=1 at this
+       point. So, we do this in a very hacky way. */
+
+    setenv("MSAN_OPTIONS", "exit_code=" STRINGIFY(MSAN_ERROR) ":"
+                           "msan_track_origins=0", 0);
+
+    execv(target_path, argv);
+
+    /* Use a distinctive bitmap signature to tell the parent about execv()
+       falling through. */
+
+    *(u32*)trace_bits = EXEC_FAIL_SIG;
+    exit(0);
+
+  }
+
+  /* Close the unneeded endpoints. */
+
+  close(ctl_pipe[0]);
+  close(st_pipe[1]);
+
+  fsrv_ctl_fd = ctl_pipe[1];
+  fsrv_st_fd = st_pipe[0];
+
+
+  /* Wait for the fork server to come up, but don't wait too long. */
+
+  it.it_value.tv_sec = ((exec_tmout * FORK_WAIT_MULT) / 1000);
+  it.it_value.tv_usec = ((exec_tmout * FORK_WAIT_MULT) % 1000) * 1000;
+
+  setitimer(ITIMER_REAL, &it, NULL);
+
+  rlen = read(fsrv_st_fd, &status, 4);
+
+  it.it_value.tv_sec = 0;
+  it.it_value.tv_usec = 0;
+
+  setitimer(ITIMER_REAL, &it, NULL);
+
+  /* If we have a four-byte "hello" message from the server, we're all set.
+     Otherwise, try to figure out what went wrong. */
+
+  if (rlen == 4) {
+    OKF("All right - fork server is up.");
+    return;
+    // continue;
+  }
+
+  if (child_timed_out)
+    FATAL("Timeout while initializing fork server (adjusting -t may help)");
+
+  if (waitpid(forksrv_pid, &status, WUNTRACED) <= 0)
+    PFATAL("waitpid() failed");
+
+  if (WIFSIGNALED(status)) {
+
+    if (mem_limit && mem_limit < 500 && uses_asan) {
+
+      SAYF("\n" cLRD "[-] " cRST
+           "Whoops, the target binary crashed suddenly, before receiving any input\n"
+           "    from the fuzzer! Since it seems to be built with ASAN and you have a\n"
+           "    restrictive memory limit configured, this is expected; please read\n"
+           "    %s/notes_for_asan.txt for help.\n", doc_path);
+
+    } else if (!mem_limit) {
+
+      SAYF("\n" cLRD "[-] " cRST
+           "Whoops, the target binary crashed suddenly, before receiving any input\n"
+           "    from the fuzzer! There are several probable explanations:\n\n"
+
+           "    - The binary is just buggy and explodes entirely on its own. If so, you\n"
+           "      need to fix the underlying problem or find a better replacement.\n\n"
+
+#ifdef __APPLE__
+
+           "    - On MacOS X, the semantics of fork() syscalls are non-standard and may\n"
+           "      break afl-fuzz performance optimizations when running platform-specific\n"
+           "      targets. To fix this, set AFL_NO_FORKSRV=1 in the environment.\n\n"
+
+#endif /* __APPLE__ */
+
+           "    - Less likely, there is a horrible bug in the fuzzer. If other options\n"
+           "      fail, poke <lcamtuf@coredump.cx> for troubleshooting tips.\n");
+
+    } else {
+
+      SAYF("\n" cLRD "[-] " cRST
+           "Whoops, the target binary crashed suddenly, before receiving any input\n"
+           "    from the fuzzer! There are several probable explanations:\n\n"
+
+           "    - The current memory limit (%s) is too restrictive, causing the\n"
+           "      target to hit an OOM condition in the dynamic linker. Try bumping up\n"
+           "      the limit with the -m setting in the command line. A simple way confirm\n"
+           "      this diagnosis would be:\n\n"
+
+#ifdef RLIMIT_AS
+          "      ( ulimit -Sv $[%llu << 10]; /path/to/fuzzed_app )\n\n"
+#else
+          "      ( ulimit -Sd $[%llu << 10]; /path/to/fuzzed_app )\n\n"
+#endif /* ^RLIMIT_AS */
+
+           "      Tip: you can use ppvm (http://jwilk.net/software/ppvm) to quickly\n"
+           "      estimate the required amount of virtual memory for the binary.\n\n"
+
+           "    - The binary is just buggy and explodes entirely on its own. If so, you\n"
+           "      need to fix the underlying problem or find a better replacement.\n\n"
+
+#ifdef __APPLE__
+
+           "    - On MacOS X, the semantics of fork() syscalls are non-standard and may\n"
+           "      break afl-fuzz performance optimizations when running platform-specific\n"
+           "      targets. To fix this, set AFL_NO_FORKSRV=1 in the environment.\n\n"
+
+#endif /* __APPLE__ */
+
+           "    - Less likely, there is a horrible bug in the fuzzer. If other options\n"
+           "      fail, poke <lcamtuf@coredump.cx> for troubleshooting tips.\n",
+           DMS(mem_limit << 20), mem_limit - 1);
+
+    }
+
+    FATAL("Fork server crashed with signal %d", WTERMSIG(status));
+
+  }
+
+  if (*(u32*)trace_bits == EXEC_FAIL_SIG)
+    FATAL("Unable to execute target application ('%s')", argv[0]);
+
+  if (mem_limit && mem_limit < 500 && uses_asan) {
+
+    SAYF("\n" cLRD "[-] " cRST
+           "Hmm, looks like the target binary terminated before we could complete a\n"
+           "    handshake with the injected code. Since it seems to be built with ASAN and\n"
+           "    you have a restrictive memory limit configured, this is expected; please\n"
+           "    read %s/notes_for_asan.txt for help.\n", doc_path);
+
+  } else if (!mem_limit) {
+
+    SAYF("\n" cLRD "[-] " cRST
+         "Hmm, looks like the target binary terminated before we could complete a\n"
+         "    handshake with the injected code. Perhaps there is a horrible bug in the\n"
+         "    fuzzer. Poke <lcamtuf@coredump.cx> for troubleshooting tips.\n");
+
+  } else {
+
+    SAYF("\n" cLRD "[-] " cRST
+         "Hmm, looks like the target binary terminated before we could complete a\n"
+         "    handshake with the injected code. There are two probable explanations:\n\n"
+
+         "    - The current memory limit (%s) is too restrictive, causing an OOM\n"
+         "      fault in the dynamic linker. This can be fixed with the -m option. A\n"
+         "      simple way to confirm the diagnosis may be:\n\n"
+
+#ifdef RLIMIT_AS
+        "      ( ulimit -Sv $[%llu << 10]; /path/to/fuzzed_app )\n\n"
+#else
+        "      ( ulimit -Sd $[%llu << 10]; /path/to/fuzzed_app )\n\n"
+#endif /* ^RLIMIT_AS */
+
+        "      Tip: you can use ppvm (http://jwilk.net/software/ppvm) to quickly\n"
+        "      estimate the required amount of virtual memory for the binary.\n\n"
+
+        "    - Less likely, there is a horrible bug in the fuzzer. If other options\n"
+        "      fail, poke <lcamtuf@coredump.cx> for troubleshooting tips.\n",
+        DMS(mem_limit << 20), mem_limit - 1);
+
+  }
+
+  FATAL("Fork server handshake failed");
+
+}
+
+float get_rare(u8* trace_map) {
+  int i;
+  float score = 0;
+  for (i = 0; i < MAP_SIZE; i++) {
+    if(overall_bits[i] >= 1024) {
+      continue; // optimization for frequently visited edge. 
+    }
+    else if (trace_map[i] > 0) { 
+      overall_bits[i] = trace_map[i] + overall_bits[i];
+      score += (1.0 * trace_map[i] / overall_bits[i]);
+    }
+  }
+  return score;
+}
+/* Execute target application, monitoring for timeouts. Return status
+   information. The called program will update trace_bits[]. Only runs with
+   score set count towards the rareness scores (overall_bits); reruns of
+   something already scored (trimming, calibration) leave them alone. */
+
+static u8 run_target(char** argv, u8 score) {
+
+  static struct itimerval it;
+  int status = 0;
+  u32 tb4;
+  u64 start_us = get_cur_time_us();
+
+  
+  child_timed_out = 0;
+
+  /* After this memset, trace_bits[] are effectively volatile, so we
+     must prevent any earlier operations from venturing into that
+     territory. */
+
+  memset(trace_bits, 0, EXPECT_ON_OFF);
+  *(u32*)(trace_bits + CRASH_REC_OFF) = 0;
+  MEM_BARRIER();
+
+  /* If we're running in "dumb" mode, we can't rely on the fork server
+     logic compiled into the target program, so we will just keep calling
+     execve(). There is a bit of code duplication between here and 
+     init_forkserver(), but c'est la vie. */
+
+  if (dumb_mode == 1 || no_forkserver) {
+
+    child_pid= fork();
+
+    if (child_pid < 0) PFATAL("fork() failed");
+
+    if (!child_pid) {
+
+      struct rlimit r;
+
+      if (mem_limit) {
+
+        r.rlim_max = r.rlim_cur = ((rlim_t)mem_limit) << 20;
+
+#ifdef RLIMIT_AS
+
+        setrlimit(RLIMIT_AS, &r); /* Ignore errors */
+
+#else
+
+        setrlimit(RLIMIT_DATA, &r); /* Ignore errors */
+
+#endif /* ^RLIMIT_AS */
+
+      }
+
+      r.rlim_max = r.rlim_cur = 0;
+
+      setrlimit(RLIMIT_CORE, &r); /* Ignore errors */
+
+      /* Isolate the process and configure standard descriptors. If out_file is
+         specified, stdin is /dev/null; otherwise, out_fd is cloned instead. */
+
+      setsid();
+
+      dup2(dev_null_fd, 1);
+      dup2(dev_null_fd, 2);
+
+      if (out_file) {
+
+        dup2(dev_null_fd, 0);
+
+      } else {
+
+        dup2(out_fd, 0);
+        close(out_fd);
+
+      }
+
+      close(dev_null_fd);
+
+      /* Set sane defaults for ASAN if nothing else specified. */
+
+      setenv("ASAN_OPTIONS", "abort_on_error=1:"
+                             "detect_leaks=0:"
+                             "allocator_may_return_null=1", 0);
+
+      setenv("MSAN_OPTIONS", "exit_code=" STRINGIFY(MSAN_ERROR) ":"
+                             "msan_track_origins=0", 0);
+
+      execv(target_path, argv);
+
+      /* Use a distinctive bitmap value to tell the parent about execv()
+         falling through. */
+
+      *(u32*)trace_bits = EXEC_FAIL_SIG;
+      exit(0);
+
+    }
+
+  } else {
+
+    s32 res;
+
+    /* In non-dumb mode, we have the fork server up and running, so simply
+       tell it to have at it, and then read back PID. */
+
+    if ((res = write(fsrv_ctl_fd, &status, 4)) != 4) {
+
+      if (stop_soon) return 0;
+      RPFATAL(res, "Unable to request new process from fork server (OOM?)");
+
+    }
+
+    if ((res = read(fsrv_st_fd, &child_pid, 4)) != 4) {
+
+      if (stop_soon) return 0;
+      RPFATAL(res, "Unable to request new process from fork server (OOM?)");
+
+    }
+
+    if (child_pid <= 0) FATAL("Fork server is misbehaving (OOM?)");
+
+  }
+  
+
+  /* Configure timeout, as requested by user, then wait for child to terminate. */
+
+  it.it_value.tv_sec = (exec_tmout / 1000);
+  it.it_value.tv_usec = (exec_tmout % 1000) * 1000;
+
+  setitimer(ITIMER_REAL, &it, NULL);
 
   /* The SIGALRM handler simply kills the child_pid and sets child_timed_out. */
 
-  if (dumb_mode == 1 || no_forkserver) {
+  if (dumb_mode == 1 || no_forkserver) {
+
+    if (waitpid(child_pid, &status, WUNTRACED) <= 0) PFATAL("waitpid() failed");
+
+  } else {
+
+    s32 res;
+    res = read(fsrv_st_fd, &status, 4);
+    
+    if (res != 4) {
+      
+      if (stop_soon) return 0;
+      RPFATAL(res, "Unable to communicate with fork server");
+
+    }
+
+  }
+ 
+  child_pid = 0;
+  it.it_value.tv_sec = 0;
+  it.it_value.tv_usec = 0;
+
+  setitimer(ITIMER_REAL, &it, NULL);
+
+  total_execs++;
+  last_exec_us   = get_cur_time_us() - start_us;
+  total_exec_us += last_exec_us;
+  
+
+    /* Any subsequent operations on trace_bits must not be moved by the
+       compiler above this point. Past this location, trace_bits[] behave
+       very normally and do not have to be treated as volatile. */
+
+  MEM_BARRIER();
+
+  tb4 = *(u32*)trace_bits;
+
+  // need to get rareness score here! 
+  if (score) rareness = get_rare(trace_bits); // before classify counts! 
+  //rareness = 0.0;
+
+#ifdef __x86_64__
+  classify_counts((u64*)trace_bits);
+#else
+  classify_counts((u32*)trace_bits);
+#endif /* ^__x86_64__ */
+  
+  /* Report outcome to caller. */
+
+  if (child_timed_out) return FAULT_HANG;
+
+  if (WIFSIGNALED(status) && !stop_soon) {
+    kill_signal = WTERMSIG(status);
+    return FAULT_CRASH;
+  }
+
+/* A somewhat nasty hack for MSAN, which doesn't support abort_on_error and
+   must use a special exit code. */
+
+  if (uses_asan && WEXITSTATUS(status) == MSAN_ERROR) {
+    kill_signal = 0;
+    return FAULT_CRASH;
+  }
+
+  if ((dumb_mode == 1 || no_forkserver) && tb4 == EXEC_FAIL_SIG)
+    return FAULT_ERROR;
+
+  return FAULT_NONE;
+
+}
+
+
+/* Write modified data to file for testing. If out_file is set, the old file
+   is unlinked and a new one is created. Otherwise, out_fd is rewound and
+   truncated. */
+
+static void write_to_testcase(void* mem, u32 len) {
+
+  s32 fd = out_fd;
+
+  if (out_file) {
+
+    unlink(out_file); /* Ignore errors. */
+
+    fd = open(out_file, O_WRONLY | O_CREAT | O_EXCL, 0600);
+
+    if (fd < 0) PFATAL("Unable to create '%s'", out_file);
+
+  } else lseek(fd, 0, SEEK_SET);
+
+  ck_write(fd, mem, len, out_file);
+
+  if (!out_file) {
+
+    if (ftruncate(fd, len)) PFATAL("ftruncate() failed");
+    lseek(fd, 0, SEEK_SET);
+
+  } else close(fd);
+
+}
+
+
+
+
+
+/* Find first power of two greater or equal to val. */
+
+static u32 next_p2(u32 val) {
+
+  u32 ret = 1;
+  while (val > ret) ret <<= 1;
+  return ret;
+
+} 
+
+
+
+/* Take a CPU token from the supervisor (-J) before running anything,
+   unless we already hold one. Without -J, there is nothing to take. */
+
+static void job_get(void) {
+
+  u8 c;
+
+  if (job_rfd < 0 || job_held) return;
+
+  if (read(job_rfd, &c, 1) != 1) {
+    if (stop_soon) return;
+    PFATAL("Unable to read from the job token pipe");
+  }
+
+  job_held  = 1;
+  job_since = get_cur_time();
+
+}
+
+
+/* Hand the token back (also an atexit handler). */
+
+static void job_put(void) {
+
+  if (!job_held) return;
+
+  if (write(job_wfd, "+", 1) != 1) WARNF("Unable to return a job token");
+
+  job_held = 0;
+
+}
+
+
+/* Between seeds: once our slice is used up, let the other filters waiting
+   for a token have a go. Spare tokens in the pipe mean nobody is waiting,
+   so we just carry on. Otherwise, the token is handed back, and we wait
+   (up to JOB_HANDOFF_US) for a waiter to pick it up before queueing up for
+   one again; reading it straight back would almost always beat the waiter
+   woken up by the write, and the slices would never change hands. */
+
+static void job_yield(void) {
+
+  s32 avail = 0;
+  u32 waited = 0;
+
+  if (!job_held || get_cur_time() - job_since < job_slice) return;
+
+  if (!ioctl(job_rfd, FIONREAD, &avail) && avail > 0) {
+    job_since = get_cur_time();
+    return;
+  }
+
+  job_put();
+
+  while (waited < JOB_HANDOFF_US && !ioctl(job_rfd, FIONREAD, &avail) &&
+         avail > 0) {
+    usleep(50);
+    waited += 50;
+  }
+
+  job_get();
+
+}
+
+
+/* An executor: a fork server of its own, with its own SHM trace map and
+   input file, so that several test cases can be in flight at once. The
+   main fork server (fsrv_*, trace_bits, out_fd) stays as it is; executors
+   are started by temporarily swapping their fields into those globals
+   around init_forkserver(). */
+
+struct executor {
+
+  s32 shm_id;                         /* SHM region of this executor      */
+  u8* trace_bits;                     /* ...and where it is mapped        */
+
+  s32 fsrv_pid,                       /* Fork server PID                  */
+      ctl_fd,                         /* Fork server control pipe (write) */
+      st_fd,                          /* Fork server status pipe (read)   */
+      child_pid,                      /* Current child, if busy           */
+      out_fd,                         /* Input fd (stdin mode)            */
+      status,                         /* waitpid() status of the child    */
+      cpu;                            /* Core it is pinned to, or -1      */
+
+  u8* out_file;                       /* Input file (file mode)           */
+  char** argv;                        /* Target argv using out_file       */
+
+  u8  busy,                           /* Running a test case?             */
+      timed_out;                      /* Killed on timeout?               */
+
+  u32 tmout;                          /* Timeout of the current test case */
+
+  u64 start_ms,                       /* When the test case was started   */
+      start_us,                       /* ...the same, in us               */
+      exec_us;                        /* How long the last one took (us)  */
+
+};
+
+static struct executor* exec_pool;    /* Extra executors, if any          */
+static u32 exec_pool_size,            /* Number of executors in use       */
+           exec_pool_alloc;           /* ...and started (the rest parked) */
+
+static u32 pool_min,                  /* Autoscaling bounds (AFL_POOL)    */
+           pool_max,
+           pool_reserve = POOL_RESERVE, /* Cores left to other processes  */
+           pool_resizes;              /* Times the pool was resized       */
+
+static u8  pool_pin = 1;              /* Pin executors to idle cores?     */
+
+static struct executor prefilter;     /* Native build run ahead of QEMU   */
+static u8* prefilter_path;            /* ...its binary (AFL_PREFILTER)    */
+static u8* prefilter_virgin;          /* ...and the edges it has not hit  */
+static u32 prefilter_skips,           /* Seeds kept away from QEMU        */
+           prefilter_passes;          /* Seeds handed on to QEMU          */
+
+
+/* Get rid of the SHM regions of executors (atexit handler). */
+
+static void remove_exec_shm(void) {
+
+  u32 i;
+
+  for (i = 0; i < exec_pool_alloc; i++) {
+    if (!exec_pool[i].trace_bits) continue;
+    shmctl(exec_pool[i].shm_id, IPC_RMID, NULL);
+    if (exec_pool[i].fsrv_pid > 0) kill(exec_pool[i].fsrv_pid, SIGKILL);
+  }
+
+}
+
+
+/* Start a single executor for argv (and target_path). Its input file is
+   named after out_file or .cur_input, plus suffix. */
+
+static void start_executor(struct executor* e, char** argv, u8* suffix) {
+
+  s32 sv_fsrv_pid = forksrv_pid, sv_ctl_fd = fsrv_ctl_fd,
+      sv_st_fd = fsrv_st_fd, sv_out_fd = out_fd;
+  u8* sv_trace_bits = trace_bits;
+  u8* sv_out_file = out_file;
+  u8* shm_str;
+  u32 j, argc;
+
+  for (argc = 0; argv[argc]; argc++);
+
+  e->shm_id = create_trace_shm();
+
+  e->trace_bits = shmat(e->shm_id, NULL, 0);
+  if (e->trace_bits == (void*)-1) PFATAL("shmat() failed");
+
+  /* Each executor gets its own copy of the input file; in file mode, the
+     target argv has to point to it instead of out_file. */
+
+  e->argv = ck_alloc((argc + 1) * sizeof(char*));
+
+  if (out_file) {
+
+    e->out_file = alloc_printf("%s.%s", out_file, suffix);
+
+    for (j = 0; j < argc; j++)
+      e->argv[j] = strcmp(argv[j], out_file) ? argv[j] : (char*)e->out_file;
+
+  } else {
+
+    u8* fn = alloc_printf("%s/.cur_input.%s", out_dir, suffix);
+
+    unlink(fn); /* Ignore errors */
+
+    e->out_fd = open(fn, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (e->out_fd < 0) PFATAL("Unable to create '%s'", fn);
+
+    ck_free(fn);
+
+    memcpy(e->argv, argv, argc * sizeof(char*));
+
+  }
+
+  shm_str = alloc_printf("%d", e->shm_id);
+  setenv(SHM_ENV_VAR, shm_str, 1);
+  ck_free(shm_str);
+
+  trace_bits = e->trace_bits;
+  out_file   = e->out_file;
+  out_fd     = e->out_fd;
+
+  init_forkserver(e->argv);
+
+  e->fsrv_pid = forksrv_pid;
+  e->ctl_fd   = fsrv_ctl_fd;
+  e->st_fd    = fsrv_st_fd;
+
+  shm_str = alloc_printf("%d", shm_id);
+  setenv(SHM_ENV_VAR, shm_str, 1);
+  ck_free(shm_str);
+
+  forksrv_pid = sv_fsrv_pid;
+  fsrv_ctl_fd = sv_ctl_fd;
+  fsrv_st_fd  = sv_st_fd;
+  out_fd      = sv_out_fd;
+  trace_bits  = sv_trace_bits;
+  out_file    = sv_out_file;
+
+}
+
+
+#ifdef __linux__
+
+static u32 *core_idle,                /* Idle ticks per core, last sample */
+           *core_busy;                /* ...and busy ticks                */
+static double* core_idle_frac;        /* Idle share between the last two  */
+
+
+/* Sample per-core idle time from /proc/stat; called before every pool
+   resize, so the shares cover the time since the previous one. */
+
+static void sample_core_idle(void) {
+
+  FILE* f = fopen("/proc/stat", "r");
+  u8 tmp[1024], first = !core_idle;
+
+  if (!f || !cpu_core_count) {
+    if (f) fclose(f);
+    return;
+  }
+
+  if (first) {
+    core_idle      = ck_alloc(cpu_core_count * sizeof(u32));
+    core_busy      = ck_alloc(cpu_core_count * sizeof(u32));
+    core_idle_frac = ck_alloc(cpu_core_count * sizeof(double));
+  }
+
+  while (fgets(tmp, sizeof(tmp), f)) {
+
+    u32 cpu, user, nice, sys, idle, d_idle, d_busy;
+
+    if (strncmp(tmp, "cpu", 3) || !isdigit(tmp[3])) continue;
+
+    if (sscanf(tmp + 3, "%u %u %u %u %u", &cpu, &user, &nice, &sys,
+               &idle) != 5 || cpu >= cpu_core_count) continue;
+
+    d_idle = idle - core_idle[cpu];
+    d_busy = user + nice + sys - core_busy[cpu];
+
+    core_idle[cpu] = idle;
+    core_busy[cpu] = user + nice + sys;
+
+    core_idle_frac[cpu] = (first || !(d_idle + d_busy)) ? 1.0 :
+                          ((double)d_idle) / (d_idle + d_busy);
+
+  }
+
+  fclose(f);
+
+}
+
+
+/* Pin the fork server of an executor (and so every child it forks from now
+   on) to the core that was the most idle in the last sample, skipping cores
+   other executors in use are pinned to. If there is no such core, the
+   executor is left to the scheduler. */
+
+static void pin_executor(struct executor* e) {
+
+  cpu_set_t c;
+  s32 best = -1, i;
+  u32 j;
+
+  e->cpu = -1;
+
+  if (!pool_pin || !core_idle_frac) return;
+
+  for (i = 0; i < cpu_core_count; i++) {
+
+    for (j = 0; j < exec_pool_size; j++)
+      if (exec_pool + j != e && exec_pool[j].cpu == i) break;
+
+    if (j < exec_pool_size) continue;
+
+    if (best < 0 || core_idle_frac[i] > core_idle_frac[best]) best = i;
+
+  }
+
+  if (best < 0) return;
+
+  CPU_ZERO(&c);
+  CPU_SET(best, &c);
+
+  if (sched_setaffinity(e->fsrv_pid, sizeof(c), &c)) return;
+
+  e->cpu = best;
+
+}
+
+#endif /* __linux__ */
+
+
+/* Make cnt executors available for the target, starting the ones that are
+   not there yet. Going down just parks the executors past cnt: their fork
+   servers stay up, so taking them back into use later is cheap. */
+
+static void init_exec_pool(char** argv, u32 cnt) {
+
+  u32 i, old = exec_pool_size;
+
+  if (!exec_pool_alloc) atexit(remove_exec_shm);
+
+  if (cnt > exec_pool_alloc) {
+
+    exec_pool = ck_realloc(exec_pool, cnt * sizeof(struct executor));
+
+    for (i = exec_pool_alloc; i < cnt; i++) {
+
+      u8* suffix = alloc_printf("%u", i);
+
+      exec_pool[i].cpu = -1;
+      exec_pool_alloc = i + 1;
+      start_executor(exec_pool + i, argv, suffix);
+
+      ck_free(suffix);
+
+    }
+
+  }
+
+  exec_pool_size = cnt;
+
+#ifdef __linux__
+
+  /* Whatever comes (back) into use gets a core of its own. */
+
+  for (i = old; i < cnt; i++) pin_executor(exec_pool + i);
+
+#else
+
+  (void)old;
+
+#endif /* __linux__ */
+
+}
+
+
+/* Hand a test case to an idle executor and return without waiting for it. */
+
+static void exec_launch(struct executor* e, void* mem, u32 len) {
+
+  s32 res, fd = e->out_fd;
+
+  if (e->out_file) {
+
+    unlink(e->out_file); /* Ignore errors. */
+
+    fd = open(e->out_file, O_WRONLY | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) PFATAL("Unable to create '%s'", e->out_file);
+
+    ck_write(fd, mem, len, e->out_file);
+    close(fd);
+
+  } else {
+
+    lseek(fd, 0, SEEK_SET);
+    ck_write(fd, mem, len, "input file");
+    if (ftruncate(fd, len)) PFATAL("ftruncate() failed");
+    lseek(fd, 0, SEEK_SET);
+
+  }
+
+  memset(e->trace_bits, 0, EXPECT_ON_OFF);
+  *(u32*)(e->trace_bits + CRASH_REC_OFF) = 0;
+  MEM_BARRIER();
+
+  if ((res = write(e->ctl_fd, &e->status, 4)) != 4) {
+    if (stop_soon) return;
+    RPFATAL(res, "Unable to request new process from fork server (OOM?)");
+  }
+
+  if ((res = read(e->st_fd, &e->child_pid, 4)) != 4) {
+    if (stop_soon) return;
+    RPFATAL(res, "Unable to request new process from fork server (OOM?)");
+  }
+
+  if (e->child_pid <= 0) FATAL("Fork server is misbehaving (OOM?)");
+
+  e->busy      = 1;
+  e->timed_out = 0;
+  e->tmout     = exec_tmout;
+  e->start_us  = get_cur_time_us();
+  e->start_ms  = e->start_us / 1000;
+
+}
+
+
+/* Wait until executor want (or, if NULL, any executor) is done, reaping
+   every other executor that finishes in the meantime and killing the ones
+   that run past the timeout they were launched with. */
+
+static void exec_wait(struct executor* want) {
+
+  struct pollfd pfd[exec_pool_size];
+  u32 map[exec_pool_size];
+
+  while (!stop_soon) {
+
+    u64 cur_ms = get_cur_time();
+    s32 tmout = exec_tmout, i, cnt = 0, any_done = 0;
+
+    for (i = 0; i < exec_pool_size; i++) {
+
+      struct executor* e = exec_pool + i;
+
+      if (!e->busy) { if (!want || e == want) any_done = 1; continue; }
+
+      if (!e->timed_out && cur_ms - e->start_ms >= e->tmout) {
+        kill(e->child_pid, SIGKILL);
+        e->timed_out = 1;
+      }
+
+      if (!e->timed_out) tmout = MIN(tmout, e->start_ms + e->tmout - cur_ms);
+
+      pfd[cnt].fd     = e->st_fd;
+      pfd[cnt].events = POLLIN;
+      map[cnt++]      = i;
+
+    }
+
+    if (any_done) return;
+
+    if (poll(pfd, cnt, tmout) < 0) {
+      if (errno == EINTR) continue;
+      PFATAL("poll() failed");
+    }
+
+    for (i = 0; i < cnt; i++) {
+
+      struct executor* e = exec_pool + map[i];
+      s32 res;
+
+      if (!(pfd[i].revents & (POLLIN | POLLHUP))) continue;
+
+      if ((res = read(e->st_fd, &e->status, 4)) != 4) {
+        if (stop_soon) return;
+        RPFATAL(res, "Unable to communicate with fork server");
+      }
+
+      e->busy = 0;
+      e->child_pid = 0;
+      e->exec_us = get_cur_time_us() - e->start_us;
+      total_execs++;
+
+    }
+
+  }
+
+}
+
+
+/* Classify the outcome of the last test case run by an executor, the same
+   way run_target() does. */
+
+static u8 exec_fault(struct executor* e) {
+
+  if (e->timed_out) return FAULT_HANG;
+
+  if (WIFSIGNALED(e->status)) {
+    kill_signal = WTERMSIG(e->status);
+    return FAULT_CRASH;
+  }
+
+  if (uses_asan && WEXITSTATUS(e->status) == MSAN_ERROR) {
+    kill_signal = 0;
+    return FAULT_CRASH;
+  }
+
+  return FAULT_NONE;
+
+}
+
+
+/* Get rid of the SHM region and fork server of the prefilter (atexit
+   handler). */
+
+static void remove_prefilter(void) {
+
+  shmctl(prefilter.shm_id, IPC_RMID, NULL);
+  if (prefilter.fsrv_pid > 0) kill(prefilter.fsrv_pid, SIGKILL);
+
+}
+
+
+/* Start a fork server for the native, afl-gcc instrumented build of the
+   target named by AFL_PREFILTER, taking the same arguments as the QEMU
+   one (argv is the target command line, not the afl-qemu-trace one). */
+
+static void init_prefilter(char** argv) {
+
+  u8* sv_target_path = target_path;
+  char** nargv;
+  u32 argc;
+
+  for (argc = 0; argv[argc]; argc++);
+
+  nargv = ck_alloc((argc + 1) * sizeof(char*));
+  memcpy(nargv, argv, argc * sizeof(char*));
+  nargv[0] = (char*)prefilter_path;
+
+  ACTF("Starting the native prefilter '%s'...", prefilter_path);
+
+  target_path = prefilter_path;
+  start_executor(&prefilter, nargv, "native");
+  target_path = sv_target_path;
+
+  atexit(remove_prefilter);
+  ck_free(nargv);
+
+  prefilter_virgin = ck_alloc_nozero(MAP_SIZE);
+  memset(prefilter_virgin, 255, MAP_SIZE);
+
+  prefilter_cksum_set = kh_init(p64);
+
+}
+
+
+/* Run a synced seed on the native build first. Returns 1 if it is worth a
+   run under QEMU: the native run crashed, hung, or hit native edges or an
+   edge set (by checksum) not seen before. Everything else is assumed to
+   bring nothing new under QEMU either. */
+
+static u8 prefilter_pass(void* mem, u32 len) {
+
+  struct executor* e = &prefilter;
+  struct pollfd pfd;
+  u8* sv_trace_bits = trace_bits;
+  s32 res, ifnew;
+  u8  ret;
+
+  exec_launch(e, mem, len);
+  if (stop_soon) return 0;
+
+  pfd.fd     = e->st_fd;
+  pfd.events = POLLIN;
+
+  /* A signal (say, SIGWINCH on a resize) just cuts the wait short; only
+     running out of time makes a hang. */
+
+  while (1) {
+
+    u64 spent = get_cur_time() - e->start_ms;
+
+    if (spent >= e->tmout) { res = 0; break; }
+
+    res = poll(&pfd, 1, e->tmout - spent);
+
+    if (res >= 0) break;
+    if (errno != EINTR) PFATAL("poll() failed");
+    if (stop_soon) return 0;
+
+  }
+
+  if (!res) {
+    kill(e->child_pid, SIGKILL);
+    e->timed_out = 1;
+  }
+
+  if ((res = read(e->st_fd, &e->status, 4)) != 4) {
+    if (stop_soon) return 0;
+    RPFATAL(res, "Unable to communicate with fork server");
+  }
+
+  e->busy = 0;
+  e->child_pid = 0;
+  total_execs++;
+
+  if (exec_fault(e) != FAULT_NONE) {
+    prefilter_passes++;
+    return 1;
+  }
+
+  trace_bits = e->trace_bits;
+
+#ifdef __x86_64__
+  classify_counts((u64*)trace_bits);
+#else
+  classify_counts((u32*)trace_bits);
+#endif /* ^__x86_64__ */
+
+  ret = !!has_new_bits(prefilter_virgin);
+
+  kh_put(p64, prefilter_cksum_set, hash32(trace_bits, MAP_SIZE, HASH_CONST),
+         &ifnew);
+
+  trace_bits = sv_trace_bits;
+
+  if (ifnew) ret = 1;
+
+  if (ret) prefilter_passes++; else prefilter_skips++;
+
+  return ret;
+
+}
+
+
+/* Hand the edges of the last classified trace (touched[]) to the target as
+   the expected set, in the main SHM region and in those of the executors,
+   so that reruns which stray off it are cut short. QEMU mode only. */
+
+static void expect_arm(void) {
+
+  static u8 map[MAP_SIZE / 8];
+  u32 i;
+
+  if (!early_exit) return;
+
+  memset(map, 0, sizeof(map));
+
+  for (i = 0; i < touched_cnt; i++)
+    map[touched[i] >> 3] |= 1 << (touched[i] & 7);
+
+  memcpy(trace_bits + EXPECT_MAP_OFF, map, sizeof(map));
+  *(u32*)(trace_bits + EXPECT_ON_OFF) = 1;
+
+  for (i = 0; i < exec_pool_size; i++) {
+    memcpy(exec_pool[i].trace_bits + EXPECT_MAP_OFF, map, sizeof(map));
+    *(u32*)(exec_pool[i].trace_bits + EXPECT_ON_OFF) = 1;
+  }
+
+}
+
+
+/* Let reruns go to completion again. */
+
+static void expect_disarm(void) {
+
+  u32 i;
+
+  if (!early_exit) return;
+
+  *(u32*)(trace_bits + EXPECT_ON_OFF) = 0;
+
+  for (i = 0; i < exec_pool_size; i++)
+    *(u32*)(exec_pool[i].trace_bits + EXPECT_ON_OFF) = 0;
+
+}
+
+
+/* Check if the last run in a SHM region was stopped on an unexpected edge,
+   in which case its trace is incomplete and cannot match. */
+
+static u8 expect_hit(u8* bits) {
+
+  if (!*(u32*)(bits + EXPECT_HIT_OFF)) return 0;
+
+  early_exits++;
+  return 1;
+
+}
+
+
+/* Build the candidate that drops del_len bytes at del_pos from in_data, and
+   return its length. */
+
+static u32 trim_candidate(u8* dst, u8* in_data, u32 in_len, u32 del_pos,
+                          u32 del_len) {
+
+  s32 tail_len = in_len - del_pos - del_len;
+
+  if (tail_len < 0) tail_len = 0;
+
+  memcpy(dst, in_data, del_pos);
+  memcpy(dst + del_pos, in_data + del_pos + del_len, tail_len);
+
+  return del_pos + tail_len;
+
+}
+
+
+/* One block deletion pass of minimize_case() at a given del_len, with the
+   candidates run speculatively across the executor pool. Each batch tries
+   del_pos, del_pos + del_len, ... as if none of them were going to match;
+   results are then looked at in position order, and the first match is
+   committed. Whatever follows it in the batch was built from the old data,
+   so it is killed and thrown away, and the next batch starts over at the
+   matching position - which is exactly what the serial loop would do, so
+   the result is the same. Returns 1 if anything was deleted. */
+
+static u8 trim_blocks_parallel(u8* in_data, u32* in_len, u8* tmp_buf,
+                               u32 del_len, u32 orig_cksum) {
+
+  u32 del_pos = 0;
+  u8  changed = 0;
+
+  while (del_pos < *in_len && !stop_soon) {
+
+    u32 cnt, i, hit = 0;
+
+    for (cnt = 0; cnt < exec_pool_size &&
+                  del_pos + cnt * del_len < *in_len; cnt++) {
+
+      u32 len = trim_candidate(tmp_buf, in_data, *in_len,
+                               del_pos + cnt * del_len, del_len);
+
+      exec_launch(exec_pool + cnt, tmp_buf, len);
+
+    }
+
+    for (i = 0; i < cnt; i++) {
+
+      struct executor* e = exec_pool + i;
+
+      exec_wait(e);
+      if (stop_soon) return changed;
+
+      if (hit || expect_hit(e->trace_bits)) continue;
+
+#ifdef __x86_64__
+      classify_counts((u64*)e->trace_bits);
+#else
+      classify_counts((u32*)e->trace_bits);
+#endif /* ^__x86_64__ */
+
+      if (hash32(e->trace_bits, MAP_SIZE, HASH_CONST) != orig_cksum) continue;
+
+      hit = i + 1;
+
+      /* No point in waiting for the rest of the batch. */
+
+      for (e++; e < exec_pool + cnt; e++)
+        if (e->busy) kill(e->child_pid, SIGKILL);
+
+    }
+
+    if (hit) {
+
+      del_pos += (hit - 1) * del_len;
+
+      *in_len = trim_candidate(tmp_buf, in_data, *in_len, del_pos, del_len);
+      memcpy(in_data, tmp_buf, *in_len);
+
+      changed = 1;
+
+    } else del_pos += cnt * del_len;
+
+  }
+
+  return changed;
+
+}
+
+
+/* Actually minimize! With an executor pool, block deletion runs through
+   trim_blocks_parallel(), which leaves trace_bits alone. */
+
+static u32 minimize_case(char** argv, u8* in_data, u32 orig_len, u32 orig_cksum, u8* fname) {
+
+  u8* old_sn = stage_name;
+  stage_name = "minimize";
+
+  // static u32 alpha_map[256];
+
+
+  u32 in_len = orig_len, stage_o_len;
+  u8* tmp_buf = ck_alloc_nozero(in_len);
+  
+  u32 del_len, del_pos, /*i, alpha_size,*/ cur_pass = 0;
+  // u32 syms_removed, alpha_del1, alpha_del2, alpha_d_total = 0;
+  u8  changed_any;
+
+  u8 fault = 0;
+  ACTF(cYEL "--- " cBRI "minimizing %s" cYEL " ---", fname);
+
+  /* In QEMU mode, rerun the seed as it is to learn its edge set; as long
+     as it still reproduces orig_cksum, candidates that leave that set can
+     be stopped early, since they cannot match anyway. */
+
+  if (early_exit) {
+
+    write_to_testcase(in_data, in_len);
+    fault = run_target(argv, 0);
+
+    if (stop_soon || fault == FAULT_ERROR) goto abort_trimming;
+
+    if (hash32(trace_bits, MAP_SIZE, HASH_CONST) == orig_cksum) expect_arm();
+
+  }
+
+next_pass:
+
+  ACTF(cYEL "--- " cBRI "Pass #%u" cYEL " ---", ++cur_pass);
+  changed_any = 0;
+
+  /******************
+   * BLOCK DELETION *
+   ******************/
+
+  del_len = next_p2(in_len / TRIM_START_STEPS);
+  stage_o_len = in_len;
+
+  // ACTF(cBRI "Stage #1: " cNOR " Removing blocks of data...");
+
+next_del_blksize:
+
+  if (!del_len) del_len = 1;
+  del_pos = 0;
+
+  // SAYF(cGRA "    Block length = %u, remaining size = %u\n" cNOR,
+  //      del_len, in_len);
+
+  if (exec_pool_size) {
+
+    if (trim_blocks_parallel(in_data, &in_len, tmp_buf, del_len, orig_cksum))
+      changed_any = 1;
+
+    if (stop_soon) goto abort_trimming;
+
+    /* Skip the serial loop. */
+
+    del_pos = in_len;
+
+  }
+
+  while (del_pos < in_len) {
+
+    s32 tail_len;
+
+    /* Head */
+    memcpy(tmp_buf, in_data, del_pos);
+
+    tail_len = in_len - del_pos - del_len;
+    if (tail_len < 0) tail_len = 0;
+
+    /* Tail */
+    memcpy(tmp_buf + del_pos, in_data + del_pos + del_len, tail_len);
+
+    write_to_testcase(tmp_buf, del_pos + tail_len);
+    fault = run_target(argv, 0);
+
+    if (stop_soon || fault == FAULT_ERROR) goto abort_trimming;
+
+    if (expect_hit(trace_bits)) {
+      del_pos += del_len;
+      continue;
+    }
+
+    /* Note that we don't keep track of crashes or hangs here; maybe TODO? */
+
+    u32 cksum = hash32(trace_bits, MAP_SIZE, HASH_CONST);
+
+    if (cksum == orig_cksum) {
+
+      // ACTF("in_data[%d]<-[%d]", orig_len, del_pos + tail_len);
+      in_data[0] = tmp_buf[0];
+
+      memcpy(in_data, tmp_buf, del_pos + tail_len);
+
+      in_len = del_pos + tail_len;
+      changed_any = 1;
+
+    } else del_pos += del_len;
+
+  }
+
+  if (del_len > 1 && in_len >= 1) {
+
+    del_len /= 2;
+    goto next_del_blksize;
+
+  }
+
+  // OKF("Block removal complete, %u bytes deleted.", stage_o_len - in_len);
+
+  if (!in_len && changed_any)
+    WARNF(cLRD "Down to zero bytes - check the command line and mem limit!" cRST);
+
+  if (cur_pass > 1 && !changed_any) goto finalize_all;
+
+  // /*************************
+  //  * ALPHABET MINIMIZATION *
+  //  *************************/
+
+  // alpha_size   = 0;
+  // alpha_del1   = 0;
+  // syms_removed = 0;
+
+  // memset(alpha_map, 0, 256);
+
+  // for (i = 0; i < in_len; i++) {
+  //   if (!alpha_map[in_data[i]]) alpha_size++;
+  //   alpha_map[in_data[i]]++;
+  // }
+
+  // // ACTF(cBRI "Stage #2: " cNOR "Minimizing symbols (%u code point%s)...",
+  //      // alpha_size, alpha_size == 1 ? "" : "s");
+
+  // for (i = 0; i < 256; i++) {
+
+  //   u32 r;
+
+  //   if (i == '0' || !alpha_map[i]) continue;
+
+  //   memcpy(tmp_buf, in_data, in_len);
+
+  //   for (r = 0; r < in_len; r++)
+  //     if (tmp_buf[r] == i) tmp_buf[r] = '0'; 
+
+  //   write_to_testcase(tmp_buf, in_len);
+  //   fault = run_target(argv, 0);
+
+  //   if (stop_soon || fault == FAULT_ERROR) goto abort_trimming;
+
+  //   u32 cksum = hash32(trace_bits, MAP_SIZE, HASH_CONST);
+  //   if (cksum == orig_cksum) {
+
+  //     memcpy(in_data, tmp_buf, in_len);
+  //     syms_removed++;
+  //     alpha_del1 += alpha_map[i];
+  //     changed_any = 1;
+
+  //   }
+
+  // }
+
+  // alpha_d_total += alpha_del1;
+
+  // // OKF("Symbol minimization finished, %u symbol%s (%u byte%s) replaced.",
+  // //     syms_removed, syms_removed == 1 ? "" : "s",
+  // //     alpha_del1, alpha_del1 == 1 ? "" : "s");
+
+  // /**************************
+  //  * CHARACTER MINIMIZATION *
+  //  **************************/
+
+  // alpha_del2 = 0;
+
+  // // ACTF(cBRI "Stage #3: " cNOR "Character minimization...");
+
+  // for (i = 0; i < in_len; i++) {
+
+  //   if (tmp_buf[i] == '0') continue;
+
+  //   memcpy(tmp_buf, in_data, in_len);
+
+  //   tmp_buf[i] = '0';
+
+  //   write_to_testcase(tmp_buf, in_len);
+  //   fault = run_target(argv, 0);
+
+  //   if (stop_soon || fault == FAULT_ERROR) goto abort_trimming;
+
+  //   u32 cksum = hash32(trace_bits, MAP_SIZE, HASH_CONST);
+  //   if (cksum == orig_cksum) {
+
+  //     memcpy(in_data, tmp_buf, in_len);
+  //     alpha_del2++;
+  //     changed_any = 1;
+
+  //   }
+
+  // }
+
+  // alpha_d_total += alpha_del2;
+
+  // // OKF("Character minimization done, %u byte%s replaced.",
+  // //     alpha_del2, alpha_del2 == 1 ? "" : "s");
+
+  if (changed_any) goto next_pass;
+
+finalize_all:
+
+  expect_disarm();
+
+  // SAYF("\n"
+  //      cGRA "     File size reduced by : " cNOR "%0.02f%% (to %u byte%s)\n"
+  //      cGRA "    Characters simplified : " cNOR "%0.02f%%\n"
+  //      cGRA "     Number of execs done : " cNOR "%u\n"
+  //      cGRA "          Fruitless execs : " cNOR "path=%u crash=%u hang=%s%u\n\n",
+  //      100 - ((double)in_len) * 100 / orig_len, in_len, in_len == 1 ? "" : "s",
+  //      ((double)(alpha_d_total)) * 100 / (in_len ? in_len : 1),
+  //      total_execs, missed_paths, missed_crashes, missed_hangs ? cLRD : "",
+  //      missed_hangs);
+
+  // if (total_execs > 50 && missed_hangs * 10 > total_execs)
+  //   WARNF(cLRD "Frequent timeouts - results may be skewed." cRST);
+
+  SAYF("\n"
+     cGRA "     File size reduced by : " cNOR "%0.02f%% (%u to %u byte%s)\n",
+     // cGRA "    Characters simplified : " cNOR "%0.02f%%\n\n",
+     100 - ((double)in_len) * 100 / orig_len, orig_len, in_len, in_len == 1 ? "" : "s");
+     // ((double)(alpha_d_total)) * 100 / (in_len ? in_len : 1));
+
+abort_trimming:
+  expect_disarm();
+  stage_name = old_sn;
+  ck_free(tmp_buf);
+  
+  if(fault == FAULT_ERROR)
+    FATAL("Unable to execute target application");
+    
+  return in_len;
+
+}
+
+
+
+/* Queue a freshly saved seed for background trimming. */
+
+static void trim_enqueue(u32 qidx, u32 rec) {
+
+  u32 i = trim_cnt++;
+
+  trim_heap = ck_realloc(trim_heap, trim_cnt * sizeof(struct trim_item));
+
+  while (i && trim_heap[(i - 1) / 2].rareness < rareness) {
+    trim_heap[i] = trim_heap[(i - 1) / 2];
+    i = (i - 1) / 2;
+  }
+
+  trim_heap[i].rareness = rareness;
+  trim_heap[i].qidx     = qidx;
+  trim_heap[i].rec      = rec;
+
+}
+
+
+/* Take the rarest seed off the trim heap. */
+
+static struct trim_item trim_pop(void) {
+
+  struct trim_item top = trim_heap[0], last = trim_heap[--trim_cnt];
+  u32 i = 0, c;
+
+  while ((c = 2 * i + 1) < trim_cnt) {
+
+    if (c + 1 < trim_cnt && trim_heap[c + 1].rareness > trim_heap[c].rareness)
+      c++;
+
+    if (trim_heap[c].rareness <= last.rareness) break;
+
+    trim_heap[i] = trim_heap[c];
+    i = c;
+
+  }
+
+  if (trim_cnt) trim_heap[i] = last;
+
+  return top;
+
+}
+
+
+/* Read back the data of a queued seed, from its file or store record. */
+
+static u8* queue_load(u32 rec, u8* fn, u32* len) {
+
+  u8* mem;
+  s32 fd;
+
+  if (packed_store) {
+
+    struct store_rec* r = store_recs + rec;
+
+    fn = alloc_printf("%s/store/seg_%06u", out_dir, r->seg);
+
+    fd = open(fn, O_RDONLY);
+    if (fd < 0) PFATAL("Unable to open '%s'", fn);
+
+    *len = r->len;
+    mem  = ck_alloc_nozero(*len);
+
+    if (pread(fd, mem, *len, r->off) != *len)
+      PFATAL("Short read from segment %u", r->seg);
+
+    ck_free(fn);
+
+  } else {
+
+    struct stat st;
+
+    fd = open(fn, O_RDONLY);
+    if (fd < 0) PFATAL("Unable to open '%s'", fn);
+
+    if (fstat(fd, &st)) PFATAL("fstat() failed");
+
+    *len = st.st_size;
+    mem  = ck_alloc_nozero(*len);
+
+    ck_read(fd, mem, *len, fn);
+
+  }
+
+  close(fd);
+  return mem;
+
+}
+
+
+/* Trim the rarest pending seed and swap the result in: the file is replaced
+   with an atomic rename() from a dot file in the same directory, and a
+   store record is superseded by a new STORE_F_TRIMMED one. The original
+   and new sizes go to <out_dir>/trim_log. */
+
+static void trim_one(char** argv) {
+
+  struct trim_item t = trim_pop();
+  struct state_chunk* c = state_chunks + t.qidx / STATE_CHUNK;
+  u32 slot = t.qidx % STATE_CHUNK, len, new_len, rec, i;
+  u64 start_us = get_cur_time_us();
+  u8 *fn = queue_fname(t.qidx), *mem, *tmp;
+  FILE* f;
+  s32 fd;
+
+  mem = queue_load(t.rec, fn, &len);
+
+  new_len = minimize_case(argv, mem, len, queue_hot[t.qidx].exec_cksum, fn);
+
+  if (stop_soon || new_len >= len) goto trim_done;
+
+  if (packed_store) {
+
+    rec = store_append(c->kind[slot], c->id[slot], mem, new_len, NULL,
+                       store_recs + t.rec);
+
+    /* A calibration still pending for the seed has to load the trimmed
+       copy instead. */
+
+    for (i = 0; i < cal_cnt; i++) {
+      struct cal_item* ci = cal_ring + (cal_head + i) % CAL_QUEUE_SIZE;
+      if (ci->qidx == t.qidx) ci->rec = rec;
+    }
+
+  } else {
+
+    tmp = alloc_printf("%.*s/.trim_tmp", (int)((u8*)strrchr(fn, '/') - fn), fn);
+
+    fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) PFATAL("Unable to create '%s'", tmp);
+
+    ck_write(fd, mem, new_len, tmp);
+    close(fd);
+
+    if (rename(tmp, fn)) PFATAL("Unable to rename '%s'", tmp);
+    ck_free(tmp);
+
+  }
+
+  queue_hot[t.qidx].len = new_len;
+
+  tmp = alloc_printf("%s/trim_log", out_dir);
+
+  f = fopen(tmp, "a");
+  if (!f) PFATAL("Unable to open '%s'", tmp);
+
+  fprintf(f, "%s,%s,%u,%u\n", strrchr(fn, '/') + 1,
+          c->kind[slot] == STORE_PQ ? "pq" : "eq", len, new_len);
+
+  fclose(f);
+  ck_free(tmp);
+
+  trimmed_seeds++;
+  trim_saved += len - new_len;
+
+trim_done:
+
+  ck_free(mem);
+  ck_free(fn);
+
+  trim_us += get_cur_time_us() - start_us;
+
+}
+
+
+/* Work through the trim heap between sync passes. When the last pass found
+   nothing to sync, a single seed is trimmed before looking again; otherwise
+   trimming only goes on while it stays within trim_budget percent of the
+   time since start. Ingestion never waits for more than one seed. */
+
+static void trim_pending(char** argv, u8 idle) {
+
+  while (trim_cnt && !stop_soon) {
+
+    u64 run_us = (get_cur_time() - start_time) * 1000;
+
+    if (!idle && trim_us * 100 >= run_us * trim_budget) break;
+
+    job_get();
+    trim_one(argv);
+
+    if (idle) break;
+
+  }
+
+}
+
+
+static void show_stats(void);
+
+/* Add a key to one of the novelty sets; new ones are also queued up in log
+   for the checkpoint journal. Returns 1 if the key was not known yet. */
+
+static u8 set_add(khash_t(p64)* set, struct ckpt_log* log, u64 key) {
+
+  int ret;
+
+  kh_put(p64, set, key, &ret);
+  if (ret <= 0) return 0;
+
+  if (log->cnt == log->size) {
+    log->size = log->size ? log->size * 2 : 1024;
+    log->keys = ck_realloc(log->keys, log->size * sizeof(u64));
+  }
+
+  log->keys[log->cnt++] = key;
+  return 1;
+
+}
+
+
+/* Checksum of the classified trace in bits with the variable edges masked
+   out, or just cksum (its plain checksum) while there are none. */
+
+static u32 masked_cksum(u8* bits, u32 cksum) {
+
+  static u8 tmp[MAP_SIZE];
+  u32 i;
+
+  if (!var_edges) return cksum;
+
+  for (i = 0; i < MAP_SIZE; i++) tmp[i] = var_bytes[i] ? 0 : bits[i];
+
+  return hash32(tmp, MAP_SIZE, HASH_CONST);
+
+}
+
+
+/* Calibrate a saved test case, off the critical path: rerun it cal_cycles
+   times (more once it turns out to be variable) across the executor pool,
+   or on the main fork server without one, and fill in exec_us and
+   bitmap_size. Edges whose classified counts differ between the reruns are
+   marked in var_bytes and cleared from virgin_bits, so that they no longer
+   count as new coverage; the masked checksum of the entry goes to
+   var_cksum_set, so that path finds differing from it only there are not
+   saved again. The expected edge set is never armed here. */
+
+static u8 calibrate_case(char** argv, u32 idx, u8* use_mem) {
+
+  static u8 ref[MAP_SIZE];
+
+  struct queue_hot* q = queue_hot + idx;
+  u32 len = q->len, done = 0, ok = 0, ref_cksum = 0, new_var = 0, i;
+  u8  fault = 0, var_detected = 0;
+  u64 start_us = get_cur_time_us(), exec_us = 0;
+
+  s32 old_sc = stage_cur, old_sm = stage_max, old_tmout = exec_tmout;
+  u8* old_sn = stage_name;
+
+  /* Be a bit more generous about timeouts, to avoid trouble due to
+     intermittent latency. */
+
+  exec_tmout = MAX(exec_tmout + CAL_TMOUT_ADD,
+                   exec_tmout * CAL_TMOUT_PERC / 100);
+
+  queue_cold[idx].cal_failed++;
+
+  stage_name = "calibration";
+  stage_max  = cal_cycles;
+
+  while (done < stage_max && !stop_soon) {
+
+    u32 batch = exec_pool_size ? MIN(exec_pool_size, stage_max - done) : 1;
+
+    for (i = 0; i < batch && exec_pool_size; i++)
+      exec_launch(exec_pool + i, use_mem, len);
+
+    for (i = 0; i < batch; i++) {
+
+      u8* bits = trace_bits;
+      u32 cksum, j;
+
+      if (exec_pool_size) {
+
+        struct executor* e = exec_pool + i;
+
+        exec_wait(e);
+        if (stop_soon) break;
+
+        fault = exec_fault(e);
+        bits  = e->trace_bits;
+
+        if (fault == FAULT_NONE) {
+#ifdef __x86_64__
+          classify_counts((u64*)bits);
+#else
+          classify_counts((u32*)bits);
+#endif /* ^__x86_64__ */
+        }
+
+        exec_us += e->exec_us;
+
+      } else {
+
+        u64 run_us = get_cur_time_us();
+
+        write_to_testcase(use_mem, len);
+        fault = run_target(argv, 0);
+
+        if (stop_soon) break;
+
+        exec_us += get_cur_time_us() - run_us;
+
+      }
+
+      stage_cur = ++done;
+
+      /* Crashes and hangs leave partial traces; don't compare those. */
+
+      if (fault != FAULT_NONE) continue;
+
+      cksum = hash32(bits, MAP_SIZE, HASH_CONST);
+
+      if (!ok++) {
+
+        memcpy(ref, bits, MAP_SIZE);
+        ref_cksum = cksum;
+
+        if (cksum != q->exec_cksum) var_detected = 1;
+        continue;
+
+      }
+
+      if (cksum == ref_cksum) continue;
+
+      var_detected = 1;
+      stage_max    = MAX(stage_max, CAL_DEFER_LONG);
+
+      for (j = 0; j < MAP_SIZE; j++)
+        if (!var_bytes[j] && ref[j] != bits[j]) {
+          var_bytes[j]   = 1;
+          virgin_bits[j] = 0;
+          new_var++;
+        }
+
+    }
+
+  }
+
+  total_cal_us     += get_cur_time_us() - start_us;
+  total_cal_cycles += done;
+
+  if (ok) {
+
+    q->exec_us = exec_us / done;
+
+    queue_cold[idx].cal_failed  = 0;
+    queue_cold[idx].bitmap_size = count_bytes(ref);
+
+    total_bitmap_size += queue_cold[idx].bitmap_size;
+    total_bitmap_entries++;
+
+  }
+
+  /* Mark variable paths. */
+
+  if (var_detected && !queue_cold[idx].var_behavior) {
+    mark_as_variable(idx);
+    queued_variable++;
+  }
+
+  if (new_var) {
+
+    var_edges += new_var;
+    set_add(var_cksum_set, &var_log, masked_cksum(ref, ref_cksum));
+
+  }
+
+  stage_name = old_sn;
+  stage_cur  = old_sc;
+  stage_max  = old_sm;
+  exec_tmout = old_tmout;
+
+  return fault;
+
+}
+
+
+/* Queue a freshly saved seed for deferred calibration. */
+
+static void cal_enqueue(u32 qidx, u32 rec) {
+
+  struct cal_item* c;
+
+  if (cal_cnt == CAL_QUEUE_SIZE) {
+    cal_head = (cal_head + 1) % CAL_QUEUE_SIZE;
+    cal_cnt--;
+    cal_dropped++;
+  }
+
+  c = cal_ring + (cal_head + cal_cnt++) % CAL_QUEUE_SIZE;
+
+  c->qidx = qidx;
+  c->rec  = rec;
+
+}
+
+
+/* Calibrate pending seeds between sync passes: all of them if the last
+   pass was idle, otherwise only while calibration stays within cal_budget
+   percent of the time since start. */
+
+static void calibrate_pending(char** argv, u8 idle) {
+
+  while (cal_cnt && !stop_soon) {
+
+    u64 run_us = (get_cur_time() - start_time) * 1000;
+    struct cal_item c = cal_ring[cal_head];
+    u8 *fn, *mem;
+    u32 len;
+
+    if (!idle && total_cal_us * 100 >= run_us * cal_budget) break;
+
+    job_get();
+
+    cal_head = (cal_head + 1) % CAL_QUEUE_SIZE;
+    cal_cnt--;
+
+    fn  = queue_fname(c.qidx);
+    mem = queue_load(c.rec, fn, &len);
+
+    /* The seed may have been trimmed since it was queued. */
+
+    queue_hot[c.qidx].len = len;
+
+    if (calibrate_case(argv, c.qidx, mem) == FAULT_ERROR)
+      FATAL("Unable to execute target application");
+
+    ck_free(mem);
+    ck_free(fn);
+
+  }
+
+}
+
+
+#ifndef SIMPLE_FILES
+
+/* Construct a file name for a new test case, capturing the operation
+   that led to its discovery. Uses a static buffer. */
+
+static u8* describe_op(u8 hnb) {
+
+  static u8 ret[256];
+
+  if (syncing_party) {
+
+    sprintf(ret, "sync:%s,src:%08u", syncing_party, syncing_case);
+
+  } else {
+
+    sprintf(ret, "src:%08u", current_entry);
+
+    if (splicing_with >= 0)
+      sprintf(ret + strlen(ret), "+%08u", splicing_with);
+
+    sprintf(ret + strlen(ret), ",op:%s", stage_short);
+
+    if (stage_cur_byte >= 0) {
+
+      sprintf(ret + strlen(ret), ",pos:%u", stage_cur_byte);
+
+      if (stage_val_type != STAGE_VAL_NONE)
+        sprintf(ret + strlen(ret), ",val:%s%+d", 
+                (stage_val_type == STAGE_VAL_BE) ? "be:" : "",
+                stage_cur_val);
+
+    } else sprintf(ret + strlen(ret), ",rep:%u", stage_cur_val);
+
+  }
+
+  if (hnb == 2) strcat(ret, ",+cov");
+
+  return ret;
+
+}
+
+#endif /* !SIMPLE_FILES */
+
+
+/* Write a message accompanying the crash directory :-) */
+
+static void write_crash_readme(void) {
+
+  u8* fn = alloc_printf("%s/crashes/README.txt", out_dir);
+  s32 fd;
+  FILE* f;
+
+  fd = open(fn, O_WRONLY | O_CREAT | O_EXCL, 0600);
+  ck_free(fn);
+
+  /* Do not die on errors here - that would be impolite. */
+
+  if (fd < 0) return;
+
+  f = fdopen(fd, "w");
+
+  if (!f) {
+    close(fd);
+    return;
+  }
+
+  fprintf(f, "Command line used to find this crash:\n\n"
+
+             "%s\n\n"
+
+             "If you can't reproduce a bug outside of afl-fuzz, be sure to set the same\n"
+             "memory limit. The limit used for this fuzzing session was %s.\n\n"
+
+             "Need a tool to minimize test cases before investigating the crashes or sending\n"
+             "them to a vendor? Check out the afl-tmin that comes with the fuzzer!\n\n"
+
+             "Found any cool bugs in open-source tools using afl-fuzz? If yes, please drop\n"
+             "me a mail at <lcamtuf@coredump.cx> once the issues are fixed - I'd love to\n"
+             "add your finds to the gallery at:\n\n"
+
+             "  http://lcamtuf.coredump.cx/afl/\n\n"
+
+             "Thanks :-)\n",
+
+             orig_cmdline, DMS(mem_limit << 20)); /* ignore errors */
+
+  fclose(f);
+
+}
+
+
+/* Check whether the crash that just happened falls into a bucket we already
+   have a representative for. Buckets are keyed by the faulting PC and stack
+   hash that afl-qemu-trace leaves in the trace SHM (CRASH_REC_OFF); crashes
+   without a record (native targets, older QEMU builds) are never dropped. */
+
+static u8 crash_seen(void) {
+
+  u8* rec = trace_bits + CRASH_REC_OFF;
+  u64 pc;
+  u32 stack_hash;
+
+  if (!crash_buckets || !*(volatile u32*)rec) return 0;
+
+  memcpy(&stack_hash, rec + 4, 4);
+  memcpy(&pc, rec + 8, 8);
+
+  return !set_add(crash_bucket_set, &crash_log, pc ^ ((u64)stack_hash << 32));
+
+}
+
+
+/* Check if the result of an execve() during routine fuzzing is interesting,
+   save or queue the input test case for further analysis if so. Returns 1 if
+   entry is saved, 0 otherwise. */
+
+static u8 save_if_interesting(char** argv, void* mem, u32 len, u8 fault) {
+
+  u8  *fn = "";
+  u8  *tmp = "";
+  u8  hnb = 0;
+  u8  keeping = 0, res, kind;
+  u32 id, qidx;
+  int ifnew;
+
+  //Update path freq. No change to semantics
+  u32 key_cksum = hash32(trace_bits, MAP_SIZE, HASH_CONST);
+  struct ckt_slot* slot = ckt_lookup(key_cksum, 0);
+  if (slot) __sync_fetch_and_add(&slot->count, 1);
+  
+  hnb = has_new_bits(virgin_bits);
+  uint64_t* afl_trace_p = (uint64_t*)(trace_bits + MAP_SIZE); 
+  ifnew = set_add(hash_value_set, &path_log, afl_trace_p[0]);
+
+  /* A new path that matches a saved seed once the variable edges are
+     masked out is most likely just the same path being flaky. */
+
+  if (!hnb && ifnew && var_edges && fault == FAULT_NONE &&
+      kh_get(p64, var_cksum_set, masked_cksum(trace_bits, key_cksum)) !=
+      kh_end(var_cksum_set)) {
+
+    paths_suppressed++;
+    ifnew = 0;
+
+  }
+
+  if (fault == crash_mode && !crash_mode) {
+
+    /* Keep only if there are new bits in the map, add to queue for
+       future fuzzing, etc. */
+    
+
+// #ifndef SIMPLE_FILES
+    if(hnb) { // edge queue
+      fn = arena_printf(&seed_arena, "%s/queue/id:%08u_%d", out_dir, my_edges, filter_index);
+      kind = STORE_EQ;
+      id = my_edges;
+      FILE *edge_rare = fopen(rareness_log_edge, "a+");
+      //flock(fileno(edge_rare), LOCK_EX);
+      fprintf(edge_rare, "%.8f,id:%08u_%d,eq\n", rareness, my_edges, filter_index);
+      //flock(fileno(edge_rare), LOCK_UN);
+      fclose(edge_rare);
+      my_edges += 1;
+    } else if(ifnew) {    // path queue      
+      fn = arena_printf(&seed_arena, "%s-path/_queue/id:%08u_%d", out_dir, my_paths, filter_index);
+      kind = STORE_PQ;
+      id = my_paths;
+      FILE *path_rare = fopen(rareness_log_path, "a+");
+      //flock(fileno(path_rare), LOCK_EX);
+      fprintf(path_rare, "%.8f,id:%08u_%d,pq\n", rareness, my_paths, filter_index);
+      //flock(fileno(path_rare), LOCK_UN);
+      fclose(path_rare);
+      my_paths += 1;
+    } else {
+      return 0;
+    }
+    
+
+// #else
+
+//     fn = alloc_printf("%s/queue/id_%08u", out_dir, queued_paths);
+
+// #endif /* ^!SIMPLE_FILES */
+
+
+    // extra_blocks(queued_paths, 0);
+    qidx = add_to_queue(len, 0, kind, id);
+    state_add(qidx, kind, id);
+
+    if (hnb/* == 2*/) {
+      queue_hot[qidx].has_new_cov = 1;
+      queued_with_cov++;
+    }
+
+    queue_hot[qidx].exec_cksum = key_cksum; //hash32(trace_bits, MAP_SIZE, HASH_CONST);
+    if (!slot && (slot = ckt_lookup(key_cksum, 1)))
+      __sync_fetch_and_add(&slot->count, 1);
+
+    /* Calibration is skipped, so score the entry against the trace we
+       already have. */
+
+    if (!dumb_mode) update_bitmap_score(qidx);
+
+    //tmp = alloc_printf("%s/tmp", out_dir);
+    save_case(fn, kind, id, mem, len);
+
+    /* Calibration is deferred, see calibrate_pending(). */
+
+    set_add(var_cksum_set, &var_log, masked_cksum(trace_bits, key_cksum));
+
+    if (!dumb_mode && fault == FAULT_NONE)
+      cal_enqueue(qidx, packed_store ? store_hdr->rec_count - 1 : 0);
+
+    /* Trimming happens in the background, see trim_pending(). */
+
+    if (is_trim_case && fault == FAULT_NONE && len <= TRIM_MAX_LEN)
+      trim_enqueue(qidx, packed_store ? store_hdr->rec_count - 1 : 0);
+
+    //rename(tmp, fn);
+    keeping = 1;
+  }
+
+  switch (fault) {
+
+    case FAULT_HANG:
+
+      /* Hangs are not very interesting, but we're still obliged to keep
+         a handful of samples. We use the presence of new bits in the
+         hang-specific bitmap as a signal of uniqueness. In "dumb" mode, we
+         just keep everything. */
+
+      total_hangs++;
+
+      //if (unique_hangs >= KEEP_UNIQUE_HANG) return keeping;
+
+      if (!dumb_mode) {
+
+#ifdef __x86_64__
+        simplify_trace((u64*)trace_bits);
+#else
+        simplify_trace((u32*)trace_bits);
+#endif /* ^__x86_64__ */
+
+        if (!has_new_bits(virgin_hang)) return keeping;
+
+      }
+
+#ifndef SIMPLE_FILES
+
+      fn = arena_printf(&seed_arena, "%s/hangs/id:%08llu,%s", out_dir,
+                        unique_hangs, describe_op(0));
+      kind = STORE_HANG;
+      id = unique_hangs;
+
+#else
+
+      fn = arena_printf(&seed_arena, "%s/hangs/id_%08llu", out_dir,
+                        unique_hangs);
+      kind = STORE_HANG;
+      id = unique_hangs;
+
+#endif /* ^!SIMPLE_FILES */
+
+      unique_hangs++;
+
+      last_hang_time = get_cur_time();
+
+      break;
+
+    case FAULT_CRASH:
+
+      /* This is handled in a manner roughly similar to hangs,
+         except for slightly different limits. */
+
+      total_crashes++;
+
+      //if (unique_crashes >= KEEP_UNIQUE_CRASH) return keeping;
+
+//       if (!dumb_mode) {
+
+// #ifdef __x86_64__
+//         simplify_trace((u64*)trace_bits);
+// #else
+//         simplify_trace((u32*)trace_bits);
+// #endif /* ^__x86_64__ */
+
+//         //if (!has_new_bits(virgin_crash)) return keeping;
+
+//       }
+
+      if ((hnb || ifnew) && crash_seen()) {
+        crash_dups++;
+        return 0;
+      }
+
+      if (!unique_crashes) write_crash_readme();
+
+// #ifndef SIMPLE_FILES
+      if(hnb) {
+        fn = arena_printf(&seed_arena, "%s/crashes/id:%08llu_%d", out_dir, my_edge_crashes, filter_index);
+        kind = STORE_EC;
+        id = my_edge_crashes;
+        FILE *edge_rare = fopen(rareness_log_edge, "a+");
+        flock(fileno(edge_rare), LOCK_EX);
+        fprintf(edge_rare, "%.8f,id:%08u_%d,ec\n", rareness, my_edge_crashes, filter_index);
+        flock(fileno(edge_rare), LOCK_UN);
+        fclose(edge_rare);
+        my_edge_crashes+=1;
+      } else if(ifnew){
+        fn = arena_printf(&seed_arena, "%s-path/_crashes/id:%08llu_%d", out_dir, my_path_crashes, filter_index);  
+        kind = STORE_PC;
+        id = my_path_crashes;
+        FILE *path_rare = fopen(rareness_log_path, "a+");
+        flock(fileno(path_rare), LOCK_EX);
+        fprintf(path_rare, "%.8f,id:%08u_%d,pc\n", rareness, my_path_crashes, filter_index);
+        flock(fileno(path_rare), LOCK_UN);
+        fclose(path_rare);
+        my_path_crashes+=1;
+      } else {
+        return 0;
+      }
+
+// #else
+
+//       fn = alloc_printf("%s/crashes/id_%08llu_%02u", out_dir, unique_crashes,
+//                         kill_signal);
+
+// #endif /* ^!SIMPLE_FILES */
+
+      if(unique_crashes == 0)
+      {
+        first_crash_time = get_cur_time();
+      }
+
+      //extra_blocks(unique_crashes, 1);
+
+      unique_crashes++;
+
+      last_crash_time = get_cur_time();
+
+      break;
+
+    case FAULT_ERROR: FATAL("Unable to execute target application");
+
+    default: return keeping;
+
+  }
+
+  /* If we're here, we apparently want to save the crash or hang
+     test case, too. */
+
+  save_case(fn, kind, id, mem, len);
+
+  return keeping;
+
+}
+
+
+// /* When resuming, try to find the queue position to start from. This makes sense
+//    only when resuming, and when we can find the original fuzzer_stats. */
+
+// static u32 find_start_position(void) {
+
+//   static u8 tmp[4096]; /* Ought to be enough for anybody. */
+
+//   u8  *fn, *off;
+//   s32 fd, i;
+//   u32 ret;
+
+//   if (!resuming_fuzz) return 0;
+
+//   if (in_place_resume) fn = alloc_printf("%s/fuzzer_stats", out_dir);
+//   else fn = alloc_printf("%s/../fuzzer_stats", in_dir);
+
+//   // fn = alloc_printf("%s/fuzzer_stats", remote_out_dir);
+
+//   fd = open(fn, O_RDONLY);
+//   ck_free(fn);
+
+//   if (fd < 0) return 0;
+
+//   i = read(fd, tmp, sizeof(tmp) - 1); (void)i; /* Ignore errors */
+//   close(fd);
+
+//   off = strstr(tmp, "cur_path       : ");
+//   if (!off) return 0;
+
+//   ret = atoi(off + 17);
+//   if (ret >= queued_paths) ret = 0;
+//   return ret;
+
+// }
+
+
+/* Update stats file for unattended monitoring. */
+
+static void write_stats_file(double bitmap_cvg, double eps) {
+
+  static double last_bcvg, last_eps;
+
+  u8* fn = alloc_printf("%s/fuzzer_stats", out_dir);
+  // u8* fn = alloc_printf("%s/fuzzer_stats", remote_out_dir);
+  s32 fd;
+  FILE* f;
+
+  fd = open(fn, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+
+  if (fd < 0) PFATAL("Unable to create '%s'", fn);
+
+  ck_free(fn);
+
+  f = fdopen(fd, "w");
+
+  if (!f) PFATAL("fdopen() failed");
+
+  /* Keep last values in case we're called from another context
+     where exec/sec stats and such are not readily available. */
+
+  if (!bitmap_cvg && !eps) {
+    bitmap_cvg = last_bcvg;
+    eps        = last_eps;
+  } else {
+    last_bcvg = bitmap_cvg;
+    last_eps  = eps;
+  }
+
+  fprintf(f, "start_time            : %llu\n"
+             "last_update           : %llu\n"
+             "fuzzer_pid            : %u\n"
+             "first_crash_time      : %llu\n"
+             "last_crash_time       : %llu\n"
+             "cycles_done           : %llu\n"
+             "execs_done            : %llu\n"
+             "execs_per_sec         : %0.02f\n"
+             "paths_total           : %u\n"
+             "paths_found           : %u\n"
+             "paths_imported        : %u\n"
+             "max_depth             : %u\n"
+             "cur_path              : %u\n"
+             "pending_favs          : %u\n"
+             "pending_total         : %u\n"
+             "variable_paths        : %u\n"
+             "bitmap_cvg            : %0.02f%%\n"
+             "unique_crashes        : %llu\n"
+             "unique_hangs          : %llu\n"
+             "imported_paths        : %u\n"
+             "checked_paths         : %i\n"
+             "checked_crashes       : %i\n"
+             "sync_times            : %i\n"
+             "spool_drained         : %u\n"
+             "exec_us_avg           : %0.02f\n"
+             "huge_pages            : shm=%u maps=%u\n"
+             "trim_pending          : %u\n"
+             "trimmed_seeds         : %u (%llu bytes saved, %0.02f%% time)\n"
+             "early_exits           : %llu\n"
+             "cal_pending           : %u (%u dropped)\n"
+             "variable_edges        : %u\n"
+             "paths_suppressed      : %u\n"
+             "hang_cache_hits       : %u\n"
+             "short_hangs           : %u\n"
+             "crash_buckets         : %u (%u duplicates)\n"
+             "prefilter             : %u skipped, %u passed\n"
+             "overload              : %s (%u times), %u deferred, %u dropped, "
+                                     "%u waiting\n"
+             "sync_latency_ms       : %llu\n"
+             "exec_pool             : %u in use, %u started (%u resizes)\n"
+             "afl_banner            : %s\n"
+             "afl_version           : " VERSION "\n"
+             "command_line          : %s\n",
+             start_time / 1000, get_cur_time() / 1000, getpid(),
+             first_crash_time / 1000, last_crash_time /1000,
+             queue_cycle ? (queue_cycle - 1) : 0, total_execs, eps,
+             queued_paths, queued_discovered, queued_imported, max_depth,
+             current_entry, pending_favored, pending_not_fuzzed,
+             queued_variable, bitmap_cvg, unique_crashes, unique_hangs,
+             queued_imported, sync_count, sync_count_crashes, sync_times,
+             spool_drained,
+             total_execs ? ((double)total_exec_us) / total_execs : 0,
+             huge_shm, huge_maps, trim_cnt, trimmed_seeds, trim_saved,
+             trim_us / (10.0 * MAX(get_cur_time() - start_time, 1)),
+             early_exits, cal_cnt, cal_dropped, var_edges, paths_suppressed,
+             hang_cache_hits, short_hangs, kh_size(crash_bucket_set),
+             crash_dups, prefilter_skips, prefilter_passes,
+             overloaded ? "on" : "off", ovl_entered, ovl_deferred, ovl_dropped,
+             deferred_cnt, sync_latency, exec_pool_size, exec_pool_alloc,
+             pool_resizes, use_banner, orig_cmdline); /* ignore errors */
+
+  fclose(f);
+
+}
+
+
+/* Publish the sync backlog for the CE scheduler in <out_dir>/backpressure:
+   seeds waiting, recent ingest rate, estimated time to drain, and whether
+   producers should back off. The throttle flag goes up at the high-water
+   mark and comes down again at half of it. Rewritten atomically at most
+   every BACKPRESSURE_MS, or right away when the flag flips. */
+
+static void write_backpressure(void) {
+
+  static u64 last_ms, last_count;
+  static double rate;
+
+  u64 cur_ms = get_cur_time();
+  u8  throttle = bp_throttle;
+  u8 *fn, *tmp;
+  FILE* f;
+
+  if (sync_backlog >= backlog_hwm) throttle = 1;
+  else if (sync_backlog < backlog_hwm / 2) throttle = 0;
+
+  if (throttle == bp_throttle && cur_ms - last_ms < BACKPRESSURE_MS) return;
+
+  bp_throttle = throttle;
+
+  if (last_ms && cur_ms > last_ms) {
+
+    double cur_rate = (sync_count - last_count) * 1000.0 / (cur_ms - last_ms);
+
+    rate = rate ? rate * 0.8 + cur_rate * 0.2 : cur_rate;
+
+  }
+
+  last_ms    = cur_ms;
+  last_count = sync_count;
+
+  fn  = alloc_printf("%s/backpressure", out_dir);
+  tmp = alloc_printf("%s/.backpressure.tmp", out_dir);
+
+  f = fopen(tmp, "w");
+  if (!f) PFATAL("Unable to create '%s'", tmp);
+
+  fprintf(f, "last_update           : %llu\n"
+             "backlog               : %u\n"
+             "ingest_rate           : %0.02f\n"
+             "drain_time            : %0.0f\n"
+             "high_water            : %u\n"
+             "throttle              : %u\n",
+             cur_ms / 1000, sync_backlog, rate,
+             rate > 0 ? sync_backlog / rate : (sync_backlog ? -1 : 0),
+             backlog_hwm, bp_throttle);
+
+  fclose(f);
+
+  if (rename(tmp, fn)) PFATAL("Unable to rename '%s'", tmp);
+
+  ck_free(fn);
+  ck_free(tmp);
+
+}
+
+
+/* Open the path count table (see store.h), creating it if needed. The table
+   lives in <out_dir>/cksum_paths unless AFL_CKSUM_TABLE names a file to
+   share with other instances. A new table is built in a temporary file and
+   link()ed into place, so instances starting at the same time all end up
+   with the same one. When replaying the output (-R), a private table is
+   started from scratch, as the replay counts every seed again. The size of
+   a new table can be set with AFL_CKSUM_BITS; an existing one keeps the
+   size it was created with. */
+
+static void setup_ckt(void) {
+
+  u8* fn = getenv("AFL_CKSUM_TABLE");
+  u8* x  = getenv("AFL_CKSUM_BITS");
+  u32 size_pow2 = CKT_SIZE_POW2;
+  struct ckt_hdr hdr;
+  struct stat st;
+  s32 fd;
+
+  if (x) {
+    size_pow2 = atoi(x);
+    if (size_pow2 < 10 || size_pow2 > 30) FATAL("Bad value of AFL_CKSUM_BITS");
+  }
+
+  if (fn) {
+    fn = ck_strdup(fn);
+    ckt_shared = 1;
+  } else fn = alloc_printf("%s/cksum_paths", out_dir);
+
+  if (replay_jobs && !ckt_shared && unlink(fn) && errno != ENOENT)
+    PFATAL("Unable to delete '%s'", fn);
+
+  fd = open(fn, O_RDWR);
+
+  if (fd < 0 && errno == ENOENT) {
+
+    u8* tmp = alloc_printf("%s.%u.tmp", fn, getpid());
+
+    fd = open(tmp, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) PFATAL("Unable to create '%s'", tmp);
+
+    memset(&hdr, 0, sizeof(hdr));
+
+    hdr.magic     = CKT_MAGIC;
+    hdr.version   = CKT_VERSION;
+    hdr.size_pow2 = size_pow2;
+
+    if (ftruncate(fd, CKT_OFF(1U << size_pow2)))
+      PFATAL("Unable to extend '%s'", tmp);
+
+    ck_write(fd, &hdr, sizeof(hdr), tmp);
+    close(fd);
+
+    if (link(tmp, fn) && errno != EEXIST) PFATAL("Unable to link '%s'", fn);
+    unlink(tmp);
+    ck_free(tmp);
+
+    fd = open(fn, O_RDWR);
+
+  }
+
+  if (fd < 0) PFATAL("Unable to open '%s'", fn);
+
+  if (fstat(fd, &st)) PFATAL("fstat() failed");
+
+  if (st.st_size < sizeof(struct ckt_hdr) ||
+      pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+      hdr.magic != CKT_MAGIC || hdr.version != CKT_VERSION ||
+      hdr.size_pow2 > 31 || st.st_size < CKT_OFF(1U << hdr.size_pow2))
+    FATAL("Bad or unsupported path count table '%s'", fn);
+
+  ckt_hdr = mmap(0, CKT_OFF(1U << hdr.size_pow2), PROT_READ | PROT_WRITE,
+                 MAP_SHARED, fd, 0);
+
+  if (ckt_hdr == MAP_FAILED) PFATAL("Unable to mmap '%s'", fn);
+
+  if (x && hdr.size_pow2 != size_pow2)
+    WARNF("Path count table '%s' already exists with %u bits, ignoring "
+          "AFL_CKSUM_BITS.", fn, hdr.size_pow2);
+
+  ckt_slots    = (struct ckt_slot*)(ckt_hdr + 1);
+  ckt_mask     = (1U << hdr.size_pow2) - 1;
+  ckt_max_used = (ckt_mask + 1) * CKT_MAX_LOAD;
+
+  close(fd);
+
+  if (ckt_hdr->used)
+    OKF("Path count table '%s' has %u checksums.", fn, ckt_hdr->used);
+
+  ck_free(fn);
+
+}
+
+
+/* Checkpoint of the novelty and scoring state, kept in <out_dir>/checkpoint.
+   The header is followed by virgin_bits, virgin_hang, virgin_crash,
+   overall_bits and var_bytes, which are fixed-size and so are written out
+   in full every time. The novelty sets only ever grow, so their keys go to
+   journals instead (<out_dir>/checkpoint.paths for hash_value_set,
+   checkpoint.var for var_cksum_set, checkpoint.crash for crash_bucket_set):
+   each checkpoint appends the keys added
+   since the previous one, and the header says how many journal entries it
+   covers, so that anything past that (left by a writer that died) is
+   ignored and later overwritten. Path counts persist on their own (see
+   setup_ckt()). */
+
+#define CKPT_MAGIC          0x434b4641 /* "AFKC" */
+#define CKPT_VERSION        5
+
+struct ckpt_hdr {
+
+  u32 magic, version, map_size, pad;
+  u64 path_cnt;
+
+  u32 my_edges, my_paths, my_edge_crashes, my_path_crashes, queued_paths,
+      queued_imported, queued_with_cov, sync_count, sync_count_crashes,
+      sync_times, spool_drained, var_edges;
+
+  u64 unique_crashes, unique_hangs, total_crashes, total_hangs, total_execs;
+
+  u64 var_cnt, crash_cnt;
+
+  u32 crash_dups, reserved;
+
+};
+
+
+/* Append the keys queued up in log to the journal in <out_dir>/name, and
+   return the number of entries the journal then has. */
+
+static u64 log_write(struct ckpt_log* log, u8* name) {
+
+  u8* fn = alloc_printf("%s/%s", out_dir, name);
+  s32 fd = open(fn, O_WRONLY | O_CREAT, 0600);
+
+  if (fd < 0) PFATAL("Unable to create '%s'", fn);
+
+  if (log->cnt && pwrite(fd, log->keys, log->cnt * sizeof(u64),
+      log->base * sizeof(u64)) != log->cnt * sizeof(u64))
+    PFATAL("Short write to '%s'", fn);
+
+  if (ftruncate(fd, (log->base + log->cnt) * sizeof(u64)))
+    PFATAL("ftruncate() failed");
+
+  if (fsync(fd)) PFATAL("fsync() failed");
+  close(fd);
+
+  ck_free(fn);
+
+  return log->base + log->cnt;
+
+}
+
+
+/* Forget the first cnt keys queued up in log once a checkpoint has them in
+   the journal. */
+
+static void log_drop(struct ckpt_log* log, u32 cnt) {
+
+  memmove(log->keys, log->keys + cnt, (log->cnt - cnt) * sizeof(u64));
+
+  log->cnt  -= cnt;
+  log->base += cnt;
+
+}
+
+
+/* Load the first cnt keys of the journal in <out_dir>/name into set. */
+
+static void log_load(khash_t(p64)* set, struct ckpt_log* log, u8* name,
+                     u64 cnt) {
+
+  u8* fn = alloc_printf("%s/%s", out_dir, name);
+  u64* keys = ck_alloc_nozero(cnt * sizeof(u64) + 1);
+  u64 i;
+  s32 fd, ret;
+
+  fd = open(fn, O_RDONLY);
+  if (fd < 0) PFATAL("Unable to open '%s'", fn);
+
+  ck_read(fd, keys, cnt * sizeof(u64), fn);
+  close(fd);
+
+  for (i = 0; i < cnt; i++) kh_put(p64, set, keys[i], &ret);
+
+  log->base = cnt;
+
+  ck_free(keys);
+  ck_free(fn);
+
+}
+
+
+/* Write out a checkpoint: the journals first, so that it never covers
+   entries that are not on disk yet, then the checkpoint itself, to a
+   temporary file renamed over the previous one, so that a crash at any
+   point leaves a usable checkpoint. */
+
+static void write_checkpoint(void) {
+
+  u8* fn  = alloc_printf("%s/checkpoint", out_dir);
+  u8* tmp = alloc_printf("%s/.checkpoint.tmp", out_dir);
+
+  struct ckpt_hdr h;
+  s32 fd;
+
+  memset(&h, 0, sizeof(h));
+
+  h.path_cnt           = log_write(&path_log, "checkpoint.paths");
+  h.var_cnt            = log_write(&var_log, "checkpoint.var");
+  h.crash_cnt          = log_write(&crash_log, "checkpoint.crash");
+
+  h.magic              = CKPT_MAGIC;
+  h.version            = CKPT_VERSION;
+  h.map_size           = MAP_SIZE;
+  h.my_edges           = my_edges;
+  h.my_paths           = my_paths;
+  h.my_edge_crashes    = my_edge_crashes;
+  h.my_path_crashes    = my_path_crashes;
+  h.queued_paths       = queued_paths;
+  h.queued_imported    = queued_imported;
+  h.queued_with_cov    = queued_with_cov;
+  h.sync_count         = sync_count;
+  h.sync_count_crashes = sync_count_crashes;
+  h.sync_times         = sync_times;
+  h.spool_drained      = spool_drained;
+  h.var_edges          = var_edges;
+  h.crash_dups         = crash_dups;
+  h.unique_crashes     = unique_crashes;
+  h.unique_hangs       = unique_hangs;
+  h.total_crashes      = total_crashes;
+  h.total_hangs        = total_hangs;
+  h.total_execs        = total_execs;
+
+  fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  if (fd < 0) PFATAL("Unable to create '%s'", tmp);
+
+  ck_write(fd, &h, sizeof(h), tmp);
+  ck_write(fd, virgin_bits, MAP_SIZE, tmp);
+  ck_write(fd, virgin_hang, MAP_SIZE, tmp);
+  ck_write(fd, virgin_crash, MAP_SIZE, tmp);
+  ck_write(fd, overall_bits, MAP_SIZE * sizeof(short), tmp);
+  ck_write(fd, var_bytes, MAP_SIZE, tmp);
+
+  if (fsync(fd)) PFATAL("fsync() failed");
+  close(fd);
+
+  if (rename(tmp, fn)) PFATAL("Unable to rename '%s'", tmp);
+
+  ck_free(fn);
+  ck_free(tmp);
+
+}
+
+
+/* Take a checkpoint every CHECKPOINT_SEC if anything was executed since the
+   last one. Normally this is done from a fork()ed child working on a
+   copy-on-write snapshot, so the sync loop does not wait for the disk; with
+   now set (on exit), it is done right away, after any pending child. */
+
+static void maybe_checkpoint(u8 now) {
+
+  s32 status;
+  u64 cur_ms = get_cur_time();
+
+  if (ckpt_pid > 0) {
+
+    if (!waitpid(ckpt_pid, &status, now ? 0 : WNOHANG)) return;
+    ckpt_pid = -1;
+
+    /* If the writer did not make it, the next one journals its share of
+       the keys again. */
+
+    if (WIFEXITED(status) && !WEXITSTATUS(status)) {
+      log_drop(&path_log, path_log.taken);
+      log_drop(&var_log, var_log.taken);
+      log_drop(&crash_log, crash_log.taken);
+    }
+
+  }
+
+  if (total_execs == last_ckpt_execs) return;
+  if (!now && cur_ms - last_ckpt_ms < CHECKPOINT_SEC * 1000) return;
+
+  last_ckpt_ms    = cur_ms;
+  last_ckpt_execs = total_execs;
+
+  if (now) {
+    write_checkpoint();
+    log_drop(&path_log, path_log.cnt);
+    log_drop(&var_log, var_log.cnt);
+    log_drop(&crash_log, crash_log.cnt);
+    return;
+  }
+
+  path_log.taken  = path_log.cnt;
+  var_log.taken   = var_log.cnt;
+  crash_log.taken = crash_log.cnt;
+
+  ckpt_pid = fork();
+  if (ckpt_pid < 0) PFATAL("fork() failed");
+
+  if (!ckpt_pid) {
+
+    /* Let the writer finish even if the session is being stopped, and keep
+       it away from our stop handler, which would kill the fork server. */
+
+    signal(SIGINT, SIG_IGN);
+    signal(SIGTERM, SIG_IGN);
+    signal(SIGHUP, SIG_IGN);
+
+    write_checkpoint();
+    _exit(0);
+
+  }
+
+}
+
+
+/* Reload the state saved by write_checkpoint() when resuming. */
+
+static void load_checkpoint(void) {
+
+  u8* fn = alloc_printf("%s/checkpoint", out_dir);
+
+  struct ckpt_hdr h;
+  s32 fd;
+
+  fd = open(fn, O_RDONLY);
+  if (fd < 0) PFATAL("Unable to open '%s'", fn);
+
+  ck_read(fd, &h, sizeof(h), fn);
+
+  if (h.magic != CKPT_MAGIC || h.version != CKPT_VERSION ||
+      h.map_size != MAP_SIZE)
+    FATAL("Checkpoint '%s' is corrupt or from an incompatible build", fn);
+
+  ck_read(fd, virgin_bits, MAP_SIZE, fn);
+  ck_read(fd, virgin_hang, MAP_SIZE, fn);
+  ck_read(fd, virgin_crash, MAP_SIZE, fn);
+  ck_read(fd, overall_bits, MAP_SIZE * sizeof(short), fn);
+  ck_read(fd, var_bytes, MAP_SIZE, fn);
+
+  close(fd);
+
+  log_load(hash_value_set, &path_log, "checkpoint.paths", h.path_cnt);
+  log_load(var_cksum_set, &var_log, "checkpoint.var", h.var_cnt);
+  log_load(crash_bucket_set, &crash_log, "checkpoint.crash", h.crash_cnt);
+
+  var_edges          = h.var_edges;
+  crash_dups         = h.crash_dups;
+  my_edges           = h.my_edges;
+  my_paths           = h.my_paths;
+  my_edge_crashes    = h.my_edge_crashes;
+  my_path_crashes    = h.my_path_crashes;
+  queued_paths       = h.queued_paths;
+  queued_imported    = h.queued_imported;
+  queued_with_cov    = h.queued_with_cov;
+  sync_count         = h.sync_count;
+  sync_count_crashes = h.sync_count_crashes;
+  sync_times         = h.sync_times;
+  spool_drained      = h.spool_drained;
+  unique_crashes     = h.unique_crashes;
+  unique_hangs       = h.unique_hangs;
+  total_crashes      = h.total_crashes;
+  total_hangs        = h.total_hangs;
+  total_execs        = h.total_execs;
+
+  last_ckpt_execs = total_execs;
+
+  OKF("Loaded checkpoint: %u edge and %u path seeds, %u path hashes.",
+      my_edges, my_paths, (u32)h.path_cnt);
+
+  ck_free(fn);
+
+}
+
+
+/* Return one past the highest id:NNNNNNNN in a directory, or 0. */
+
+static u32 next_free_id(u8* dir) {
+
+  DIR* d = opendir(dir);
+  struct dirent* de;
+  u32 ret = 0, id;
+
+  if (!d) return 0;
+
+  while ((de = readdir(d)))
+    if (sscanf(de->d_name, CASE_PREFIX "%08u", &id) == 1 && id >= ret)
+      ret = id + 1;
+
+  closedir(d);
+  return ret;
+
+}
+
+
+/* Seeds saved after the last checkpoint are still on disk; move the ID
+   counters past them so that nothing gets overwritten or reused. */
+
+static void resume_counters(void) {
+
+  u8* fn;
+  u32 i, n;
+
+  if (state_hdr->entries > queued_paths) queued_paths = state_hdr->entries;
+
+  queue_grow(queued_paths);
+
+  /* Markers of the entries queued before the restart are already on disk;
+     leave them alone. */
+
+  culled_paths = queued_paths;
+
+#define BUMP(_ctr, _val) do { if ((_val) > (_ctr)) (_ctr) = (_val); } while (0)
+
+  if (store_hdr) for (i = 0; i < store_hdr->rec_count; i++) {
+
+    struct store_rec* r = store_recs + i;
+
+    switch (r->kind) {
+      case STORE_EQ:   BUMP(my_edges, r->id + 1); break;
+      case STORE_PQ:   BUMP(my_paths, r->id + 1); break;
+      case STORE_EC:   BUMP(my_edge_crashes, r->id + 1); break;
+      case STORE_PC:   BUMP(my_path_crashes, r->id + 1); break;
+      case STORE_HANG: BUMP(unique_hangs, r->id + 1); break;
+    }
+
+  }
+
+  fn = alloc_printf("%s/queue", out_dir);
+  n = next_free_id(fn); BUMP(my_edges, n);
+  ck_free(fn);
+
+  fn = alloc_printf("%s-path/_queue", out_dir);
+  n = next_free_id(fn); BUMP(my_paths, n);
+  ck_free(fn);
+
+  fn = alloc_printf("%s/crashes", out_dir);
+  n = next_free_id(fn); BUMP(my_edge_crashes, n);
+  ck_free(fn);
+
+  fn = alloc_printf("%s-path/_crashes", out_dir);
+  n = next_free_id(fn); BUMP(my_path_crashes, n);
+  ck_free(fn);
+
+  fn = alloc_printf("%s/hangs", out_dir);
+  n = next_free_id(fn); BUMP(unique_hangs, n);
+  ck_free(fn);
+
+#undef BUMP
+
+}
+
+
+/* Update the plot file if there is a reason to. */
+
+static void maybe_update_plot_file(double bitmap_cvg, double eps) {
+
+  static u32 prev_qp, prev_pf, prev_pnf, prev_ce, prev_md;
+  static u64 prev_qc, prev_uc, prev_uh;
+
+  if (prev_qp == queued_paths && prev_pf == pending_favored && 
+      prev_pnf == pending_not_fuzzed && prev_ce == current_entry &&
+      prev_qc == queue_cycle && prev_uc == unique_crashes &&
+      prev_uh == unique_hangs && prev_md == max_depth) return;
+
+  prev_qp  = queued_paths;
+  prev_pf  = pending_favored;
+  prev_pnf = pending_not_fuzzed;
+  prev_ce  = current_entry;
+  prev_qc  = queue_cycle;
+  prev_uc  = unique_crashes;
+  prev_uh  = unique_hangs;
+  prev_md  = max_depth;
+
+  /* Fields in the file:
+
+     unix_time, cycles_done, cur_path, paths_total, paths_not_fuzzed,
+     favored_not_fuzzed, unique_crashes, unique_hangs, max_depth,
+     execs_per_sec */
+
+  fprintf(plot_file, 
+          "%llu, %llu, %u, %u, %u, %u, %0.02f%%, %llu, %llu, %u, %0.02f\n",
+          get_cur_time() / 1000, queue_cycle - 1, current_entry, queued_paths,
+          pending_not_fuzzed, pending_favored, bitmap_cvg, unique_crashes,
+          unique_hangs, max_depth, eps); /* ignore errors */
+
+  fflush(plot_file);
+
+}
+
+
+
+/* A helper function for maybe_delete_out_dir(), deleting all prefixed
+   files in a directory. */
+
+static u8 delete_files(u8* path, u8* prefix) {
+
+  DIR* d;
+  struct dirent* d_ent;
+
+  d = opendir(path);
+
+  if (!d) return 0;
+
+  while ((d_ent = readdir(d))) {
+
+    if (d_ent->d_name[0] != '.' && (!prefix ||
+        !strncmp(d_ent->d_name, prefix, strlen(prefix)))) {
+
+      u8* fname = alloc_printf("%s/%s", path, d_ent->d_name);
+      if (unlink(fname)) PFATAL("Unable to delete '%s'", fname);
+      ck_free(fname);
+
+    }
+
+  }
+
+  closedir(d);
+
+  return !!rmdir(path);
+
+}
+
+
+/* Get the number of runnable processes, with some simple smoothing. */
+
+static double get_runnable_processes(void) {
+
+  static double res;
+
+#if defined(__APPLE__) || defined(__FreeBSD__) || defined (__OpenBSD__)
+
+  /* I don't see any portable sysctl or so that would quickly give us the
+     number of runnable processes; the 1-minute load average can be a
+     semi-decent approximation, though. */
+
+  if (getloadavg(&res, 1) != 1) return 0;
+
+#else
+
+  /* On Linux, /proc/stat is probably the best way; load averages are
+     computed in funny ways and sometimes don't reflect extremely short-lived
+     processes well. */
+
+  FILE* f = fopen("/proc/stat", "r");
+  u8 tmp[1024];
+  u32 val = 0;
+
+  if (!f) return 0;
+
+  while (fgets(tmp, sizeof(tmp), f)) {
+
+    if (!strncmp(tmp, "procs_running ", 14) ||
+        !strncmp(tmp, "procs_blocked ", 14)) val += atoi(tmp + 14);
+
+  }
+ 
+  fclose(f);
+
+  if (!res) {
+
+    res = val;
+
+  } else {
+
+    res = res * (1.0 - 1.0 / AVG_SMOOTHING) +
+          ((double)val) * (1.0 / AVG_SMOOTHING);
+
+  }
+
+#endif /* ^(__APPLE__ || __FreeBSD__ || __OpenBSD__) */
+
+  return res;
+
+}
+
+
+
+
+/* Delete fuzzer output directory if we recognize it as ours, if the fuzzer
+   is not currently running, and if the last run time isn't too great. */
+
+static void maybe_delete_out_dir(void) {
+
+  FILE* f;
+  u8 *fn = alloc_printf("%s/fuzzer_stats", out_dir);
+  // u8* fn = alloc_printf("%s/fuzzer_stats", remote_out_dir);
+
+  static s32 out_dir_fd;
+
+  /* See if the output directory is locked. If yes, bail out. If not,
+     create a lock that will persist for the lifetime of the process
+     (this requires leaving the descriptor open).*/
+
+  out_dir_fd = open(out_dir, O_RDONLY);
+  if (out_dir_fd < 0) PFATAL("Unable to open '%s'", out_dir);
+
+  if (flock(out_dir_fd, LOCK_EX | LOCK_NB) && errno == EWOULDBLOCK) {
+
+    SAYF("\n" cLRD "[-] " cRST
+         "Looks like the job output directory is being actively used by another\n"
+         "    instance of afl-fuzz. You will need to choose a different %s\n"
+         "    or stop the other process first.\n",
+         sync_id ? "fuzzer ID" : "output location");
+
+    FATAL("Directory '%s' is in use", out_dir);
+
+  }
+
+  close(out_dir_fd); // j.h.
+
+  f = fopen(fn, "r");
+
+  if (f) {
+
+    u64 start_time, last_update;
+
+    if (fscanf(f, "start_time     : %llu\n"
+                  "last_update    : %llu\n", &start_time, &last_update) != 2)
+      FATAL("Malformed data in '%s'", fn);
+
+    fclose(f);
+
+    /* Let's see how much work is at stake. */
+
+    if (!in_place_resume && last_update - start_time > OUTPUT_GRACE * 60) {
+
+      SAYF("\n" cLRD "[-] " cRST
+           "The job output directory already exists and contains the results of more\n"
+           "    than %u minutes worth of fuzzing. To avoid data loss, afl-fuzz will *NOT*\n"
+           "    automatically delete this data for you.\n\n"
+
+           "    If you wish to start a new session, remove or rename the directory manually,\n"
+           "    or specify a different output location for this job. To resume the old\n"
+           "    session, put '-' as the input directory in the command line ('-i -') and\n"
+           "    try again.\n", OUTPUT_GRACE);
+
+       FATAL("At-risk data found in in '%s'", out_dir);
+
+    }
+
+  }
+
+  ck_free(fn);
+
+  /* With a checkpoint around, or when rebuilding the state by replaying the
+     output (-R), resuming means carrying on with the existing output;
+     nothing gets deleted. */
+
+  fn = alloc_printf("%s/checkpoint", out_dir);
+
+  if (replay_jobs || (in_place_resume && !access(fn, F_OK))) {
+
+    if (replay_jobs) OKF("Will replay the existing output to rebuild state.");
+    else OKF("Found a checkpoint, resuming with the existing output.");
+
+    resuming = 1;
+    ck_free(fn);
+    return;
+
+  }
+
+  ck_free(fn);
+
+  /* The idea for in-place resume is pretty simple: we temporarily move the old
+     queue/ to a new location that gets deleted once import to the new queue/
+     is finished. If _resume/ already exists, the current queue/ may be
+     incomplete due to an earlier abort, so we want to use the old _resume/
+     dir instead, and we let rename() fail silently. */
+
+  if (in_place_resume) {
+
+    // u8* orig_q = alloc_printf("%s/queue", out_dir);
+
+    // in_dir = alloc_printf("%s/_resume", out_dir);
+
+    // rename(orig_q, in_dir); /* Ignore errors */
+
+    // OKF("Output directory exists, will attempt session resume.");
+
+    // ck_free(orig_q);
+
+  } else {
+
+    OKF("Output directory exists but deemed OK to reuse.");
+
+  }
+
+  ACTF("Deleting old session data...");
+
+  /* Okay, let's get the ball rolling! First, we need to get rid of the entries
+     in <out_dir>/.synced/.../id:*, if any are present. */
+
+  fn = alloc_printf("%s/.synced", out_dir);
+  if (delete_files(fn, NULL)) goto dir_cleanup_failed;
+  ck_free(fn);
+
+  /* Seeds deferred in overload mode go with their cursor. */
+
+  fn = alloc_printf("%s/deferred", out_dir);
+  if (delete_files(fn, CASE_PREFIX)) goto dir_cleanup_failed;
+  ck_free(fn);
+
+  /* Next, we need to clean up <out_dir>/queue/.state/ subdirectories: */
+
+  fn = alloc_printf("%s/queue/.state/deterministic_done", out_dir);
+  if (delete_files(fn, CASE_PREFIX)) goto dir_cleanup_failed;
+  ck_free(fn);
+
+  fn = alloc_printf("%s/queue/.state/auto_extras", out_dir);
+  if (delete_files(fn, "auto_")) goto dir_cleanup_failed;
+  ck_free(fn);
+
+  fn = alloc_printf("%s/queue/.state/redundant_edges", out_dir);
+  if (delete_files(fn, CASE_PREFIX)) goto dir_cleanup_failed;
+  ck_free(fn);
+
+  fn = alloc_printf("%s/queue/.state/favored_edges", out_dir);
+  if(delete_files(fn, CASE_PREFIX)) goto dir_cleanup_failed;
+  ck_free(fn);
+
+  fn = alloc_printf("%s/queue/.state/variable_behavior", out_dir);
+  if (delete_files(fn, CASE_PREFIX)) goto dir_cleanup_failed;
+  ck_free(fn);
+
+  fn = alloc_printf("%s/queue/.state/markers", out_dir);
+  if (unlink(fn) && errno != ENOENT) goto dir_cleanup_failed;
+  ck_free(fn);
+
+  fn = alloc_printf("%s/queue/.state/queue_hot", out_dir);
+  if (unlink(fn) && errno != ENOENT) goto dir_cleanup_failed;
+  ck_free(fn);
+
+  fn = alloc_printf("%s/queue/.state/queue_cold", out_dir);
+  if (unlink(fn) && errno != ENOENT) goto dir_cleanup_failed;
+  ck_free(fn);
+
+  fn = alloc_printf("%s/queue/.state/ids_eq", out_dir);
+  if (unlink(fn) && errno != ENOENT) goto dir_cleanup_failed;
+  ck_free(fn);
+
+  fn = alloc_printf("%s/queue/.state/ids_pq", out_dir);
+  if (unlink(fn) && errno != ENOENT) goto dir_cleanup_failed;
+  ck_free(fn);
+
+  /* Then, get rid of the .state subdirectory itself (should be empty by now)
+     and everything matching <out_dir>/queue/id:*. */
+
+  fn = alloc_printf("%s/queue/.state", out_dir);
+  if (rmdir(fn) && errno != ENOENT) goto dir_cleanup_failed;
+  ck_free(fn);
+
+  fn = alloc_printf("%s/queue", out_dir);
+  // if (delete_files(fn, CASE_PREFIX)) goto dir_cleanup_failed;
+  if (delete_files(fn, CASE_PREFIX) && delete_files(fn, "blocks,id:")) 
+  {
+    // erro_n = 1;
+    goto dir_cleanup_failed;
+  }
+  ck_free(fn);
+
+
+
+  /* The packed store, if there is one, goes away with its directory. */
+
+  fn = alloc_printf("%s/store", out_dir);
+  if (delete_files(fn, NULL)) goto dir_cleanup_failed;
+  ck_free(fn);
+
+  /* All right, let's do <out_dir>/crashes/id:* and <out_dir>/hangs/id:*. */
+
+  fn = alloc_printf("%s/crashes/README.txt", out_dir);
+  unlink(fn); /* Ignore errors */
+  ck_free(fn);
+
+  fn = alloc_printf("%s/crashes", out_dir);
+
+  /* Make backup of the crashes directory if it's not empty and if we're
+     doing in-place resume. */
+
+  if (in_place_resume && rmdir(fn)) {
+
+    time_t cur_t = time(0);
+    struct tm* t = localtime(&cur_t);
+
+    u8* nfn = alloc_printf("%s.%04u-%02u-%02u-%02u:%02u:%02u", fn,
+                           t->tm_year + 1900, t->tm_mon + 1, t->tm_mday,
+                           t->tm_hour, t->tm_min, t->tm_sec);
+
+    rename(fn, nfn); /* Ignore errors. */
+    ck_free(nfn);
+
+  }
+
+  // if (delete_files(fn, CASE_PREFIX)) goto dir_cleanup_failed;
+  if (delete_files(fn, CASE_PREFIX) && delete_files(fn, "blocks,id:")) 
+  {
+    // erro_n = 1;
+    goto dir_cleanup_failed;
+  }
+  ck_free(fn);
+
+  fn = alloc_printf("%s/hangs", out_dir);
+
+  /* Backup hangs, too. */
+
+  if (in_place_resume && rmdir(fn)) {
+
+    time_t cur_t = time(0);
+    struct tm* t = localtime(&cur_t);
+
+    u8* nfn = alloc_printf("%s.%04u-%02u-%02u-%02u:%02u:%02u", fn,
+                           t->tm_year + 1900, t->tm_mon + 1, t->tm_mday,
+                           t->tm_hour, t->tm_min, t->tm_sec);
+
+    rename(fn, nfn); /* Ignore errors. */
+    ck_free(nfn);
+
+  }
+
+  if (delete_files(fn, CASE_PREFIX)) goto dir_cleanup_failed;
+  ck_free(fn);
+
+  /* And now, for some finishing touches. */
+
+  fn = alloc_printf("%s/.cur_input", out_dir);
+  if (unlink(fn) && errno != ENOENT) goto dir_cleanup_failed;
+  ck_free(fn);
+
+  fn = alloc_printf("%s/.cur_code_block_info", out_dir);
+  if (unlink(fn) && errno != ENOENT) goto dir_cleanup_failed;
+  ck_free(fn);
+
+  fn = alloc_printf("%s/fuzz_bitmap", out_dir);
+  if (unlink(fn) && errno != ENOENT) goto dir_cleanup_failed;
+  ck_free(fn);
+
+  if (!in_place_resume) {
+    fn  = alloc_printf("%s/fuzzer_stats", out_dir);
+    if (unlink(fn) && errno != ENOENT) goto dir_cleanup_failed;
+    ck_free(fn);
+  }
+
+  fn = alloc_printf("%s/plot_data", out_dir);
+  if (unlink(fn) && errno != ENOENT) goto dir_cleanup_failed;
+  ck_free(fn);
+
+  fn = alloc_printf("%s/backpressure", out_dir);
+  if (unlink(fn) && errno != ENOENT) goto dir_cleanup_failed;
+  ck_free(fn);
+
+  fn = alloc_printf("%s/checkpoint", out_dir);
+  if (unlink(fn) && errno != ENOENT) goto dir_cleanup_failed;
+  ck_free(fn);
+
+  fn = alloc_printf("%s/.checkpoint.tmp", out_dir);
+  if (unlink(fn) && errno != ENOENT) goto dir_cleanup_failed;
+  ck_free(fn);
+
+  fn = alloc_printf("%s/checkpoint.paths", out_dir);
+  if (unlink(fn) && errno != ENOENT) goto dir_cleanup_failed;
+  ck_free(fn);
+
+  fn = alloc_printf("%s/checkpoint.var", out_dir);
+  if (unlink(fn) && errno != ENOENT) goto dir_cleanup_failed;
+  ck_free(fn);
+
+  fn = alloc_printf("%s/checkpoint.crash", out_dir);
+  if (unlink(fn) && errno != ENOENT) goto dir_cleanup_failed;
+  ck_free(fn);
+
+  fn = alloc_printf("%s/cksum_paths", out_dir);
+  if (unlink(fn) && errno != ENOENT) goto dir_cleanup_failed;
+  ck_free(fn);
 
-    if (waitpid(child_pid, &status, WUNTRACED) <= 0) PFATAL("waitpid() failed");
+  fn = alloc_printf("%s/trim_log", out_dir);
+  if (unlink(fn) && errno != ENOENT) goto dir_cleanup_failed;
+  ck_free(fn);
 
-  } else {
+  OKF("Output dir cleanup successful.");
 
-    s32 res;
-    res = read(fsrv_st_fd, &status, 4);
-    
-    if (res != 4) {
-      
-      if (stop_soon) return 0;
-      RPFATAL(res, "Unable to communicate with fork server");
+  /* Wow... is that all? If yes, celebrate! */
 
-    }
+  return;
 
-  }
- 
-  child_pid = 0;
-  it.it_value.tv_sec = 0;
-  it.it_value.tv_usec = 0;
+dir_cleanup_failed:
 
-  setitimer(ITIMER_REAL, &it, NULL);
+  SAYF("\n" cLRD "[-] " cRST
+       "Whoops, the fuzzer tried to reuse your output directory, but bumped into\n"
+       "    some files that shouldn't be there or that couldn't be removed - so it\n"
+       "    decided to abort! This happened while processing this path:\n\n"
 
-  total_execs++;
-  
+       "    %s\n\n"
+       "    Please examine and manually delete the files, or specify a different\n"
+       "    output location for the tool.\n", fn);
 
-    /* Any subsequent operations on trace_bits must not be moved by the
-       compiler above this point. Past this location, trace_bits[] behave
-       very normally and do not have to be treated as volatile. */
+  FATAL("Output directory cleanup failed");
 
-  MEM_BARRIER();
+}
 
-  tb4 = *(u32*)trace_bits;
 
-  // need to get rareness score here! 
-  rareness = get_rare(trace_bits); // before classify counts! 
-  //rareness = 0.0;
+/* A spiffy retro stats screen! This is called every stats_update_freq
+   execve() calls, plus in several other circumstances. */
 
-#ifdef __x86_64__
-  classify_counts((u64*)trace_bits);
-#else
-  classify_counts((u32*)trace_bits);
-#endif /* ^__x86_64__ */
-  
-  /* Report outcome to caller. */
+static void show_stats(void) {
 
-  if (child_timed_out) return FAULT_HANG;
+  static u64 last_stats_ms, last_plot_ms, last_ms, last_execs;
+  static double avg_exec;
+  double t_byte_ratio;
 
-  if (WIFSIGNALED(status) && !stop_soon) {
-    kill_signal = WTERMSIG(status);
-    return FAULT_CRASH;
-  }
+  u64 cur_ms;
+  u32 t_bytes, t_bits;
 
-/* A somewhat nasty hack for MSAN, which doesn't support abort_on_error and
-   must use a special exit code. */
+  u32 banner_len, banner_pad;
+  u8  tmp[256];
 
-  if (uses_asan && WEXITSTATUS(status) == MSAN_ERROR) {
-    kill_signal = 0;
-    return FAULT_CRASH;
-  }
+  cur_ms = get_cur_time();
 
-  if ((dumb_mode == 1 || no_forkserver) && tb4 == EXEC_FAIL_SIG)
-    return FAULT_ERROR;
+  /* If not enough time has passed since last UI update, bail out. */
 
-  return FAULT_NONE;
+  if (cur_ms - last_ms < 1000 / UI_TARGET_HZ) return;
 
-}
+  /* Check if we're past the 10 minute mark. */
 
+  if (cur_ms - start_time > 10 * 60 * 1000) run_over10m = 1;
 
-/* Write modified data to file for testing. If out_file is set, the old file
-   is unlinked and a new one is created. Otherwise, out_fd is rewound and
-   truncated. */
+  /* Calculate smoothed exec speed stats. */
 
-static void write_to_testcase(void* mem, u32 len) {
+  if (!last_execs) {
+  
+    avg_exec = ((double)total_execs) * 1000 / (cur_ms - start_time);
 
-  s32 fd = out_fd;
+  } else {
 
-  if (out_file) {
+    double cur_avg = ((double)(total_execs - last_execs)) * 1000 /
+                     (cur_ms - last_ms);
 
-    unlink(out_file); /* Ignore errors. */
+    /* If there is a dramatic (5x+) jump in speed, reset the indicator
+       more quickly. */
 
-    fd = open(out_file, O_WRONLY | O_CREAT | O_EXCL, 0600);
+    if (cur_avg * 5 < avg_exec || cur_avg / 5 > avg_exec)
+      avg_exec = cur_avg;
 
-    if (fd < 0) PFATAL("Unable to create '%s'", out_file);
+    avg_exec = avg_exec * (1.0 - 1.0 / AVG_SMOOTHING) +
+               cur_avg * (1.0 / AVG_SMOOTHING);
 
-  } else lseek(fd, 0, SEEK_SET);
+  }
 
-  ck_write(fd, mem, len, out_file);
+  last_ms = cur_ms;
+  last_execs = total_execs;
 
-  if (!out_file) {
+  /* Tell the callers when to contact us (as measured in execs). */
 
-    if (ftruncate(fd, len)) PFATAL("ftruncate() failed");
-    lseek(fd, 0, SEEK_SET);
+  stats_update_freq = avg_exec / (UI_TARGET_HZ * 10);
+  if (!stats_update_freq) stats_update_freq = 1;
 
-  } else close(fd);
+  /* Do some bitmap stats. */
 
-}
+  t_bytes = count_non_255_bytes(virgin_bits);
+  t_byte_ratio = ((double)t_bytes * 100) / MAP_SIZE;
 
+  /* Roughly every minute, update fuzzer stats and save auto tokens. */
 
+  if (cur_ms - last_stats_ms > STATS_UPDATE_SEC * 1000) {
 
+    last_stats_ms = cur_ms;
+    write_stats_file(t_byte_ratio, avg_exec);
 
+    write_bitmap();
 
-/* Find first power of two greater or equal to val. */
+  }
 
-static u32 next_p2(u32 val) {
+  /* Every now and then, write plot data. */
 
-  u32 ret = 1;
-  while (val > ret) ret <<= 1;
-  return ret;
+  if (cur_ms - last_plot_ms > PLOT_UPDATE_SEC * 1000) {
 
-} 
+    last_plot_ms = cur_ms;
+    maybe_update_plot_file(t_byte_ratio, avg_exec);
+ 
+  }
 
+  /* If we're not on TTY, bail out. */
 
+  if (not_on_tty) return;
 
-/* Actually minimize! */
+  /* Compute some mildly useful bitmap stats. */
 
-static u32 minimize_case(char** argv, u8* in_data, u32 orig_len, u32 orig_cksum, u8* fname) {
+  t_bits = (MAP_SIZE << 3) - count_bits(virgin_bits);
 
-  u8* old_sn = stage_name;
-  stage_name = "minimize";
+  /* Now, for the visuals... */
 
-  // static u32 alpha_map[256];
+  if (clear_screen) {
 
+    SAYF(TERM_CLEAR CURSOR_HIDE);
+    clear_screen = 0;
 
-  u32 in_len = orig_len, stage_o_len;
-  u8* tmp_buf = ck_alloc_nozero(in_len);
-  
-  u32 del_len, del_pos, /*i, alpha_size,*/ cur_pass = 0;
-  // u32 syms_removed, alpha_del1, alpha_del2, alpha_d_total = 0;
-  u8  changed_any;
+  }
 
-  u8 fault = 0;
-  ACTF(cYEL "--- " cBRI "minimizing %s" cYEL " ---", fname);
+  SAYF(TERM_HOME);
 
-next_pass:
+  /* Let's start by drawing a centered banner. */
 
-  ACTF(cYEL "--- " cBRI "Pass #%u" cYEL " ---", ++cur_pass);
-  changed_any = 0;
+  banner_len = (crash_mode ? 24 : 22) + strlen(VERSION) + strlen(use_banner);
+  banner_pad = (80 - banner_len) / 2;
+  memset(tmp, ' ', banner_pad);
 
-  /******************
-   * BLOCK DELETION *
-   ******************/
+  sprintf(tmp + banner_pad, "%s " cLCY VERSION cLGN
+          " (%s)",  crash_mode ? cPIN "peruvian were-rabbit" : 
+          cYEL "american fuzzy lop", use_banner);
 
-  del_len = next_p2(in_len / TRIM_START_STEPS);
-  stage_o_len = in_len;
+  SAYF("\n%s\n\n", tmp);
 
-  // ACTF(cBRI "Stage #1: " cNOR " Removing blocks of data...");
+  /* "Handy" shortcuts for drawing boxes... */
 
-next_del_blksize:
+#define bSTG    bSTART cGRA
+#define bH2     bH bH
+#define bH5     bH2 bH2 bH
+#define bH10    bH5 bH5
+#define bH20    bH10 bH10
+#define bH30    bH20 bH10
+#define SP5     "     "
+#define SP10    SP5 SP5
+#define SP20    SP10 SP10
 
-  if (!del_len) del_len = 1;
-  del_pos = 0;
+  /* Lord, forgive me this. */
 
-  // SAYF(cGRA "    Block length = %u, remaining size = %u\n" cNOR,
-  //      del_len, in_len);
+  SAYF(SET_G1 bSTG bLT bH bSTOP cCYA " process timing " bSTG bH30 bH5 bH2 bHB
+       bH bSTOP cCYA " overall results " bSTG bH5 bRT "\n");
 
-  while (del_pos < in_len) {
+  if (dumb_mode) {
 
-    s32 tail_len;
+    strcpy(tmp, cNOR);
 
-    /* Head */
-    memcpy(tmp_buf, in_data, del_pos);
+  } else {
 
-    tail_len = in_len - del_pos - del_len;
-    if (tail_len < 0) tail_len = 0;
+    /* First queue cycle: don't stop now! */
+    if (queue_cycle == 1) strcpy(tmp, cMGN); else
 
-    /* Tail */
-    memcpy(tmp_buf + del_pos, in_data + del_pos + del_len, tail_len);
+    /* Subsequent cycles, but we're still making finds. */
+    if (cycles_wo_finds < 3) strcpy(tmp, cYEL); else
 
-    write_to_testcase(tmp_buf, del_pos + tail_len);
-    fault = run_target(argv);
+    /* No finds for a long time and no test cases to try. */
+    if (cycles_wo_finds > 20 && !pending_not_fuzzed) strcpy(tmp, cLGN);
 
-    if (stop_soon || fault == FAULT_ERROR) goto abort_trimming;
+    /* Default: cautiously OK to stop? */
+    else strcpy(tmp, cLBL);
 
-    /* Note that we don't keep track of crashes or hangs here; maybe TODO? */
+  }
 
-    u32 cksum = hash32(trace_bits, MAP_SIZE, HASH_CONST);
+  SAYF(bV bSTOP "        run time : " cNOR "%-34s " bSTG bV bSTOP
+       "  cycles done : %s%-5s  " bSTG bV "\n",
+       DTD(cur_ms, start_time), tmp, DI(queue_cycle - 1));
 
-    if (cksum == orig_cksum) {
+  /* We want to warn people about not seeing new paths after a full cycle,
+     except when resuming fuzzing or running in non-instrumented mode. */
 
-      // ACTF("in_data[%d]<-[%d]", orig_len, del_pos + tail_len);
-      in_data[0] = tmp_buf[0];
+  if (!dumb_mode && (last_path_time || resuming_fuzz || queue_cycle == 1 ||
+      in_bitmap || crash_mode)) {
 
-      memcpy(in_data, tmp_buf, del_pos + tail_len);
+    SAYF(bV bSTOP "   last new path : " cNOR "%-34s ",
+         DTD(cur_ms, last_path_time));
 
-      in_len = del_pos + tail_len;
-      changed_any = 1;
+  } else {
 
-    } else del_pos += del_len;
+    if (dumb_mode)
 
-  }
+      SAYF(bV bSTOP "   last new path : " cPIN "n/a" cNOR 
+           " (non-instrumented mode)        ");
 
-  if (del_len > 1 && in_len >= 1) {
+     else
 
-    del_len /= 2;
-    goto next_del_blksize;
+      SAYF(bV bSTOP "   last new path : " cNOR "none yet " cLRD
+           "(odd, check syntax!)      ");
 
   }
 
-  // OKF("Block removal complete, %u bytes deleted.", stage_o_len - in_len);
-
-  if (!in_len && changed_any)
-    WARNF(cLRD "Down to zero bytes - check the command line and mem limit!" cRST);
-
-  if (cur_pass > 1 && !changed_any) goto finalize_all;
+  SAYF(bSTG bV bSTOP "  total paths : " cNOR "%-5s  " bSTG bV "\n",
+       DI(queued_paths));
 
-  // /*************************
-  //  * ALPHABET MINIMIZATION *
-  //  *************************/
+  /* Highlight crashes in red if found, denote going over the KEEP_UNIQUE_CRASH
+     limit with a '+' appended to the count. */
 
-  // alpha_size   = 0;
-  // alpha_del1   = 0;
-  // syms_removed = 0;
+  sprintf(tmp, "%s%s", DI(unique_crashes),
+          (unique_crashes >= KEEP_UNIQUE_CRASH) ? "+" : "");
 
-  // memset(alpha_map, 0, 256);
+  SAYF(bV bSTOP " last uniq crash : " cNOR "%-34s " bSTG bV bSTOP
+       " uniq crashes : %s%-6s " bSTG bV "\n",
+       DTD(cur_ms, last_crash_time), unique_crashes ? cLRD : cNOR,
+       tmp);
 
-  // for (i = 0; i < in_len; i++) {
-  //   if (!alpha_map[in_data[i]]) alpha_size++;
-  //   alpha_map[in_data[i]]++;
-  // }
+  sprintf(tmp, "%s%s", DI(unique_hangs),
+         (unique_hangs >= KEEP_UNIQUE_HANG) ? "+" : "");
 
-  // // ACTF(cBRI "Stage #2: " cNOR "Minimizing symbols (%u code point%s)...",
-  //      // alpha_size, alpha_size == 1 ? "" : "s");
+  SAYF(bV bSTOP "  last uniq hang : " cNOR "%-34s " bSTG bV bSTOP 
+       "   uniq hangs : " cNOR "%-6s " bSTG bV "\n",
+       DTD(cur_ms, last_hang_time), tmp);
 
-  // for (i = 0; i < 256; i++) {
+  SAYF(bVR bH bSTOP cCYA " cycle progress " bSTG bH20 bHB bH bSTOP cCYA
+       " map coverage " bSTG bH bHT bH20 bH2 bH bVL "\n");
 
-  //   u32 r;
+  /* This gets funny becuse we want to print several variable-length variables
+     together, but then cram them into a fixed-width field - so we need to
+     put them in a temporary buffer first. */
 
-  //   if (i == '0' || !alpha_map[i]) continue;
+  // sprintf(tmp, "%s%s (%0.02f%%)", DI(current_entry),
+  //         queue_cur->favored ? "" : "*",
+  //         ((double)current_entry * 100) / queued_paths);
+  sprintf(tmp, "%s%s%d (%0.02f%%)", DI(current_entry),
+        queue_cur != QUEUE_NONE && !queue_hot[queue_cur].favored ? "*" : ".",
+        queue_cur != QUEUE_NONE ? queue_hot[queue_cur].fuzz_level : -1,
+        ((double)current_entry * 100) / queued_paths);
 
-  //   memcpy(tmp_buf, in_data, in_len);
 
-  //   for (r = 0; r < in_len; r++)
-  //     if (tmp_buf[r] == i) tmp_buf[r] = '0'; 
+  SAYF(bV bSTOP "  now processing : " cNOR "%-17s " bSTG bV bSTOP, tmp);
 
-  //   write_to_testcase(tmp_buf, in_len);
-  //   fault = run_target(argv);
 
-  //   if (stop_soon || fault == FAULT_ERROR) goto abort_trimming;
+  sprintf(tmp, "%s (%0.02f%%)", DI(t_bytes), t_byte_ratio);
 
-  //   u32 cksum = hash32(trace_bits, MAP_SIZE, HASH_CONST);
-  //   if (cksum == orig_cksum) {
+  SAYF("    map density : %s%-21s " bSTG bV "\n", t_byte_ratio > 70 ? cLRD : 
+       ((t_bytes < 200 && !dumb_mode) ? cPIN : cNOR), tmp);
 
-  //     memcpy(in_data, tmp_buf, in_len);
-  //     syms_removed++;
-  //     alpha_del1 += alpha_map[i];
-  //     changed_any = 1;
+  sprintf(tmp, "%s (%0.02f%%)", DI(cur_skipped_paths),
+          ((double)cur_skipped_paths * 100) / queued_paths);
 
-  //   }
+  SAYF(bV bSTOP " paths timed out : " cNOR "%-17s " bSTG bV, tmp);
 
-  // }
+  sprintf(tmp, "%0.02f bits/tuple",
+          t_bytes ? (((double)t_bits) / t_bytes) : 0);
 
-  // alpha_d_total += alpha_del1;
+  SAYF(bSTOP " count coverage : " cNOR "%-21s " bSTG bV "\n", tmp);
 
-  // // OKF("Symbol minimization finished, %u symbol%s (%u byte%s) replaced.",
-  // //     syms_removed, syms_removed == 1 ? "" : "s",
-  // //     alpha_del1, alpha_del1 == 1 ? "" : "s");
+  SAYF(bVR bH bSTOP cCYA " stage progress " bSTG bH20 bX bH bSTOP cCYA
+       " findings in depth " bSTG bH20 bVL "\n");
 
-  // /**************************
-  //  * CHARACTER MINIMIZATION *
-  //  **************************/
+  sprintf(tmp, "%s (%0.02f%%)", DI(queued_favored),
+          ((double)queued_favored) * 100 / queued_paths);
 
-  // alpha_del2 = 0;
+  /* Yeah... it's still going on... halp? */
 
-  // // ACTF(cBRI "Stage #3: " cNOR "Character minimization...");
+  SAYF(bV bSTOP "  now trying : " cNOR "%-21s " bSTG bV bSTOP 
+       " favored paths : " cNOR "%-22s " bSTG bV "\n", stage_name, tmp);
 
-  // for (i = 0; i < in_len; i++) {
+  if (!stage_max) {
 
-  //   if (tmp_buf[i] == '0') continue;
+    sprintf(tmp, "%s/-", DI(stage_cur));
 
-  //   memcpy(tmp_buf, in_data, in_len);
+  } else {
 
-  //   tmp_buf[i] = '0';
+    sprintf(tmp, "%s/%s (%0.02f%%)", DI(stage_cur), DI(stage_max),
+            ((double)stage_cur) * 100 / stage_max);
 
-  //   write_to_testcase(tmp_buf, in_len);
-  //   fault = run_target(argv);
+  }
 
-  //   if (stop_soon || fault == FAULT_ERROR) goto abort_trimming;
+  SAYF(bV bSTOP " stage execs : " cNOR "%-21s " bSTG bV bSTOP, tmp);
 
-  //   u32 cksum = hash32(trace_bits, MAP_SIZE, HASH_CONST);
-  //   if (cksum == orig_cksum) {
+  sprintf(tmp, "%s (%0.02f%%)", DI(queued_with_cov),
+          ((double)queued_with_cov) * 100 / queued_paths);
 
-  //     memcpy(in_data, tmp_buf, in_len);
-  //     alpha_del2++;
-  //     changed_any = 1;
+  SAYF("  new edges on : " cNOR "%-22s " bSTG bV "\n", tmp);
 
-  //   }
+  sprintf(tmp, "%s (%s%s unique)", DI(total_crashes), DI(unique_crashes),
+          (unique_crashes >= KEEP_UNIQUE_CRASH) ? "+" : "");
 
-  // }
+  if (crash_mode) {
 
-  // alpha_d_total += alpha_del2;
+    SAYF(bV bSTOP " total execs : " cNOR "%-21s " bSTG bV bSTOP
+         "   new crashes : %s%-22s " bSTG bV "\n", DI(total_execs),
+         unique_crashes ? cLRD : cNOR, tmp);
 
-  // // OKF("Character minimization done, %u byte%s replaced.",
-  // //     alpha_del2, alpha_del2 == 1 ? "" : "s");
+  } else {
 
-  if (changed_any) goto next_pass;
+    SAYF(bV bSTOP " total execs : " cNOR "%-21s " bSTG bV bSTOP
+         " total crashes : %s%-22s " bSTG bV "\n", DI(total_execs),
+         unique_crashes ? cLRD : cNOR, tmp);
 
-finalize_all:
+  }
 
-  // re-run the final minimized in_data
-  write_to_testcase(in_data, in_len);
-  fault = run_target(argv);
- 
-  if (stop_soon || fault == FAULT_ERROR) goto abort_trimming;
+  /* Show a warning about slow execution. */
 
-  // SAYF("\n"
-  //      cGRA "     File size reduced by : " cNOR "%0.02f%% (to %u byte%s)\n"
-  //      cGRA "    Characters simplified : " cNOR "%0.02f%%\n"
-  //      cGRA "     Number of execs done : " cNOR "%u\n"
-  //      cGRA "          Fruitless execs : " cNOR "path=%u crash=%u hang=%s%u\n\n",
-  //      100 - ((double)in_len) * 100 / orig_len, in_len, in_len == 1 ? "" : "s",
-  //      ((double)(alpha_d_total)) * 100 / (in_len ? in_len : 1),
-  //      total_execs, missed_paths, missed_crashes, missed_hangs ? cLRD : "",
-  //      missed_hangs);
+  if (avg_exec < 100) {
 
-  // if (total_execs > 50 && missed_hangs * 10 > total_execs)
-  //   WARNF(cLRD "Frequent timeouts - results may be skewed." cRST);
+    sprintf(tmp, "%s/sec (%s)", DF(avg_exec), avg_exec < 20 ?
+            "zzzz..." : "slow!");
 
-  SAYF("\n"
-     cGRA "     File size reduced by : " cNOR "%0.02f%% (%u to %u byte%s)\n",
-     // cGRA "    Characters simplified : " cNOR "%0.02f%%\n\n",
-     100 - ((double)in_len) * 100 / orig_len, orig_len, in_len, in_len == 1 ? "" : "s");
-     // ((double)(alpha_d_total)) * 100 / (in_len ? in_len : 1));
+    SAYF(bV bSTOP "  exec speed : " cLRD "%-21s ", tmp);
 
-abort_trimming:
-  stage_name = old_sn;
-  
-  if(fault == FAULT_ERROR)
-    FATAL("Unable to execute target application");
-    
-  return in_len;
+  } else {
 
-}
+    sprintf(tmp, "%s/sec", DF(avg_exec));
+    SAYF(bV bSTOP "  exec speed : " cNOR "%-21s ", tmp);
 
+  }
 
+  sprintf(tmp, "%s (%s%s unique)", DI(total_hangs), DI(unique_hangs),
+          (unique_hangs >= KEEP_UNIQUE_HANG) ? "+" : "");
 
-static void show_stats(void);
+  SAYF (bSTG bV bSTOP "   total hangs : " cNOR "%-22s " bSTG bV "\n", tmp);
 
-/* Calibrate a new test case. This is done when processing the input directory
-   to warn about flaky or otherwise problematic test cases early on; and when
-   new paths are discovered to detect variable behavior and so on. */
+  /* Aaaalmost there... hold on! */
 
-static u8 calibrate_case(char** argv, struct queue_entry* q, u8* use_mem,
-                         u32 handicap, u8 from_queue) {
+  SAYF(bVR bH cCYA bSTOP " fuzzing strategy yields " bSTG bH10 bH bHT bH10
+       bH5 bHB bH bSTOP cCYA " path geometry " bSTG bH5 bH2 bH bVL "\n");
 
-  u8  fault = 0, new_bits = 0, var_detected = 0, first_run = (q->exec_cksum == 0);
-  u64 start_us, stop_us;
+  if (skip_deterministic) {
 
-  s32 old_sc = stage_cur, old_sm = stage_max, old_tmout = exec_tmout;
-  u8* old_sn = stage_name;
+    strcpy(tmp, "n/a, n/a, n/a");
 
-  /* Be a bit more generous about timeouts when resuming sessions, or when
-     trying to calibrate already-added finds. This helps avoid trouble due
-     to intermittent latency. */
+  } else {
 
-  if (!from_queue || resuming_fuzz)
-    exec_tmout = MAX(exec_tmout + CAL_TMOUT_ADD,
-                     exec_tmout * CAL_TMOUT_PERC / 100);
+    sprintf(tmp, "%s/%s, %s/%s, %s/%s",
+            DI(stage_finds[STAGE_FLIP1]), DI(stage_cycles[STAGE_FLIP1]),
+            DI(stage_finds[STAGE_FLIP4]), DI(stage_cycles[STAGE_FLIP2]),
+            DI(stage_finds[STAGE_FLIP4]), DI(stage_cycles[STAGE_FLIP4]));
 
-  q->cal_failed++;
+  }
 
-  stage_name = "calibration";
-  stage_max  = no_var_check ? CAL_CYCLES_NO_VAR : CAL_CYCLES;
+  SAYF(bV bSTOP "   bit flips : " cNOR "%-37s " bSTG bV bSTOP "    levels : "
+       cNOR "%-10s " bSTG bV "\n", tmp, DI(max_depth));
 
-  /* Make sure the forkserver is up before we do anything, and let's not
-     count its spin-up time toward binary calibration. */
+  if (!skip_deterministic)
+    sprintf(tmp, "%s/%s, %s/%s, %s/%s",
+            DI(stage_finds[STAGE_FLIP8]), DI(stage_cycles[STAGE_FLIP8]),
+            DI(stage_finds[STAGE_FLIP16]), DI(stage_cycles[STAGE_FLIP16]),
+            DI(stage_finds[STAGE_FLIP32]), DI(stage_cycles[STAGE_FLIP32]));
 
-  if (!dumb_mode && !no_forkserver && !forksrv_pid)
-    init_forkserver(argv);
-  // while(1);
-  start_us = get_cur_time_us();
-  // ACTF("stage_max: %d", stage_max);
+  SAYF(bV bSTOP "  byte flips : " cNOR "%-37s " bSTG bV bSTOP "   pending : "
+       cNOR "%-10s " bSTG bV "\n", tmp, DI(pending_not_fuzzed));
 
-  for (stage_cur = 0; stage_cur < stage_max; stage_cur++) {
+  if (!skip_deterministic)
+    sprintf(tmp, "%s/%s, %s/%s, %s/%s",
+            DI(stage_finds[STAGE_ARITH8]), DI(stage_cycles[STAGE_ARITH8]),
+            DI(stage_finds[STAGE_ARITH16]), DI(stage_cycles[STAGE_ARITH16]),
+            DI(stage_finds[STAGE_ARITH32]), DI(stage_cycles[STAGE_ARITH32]));
 
-    u32 cksum;
+  SAYF(bV bSTOP " arithmetics : " cNOR "%-37s " bSTG bV bSTOP "  pend fav : "
+       cNOR "%-10s " bSTG bV "\n", tmp, DI(pending_favored));
 
-    if (!first_run && !(stage_cur % stats_update_freq)) show_stats();
+  if (!skip_deterministic)
+    sprintf(tmp, "%s/%s, %s/%s, %s/%s",
+            DI(stage_finds[STAGE_INTEREST8]), DI(stage_cycles[STAGE_INTEREST8]),
+            DI(stage_finds[STAGE_INTEREST16]), DI(stage_cycles[STAGE_INTEREST16]),
+            DI(stage_finds[STAGE_INTEREST32]), DI(stage_cycles[STAGE_INTEREST32]));
 
-    write_to_testcase(use_mem, q->len);
-    // ACTF("run_target() 1 at staget_cur: %d", stage_cur);
-    fault = run_target(argv);
-    
-    /* stop_soon is set by the handler for Ctrl+C. When it's pressed,
-       we want to bail out quickly. */
+  SAYF(bV bSTOP "  known ints : " cNOR "%-37s " bSTG bV bSTOP " own finds : "
+       cNOR "%-10s " bSTG bV "\n", tmp, DI(queued_discovered));
 
-    if (stop_soon || fault != crash_mode) goto abort_calibration;
+  if (!skip_deterministic)
+    sprintf(tmp, "%s/%s, %s/%s, %s/%s",
+            DI(stage_finds[STAGE_EXTRAS_UO]), DI(stage_cycles[STAGE_EXTRAS_UO]),
+            DI(stage_finds[STAGE_EXTRAS_UI]), DI(stage_cycles[STAGE_EXTRAS_UI]),
+            DI(stage_finds[STAGE_EXTRAS_AO]), DI(stage_cycles[STAGE_EXTRAS_AO]));
 
-    if (!dumb_mode && !stage_cur && !count_bytes(trace_bits)) {
-      fault = FAULT_NOINST;
-      goto abort_calibration;
-    }
+  u8 _tmp[256];
+  memset(_tmp, ' ', banner_pad);
+  if(sync_id)
+    sprintf(_tmp, "%s|%s[%s]", DI(queued_imported), DI(sync_count), DI(sync_times));
+  else
+    sprintf(_tmp, "%s", (u8*)"n/a");
 
-    cksum = hash32(trace_bits, MAP_SIZE, HASH_CONST);
-    // ACTF("cksum: %u @%d", cksum, stage_cur);
-    if (q->exec_cksum != cksum) {
+  // SAYF(bV bSTOP "  dictionary : " cNOR "%-37s " bSTG bV bSTOP
+  //      "  imported : " cNOR "%-10s " bSTG bV "\n", tmp,
+  //      sync_id ? DI(queued_imported) : (u8*)"n/a");
+  SAYF(bV bSTOP "  dictionary : " cNOR "%-37s " bSTG bV bSTOP
+       "  imported : " cNOR "%-10s " bSTG bV "\n", tmp, _tmp);
+  
+  sprintf(tmp, "%s/%s, %s/%s",
+          DI(stage_finds[STAGE_HAVOC]), DI(stage_cycles[STAGE_HAVOC]),
+          DI(stage_finds[STAGE_SPLICE]), DI(stage_cycles[STAGE_SPLICE]));
 
-      u8 hnb = has_new_bits(virgin_bits);
-      if (hnb > new_bits) new_bits = hnb;
+  SAYF(bV bSTOP "       havoc : " cNOR "%-37s " bSTG bV bSTOP 
+       "  variable : %s%-10s " bSTG bV "\n", tmp, queued_variable ? cLRD : cNOR,
+      no_var_check ? (u8*)"n/a" : DI(queued_variable));
 
-      if (!no_var_check && q->exec_cksum) {
+  if (!bytes_trim_out) {
 
-        var_detected = 1;
-        stage_max    = CAL_CYCLES_LONG;
+    sprintf(tmp, "n/a, ");
 
-      } else q->exec_cksum = cksum;
+  } else {
 
-    }
+    sprintf(tmp, "%0.02f%%/%s, ",
+            ((double)(bytes_trim_in - bytes_trim_out)) * 100 / bytes_trim_in,
+            DI(trim_execs));
 
   }
-  
-  stop_us = get_cur_time_us();
 
-  total_cal_us     += stop_us - start_us;
-  total_cal_cycles += stage_max;
+  if (!blocks_eff_total) {
+
+    u8 tmp2[128];
 
-  /* OK, let's collect some stats about the performance of this test case.
-     This is used for fuzzing air time calculations in calculate_score(). */
+    sprintf(tmp2, "n/a");
+    strcat(tmp, tmp2);
 
-  q->exec_us     = (stop_us - start_us) / stage_max;
-  q->bitmap_size = count_bytes(trace_bits);
-  q->handicap    = handicap;
-  q->cal_failed  = 0;
+  } else {
 
-  total_bitmap_size += q->bitmap_size;
-  total_bitmap_entries++;
-  update_bitmap_score(q);
+    u8 tmp2[128];
 
-  /* If this case didn't result in new output from the instrumentation, tell
-     parent. This is a non-critical problem, but something to warn the user
-     about. */
-  
-  if (!dumb_mode && first_run && !fault && !new_bits) fault = FAULT_NOBITS;
+    sprintf(tmp2, "%0.02f%%",
+            ((double)(blocks_eff_total - blocks_eff_select)) * 100 /
+            blocks_eff_total);
 
-abort_calibration:
+    strcat(tmp, tmp2);
 
-  if (new_bits == 2 && !q->has_new_cov) {
-    q->has_new_cov = 1;
-    queued_with_cov++;
   }
 
-  /* Mark variable paths. */
+  SAYF(bV bSTOP "        trim : " cNOR "%-37s " bSTG bVR bH20 bH2 bH2 bRB "\n"
+       bLB bH30 bH20 bH2 bH bRB bSTOP cRST RESET_G1, tmp);
 
-  if (var_detected && !q->var_behavior) {
-    mark_as_variable(q);
-    queued_variable++;
-  }
+  /* Provide some CPU utilization stats. */
 
-  stage_name = old_sn;
-  stage_cur  = old_sc;
-  stage_max  = old_sm;
-  exec_tmout = old_tmout;
-  if (!first_run) show_stats();
+  if (cpu_core_count) {
 
-  return fault;
+    double cur_runnable = get_runnable_processes();
+    u32 cur_utilization = cur_runnable * 100 / cpu_core_count;
 
-}
+    u8* cpu_color = cCYA;
+
+    /* If we could still run one or more processes, use green. */
+
+    if (cpu_core_count > 1 && cur_runnable + 1 <= cpu_core_count)
+      cpu_color = cLGN;
+
+    /* If we're clearly oversubscribed, use red. */
 
+    if (!no_cpu_meter_red && cur_utilization >= 150) cpu_color = cLRD;
 
+    SAYF(SP10 cGRA "   [cpu:%s%3u%%" cGRA "]\r" cRST,
+         cpu_color, cur_utilization < 999 ? cur_utilization : 999);
 
+  } else SAYF("\r");
 
+  /* Hallelujah! */
 
+  fflush(0);
 
+}
 
 
+static void show_stats__()
+{
+  return;
+}
 
 
+/* Display quick statistics at the end of processing the input directory,
+   plus a bunch of warnings. Some calibration stuff also ended up here,
+   along with several hardcoded constants. Maybe clean up eventually. */
 
+static void show_init_stats(void) {
 
+  u32 i;
+  u32 min_bits = 0, max_bits = 0;
+  u64 min_us = 0, max_us = 0;
+  u64 avg_us = 0;
+  u32 max_len = 0;
 
+  if (total_cal_cycles) avg_us = total_cal_us / total_cal_cycles;
 
-#ifndef SIMPLE_FILES
+  for (i = 0; i < queued_paths; i++) {
 
-/* Construct a file name for a new test case, capturing the operation
-   that led to its discovery. Uses a static buffer. */
+    struct queue_hot* q = queue_hot + i;
+    u32 bitmap_size = queue_cold[i].bitmap_size;
 
-static u8* describe_op(u8 hnb) {
+    if (!min_us || q->exec_us < min_us) min_us = q->exec_us;
+    if (q->exec_us > max_us) max_us = q->exec_us;
 
-  static u8 ret[256];
+    if (!min_bits || bitmap_size < min_bits) min_bits = bitmap_size;
+    if (bitmap_size > max_bits) max_bits = bitmap_size;
 
-  if (syncing_party) {
+    if (q->len > max_len) max_len = q->len;
 
-    sprintf(ret, "sync:%s,src:%08u", syncing_party, syncing_case);
+  }
 
-  } else {
+  SAYF("\n");
 
-    sprintf(ret, "src:%08u", current_entry);
+  if (avg_us > (qemu_mode ? 50000 : 10000)) 
+    WARNF(cLRD "The target binary is pretty slow! See %s/perf_tips.txt.",
+          doc_path);
 
-    if (splicing_with >= 0)
-      sprintf(ret + strlen(ret), "+%08u", splicing_with);
+  /* Let's keep things moving with slow binaries. */
 
-    sprintf(ret + strlen(ret), ",op:%s", stage_short);
+  if (avg_us > 50000) havoc_div = 10;     /* 0-19 execs/sec   */
+  else if (avg_us > 20000) havoc_div = 5; /* 20-49 execs/sec  */
+  else if (avg_us > 10000) havoc_div = 2; /* 50-100 execs/sec */
 
-    if (stage_cur_byte >= 0) {
+  if (!resuming_fuzz) {
 
-      sprintf(ret + strlen(ret), ",pos:%u", stage_cur_byte);
+    if (max_len > 50 * 1024)
+      WARNF(cLRD "Some test cases are huge (%s) - see %s/perf_tips.txt!",
+            DMS(max_len), doc_path);
+    else if (max_len > 10 * 1024)
+      WARNF("Some test cases are big (%s) - see %s/perf_tips.txt.",
+            DMS(max_len), doc_path);
 
-      if (stage_val_type != STAGE_VAL_NONE)
-        sprintf(ret + strlen(ret), ",val:%s%+d", 
-                (stage_val_type == STAGE_VAL_BE) ? "be:" : "",
-                stage_cur_val);
+    if (useless_at_start && !in_bitmap)
+      WARNF(cLRD "Some test cases look useless. Consider using a smaller set.");
 
-    } else sprintf(ret + strlen(ret), ",rep:%u", stage_cur_val);
+    if (queued_paths > 100)
+      WARNF(cLRD "You probably have far too many input files! Consider trimming down.");
+    else if (queued_paths > 20)
+      WARNF("You have lots of input files; try starting small.");
 
   }
 
-  if (hnb == 2) strcat(ret, ",+cov");
+  OKF("Here are some useful stats:\n\n"
 
-  return ret;
+      cGRA "    Test case count : " cNOR "%u favored, %u variable, %u total\n"
+      cGRA "       Bitmap range : " cNOR "%u to %u bits (average: %0.02f bits)\n"
+      cGRA "        Exec timing : " cNOR "%s to %s us (average: %s us)\n",
+      queued_favored, queued_variable, queued_paths, min_bits, max_bits, 
+      ((double)total_bitmap_size) / (total_bitmap_entries ? total_bitmap_entries : 1),
+      DI(min_us), DI(max_us), DI(avg_us));
 
-}
+  if (!timeout_given) {
 
-#endif /* !SIMPLE_FILES */
+    /* Figure out the appropriate timeout. The basic idea is: 5x average or
+       1x max, rounded up to EXEC_TM_ROUND ms and capped at 1 second.
 
+       If the program is slow, the multiplier is lowered to 2x or 3x, because
+       random scheduler jitter is less likely to have any impact, and because
+       our patience is wearing thin =) */
 
-/* Write a message accompanying the crash directory :-) */
+    if (avg_us > 50000) exec_tmout = avg_us * 2 / 1000;
+    else if (avg_us > 10000) exec_tmout = avg_us * 3 / 1000;
+    else exec_tmout = avg_us * 5 / 1000;
 
-static void write_crash_readme(void) {
+    exec_tmout = MAX(exec_tmout, max_us / 1000);
+    exec_tmout = (exec_tmout + EXEC_TM_ROUND) / EXEC_TM_ROUND * EXEC_TM_ROUND;
 
-  u8* fn = alloc_printf("%s/crashes/README.txt", out_dir);
-  s32 fd;
-  FILE* f;
+    if (exec_tmout > EXEC_TIMEOUT) exec_tmout = EXEC_TIMEOUT;
 
-  fd = open(fn, O_WRONLY | O_CREAT | O_EXCL, 0600);
-  ck_free(fn);
+    ACTF("No -t option specified, so I'll use exec timeout of %u ms.", 
+         exec_tmout);
 
-  /* Do not die on errors here - that would be impolite. */
+    timeout_given = 1;
 
-  if (fd < 0) return;
+  }
 
-  f = fdopen(fd, "w");
+  OKF("All set and ready to roll!");
 
-  if (!f) {
-    close(fd);
-    return;
-  }
+}
 
-  fprintf(f, "Command line used to find this crash:\n\n"
 
-             "%s\n\n"
 
-             "If you can't reproduce a bug outside of afl-fuzz, be sure to set the same\n"
-             "memory limit. The limit used for this fuzzing session was %s.\n\n"
 
-             "Need a tool to minimize test cases before investigating the crashes or sending\n"
-             "them to a vendor? Check out the afl-tmin that comes with the fuzzer!\n\n"
 
-             "Found any cool bugs in open-source tools using afl-fuzz? If yes, please drop\n"
-             "me a mail at <lcamtuf@coredump.cx> once the issues are fixed - I'd love to\n"
-             "add your finds to the gallery at:\n\n"
 
-             "  http://lcamtuf.coredump.cx/afl/\n\n"
 
-             "Thanks :-)\n",
+static int startswith(const char *str, const char *prefix)
+{
+    return strncmp(prefix, str, strlen(prefix)) == 0;
+}
 
-             orig_cmdline, DMS(mem_limit << 20)); /* ignore errors */
+/* Exec times of the seeds from a producer or task that did not hang, as a
+   histogram over powers of two (us). */
 
-  fclose(f);
+struct tmout_stats {
 
-}
+  u32 hist[32],                       /* Runs per floor(log2(exec_us))    */
+      cnt;                            /* Runs counted                     */
+
+};
 
+/* A producer directory being synced from, with the backlog of seeds found
+   in it on this pass. */
 
-/* Check if the result of an execve() during routine fuzzing is interesting,
-   save or queue the input test case for further analysis if so. Returns 1 if
-   entry is saved, 0 otherwise. */
+struct sync_src {
 
-static u8 save_if_interesting(char** argv, void* mem, u32 len, u8 fault) {
+  u8* qd_path;                        /* Directory with the seeds         */
+  u8* synced_path;                    /* Cursor file in .synced/          */
+  u8* party;                          /* Name shown by describe_op()      */
+  u8* done_path;                      /* Spool .done marker, if any       */
 
-  u8  *fn = "";
-  u8  *tmp = "";
-  u8  hnb = 0;
-  s32 fd;
-  u8  keeping = 0, res;
-  int ifnew;
+  u8  is_spool,                       /* Spool slot (id:N,task:M names)?  */
+      drained;                        /* .done was there before the scan? */
 
-  //Update path freq. No change to semantics
-  khiter_t k;
-  u32 key_cksum = hash32(trace_bits, MAP_SIZE, HASH_CONST);
-  k = kh_get(32, cksum2paths, key_cksum);
-  if (k != kh_end(cksum2paths)){
-    ++kh_value(cksum2paths, k);
-  }
-  
-  hnb = has_new_bits(virgin_bits);
-  uint64_t* afl_trace_p = (uint64_t*)(trace_bits + MAP_SIZE); 
-  kh_put(p64, hash_value_set, afl_trace_p[0], &ifnew);  
+  u8** names;                         /* Backlog (sorted file names)      */
+  s32 names_cnt,                      /* Backlog size                     */
+      names_pos;                      /* Next backlog entry to look at    */
 
-  if (fault == crash_mode && !crash_mode) {
+  s32 id_fd;                          /* Open cursor file                 */
+  u32 min_accept,                     /* Cursor at the start of the pass  */
+      next_min_accept;                /* Cursor to write back             */
 
-    /* Keep only if there are new bits in the map, add to queue for
-       future fuzzing, etc. */
-    
+  s32 task;                           /* Task of the last seed run        */
+  double score,                       /* Score of the originating task    */
+         yield;                       /* EWMA of seeds kept per seed run  */
 
-// #ifndef SIMPLE_FILES
-    if(hnb) { // edge queue
-      fn = alloc_printf("%s/queue/id:%08u_%d", out_dir, my_edges, filter_index);
-      FILE *edge_rare = fopen(rareness_log_edge, "a+");
-      //flock(fileno(edge_rare), LOCK_EX);
-      fprintf(edge_rare, "%.8f,id:%08u_%d,eq\n", rareness, my_edges, filter_index);
-      //flock(fileno(edge_rare), LOCK_UN);
-      fclose(edge_rare);
-      my_edges += 1;
-    } else if(ifnew) {    // path queue      
-      fn = alloc_printf("%s-path/_queue/id:%08u_%d", out_dir, my_paths, filter_index);
-      FILE *path_rare = fopen(rareness_log_path, "a+");
-      //flock(fileno(path_rare), LOCK_EX);
-      fprintf(path_rare, "%.8f,id:%08u_%d,pq\n", rareness, my_paths, filter_index);
-      //flock(fileno(path_rare), LOCK_UN);
-      fclose(path_rare);
-      my_paths += 1;
-    } else {
-      return 0;
-    }
-    
+  struct tmout_stats tm;              /* Exec times of its seeds          */
 
-// #else
+};
 
-//     fn = alloc_printf("%s/queue/id_%08u", out_dir, queued_paths);
+static struct sync_src spool_srcs[SPOOL_SLOTS];
 
-// #endif /* ^!SIMPLE_FILES */
+static struct sync_src* fuzz_srcs;    /* Producers in the legacy layout   */
+static u32 fuzz_srcs_cnt;             /* ...and how many there are        */
 
-    // if (is_trim_case && (len <= 10*1024))
-    // {
-    //   len = minimize_case(argv, mem, len, key_cksum, fn);
-    // }
+static u8  sync_policy;               /* SYNC_POLICY_*                    */
+static u32 sync_rr_cur;               /* Round-robin position             */
 
-    // extra_blocks(queued_paths, 0);
-    add_to_queue(fn, len, 0);
+enum {
+  /* 00 */ SYNC_POLICY_RR,
+  /* 01 */ SYNC_POLICY_SCORE,
+  /* 02 */ SYNC_POLICY_YIELD
+};
 
-    if (hnb/* == 2*/) {
-      queue_top->has_new_cov = 1;
-      queued_with_cov++;
-    }
+static u8* sync_policy_names[] = { "rr", "score", "yield" };
 
-    queue_top->exec_cksum = key_cksum; //hash32(trace_bits, MAP_SIZE, HASH_CONST);
-    int ret;
-    if (k == kh_end(cksum2paths)){
-      k = kh_put(32, cksum2paths, key_cksum, &ret);
-      kh_value(cksum2paths, k) = 1;
-    } 
-    /* Try to calibrate inline; this also calls update_bitmap_score() when
-       successful. */
+static struct sync_src defer_src;     /* deferred/, read like a spool slot */
 
-    // ACTF("calibrating");
-    //res = calibrate_case(argv, queue_top, mem, queue_cycle - 1, 0);
+/* Seeds seen per task, direct-mapped like tmout_fam[]. */
 
-    // if (res == FAULT_ERROR)
-    //   FATAL("Unable to execute target application");
-    //tmp = alloc_printf("%s/tmp", out_dir);
-    fd = open(fn, O_WRONLY | O_CREAT | O_EXCL, 0600);
-    if (fd < 0) PFATAL("Unable to create '%s'", fn);
-    ck_write(fd, mem, len, fn);
-    close(fd);
+struct ovl_task {
 
-    //rename(tmp, fn);
-    keeping = 1;
-  }
+  s32 task;                           /* Task owning the slot             */
+  u32 seen;                           /* Seeds of it picked so far        */
 
-  switch (fault) {
+};
 
-    case FAULT_HANG:
+static struct ovl_task ovl_tasks[OVERLOAD_TASKS];
 
-      /* Hangs are not very interesting, but we're still obliged to keep
-         a handful of samples. We use the presence of new bits in the
-         hang-specific bitmap as a signal of uniqueness. In "dumb" mode, we
-         just keep everything. */
+/* Exec times per task (filter_index), direct-mapped; a task taking over a
+   slot evicts the one that was there. */
 
-      total_hangs++;
+struct tmout_family {
 
-      //if (unique_hangs >= KEEP_UNIQUE_HANG) return keeping;
+  s32 task;                           /* Task owning the slot             */
+  struct tmout_stats tm;              /* Exec times of its seeds          */
 
-      if (!dumb_mode) {
+};
 
-#ifdef __x86_64__
-        simplify_trace((u64*)trace_bits);
-#else
-        simplify_trace((u32*)trace_bits);
-#endif /* ^__x86_64__ */
+static struct tmout_family tmout_fam[HANG_FAMILIES];
 
-        if (!has_new_bits(virgin_hang)) return keeping;
+static u32 hang_sigs[HANG_CACHE_SIZE]; /* Signatures of recent hangs      */
 
-      }
 
-#ifndef SIMPLE_FILES
 
-      fn = alloc_printf("%s/hangs/id:%08llu,%s", out_dir,
-                        unique_hangs, describe_op(0));
+/* Count a run in an exec time histogram. */
 
-#else
+static void tmout_add(struct tmout_stats* t, u64 us) {
 
-      fn = alloc_printf("%s/hangs/id_%08llu", out_dir,
-                        unique_hangs);
+  u32 b = 0, i;
 
-#endif /* ^!SIMPLE_FILES */
+  while (b < 31 && (us >> (b + 1))) b++;
 
-      unique_hangs++;
+  t->hist[b]++;
 
-      last_hang_time = get_cur_time();
+  if (++t->cnt < HANG_HIST_MAX) return;
 
-      break;
+  for (t->cnt = i = 0; i < 32; i++) {
+    t->hist[i] >>= 1;
+    t->cnt += t->hist[i];
+  }
 
-    case FAULT_CRASH:
+}
 
-      /* This is handled in a manner roughly similar to hangs,
-         except for slightly different limits. */
 
-      total_crashes++;
+/* Timeout (ms) derived from a histogram, or 0 if it has too few runs. */
 
-      //if (unique_crashes >= KEEP_UNIQUE_CRASH) return keeping;
+static u32 tmout_pick(struct tmout_stats* t) {
 
-//       if (!dumb_mode) {
+  u32 b = 32, tail = 0;
+  u64 p99_us;
 
-// #ifdef __x86_64__
-//         simplify_trace((u64*)trace_bits);
-// #else
-//         simplify_trace((u32*)trace_bits);
-// #endif /* ^__x86_64__ */
+  if (t->cnt < HANG_MIN_SAMPLES) return 0;
 
-//         //if (!has_new_bits(virgin_crash)) return keeping;
+  while (b--) {
+    tail += t->hist[b];
+    if (tail * 100 > t->cnt) break;
+  }
 
-//       }
+  p99_us = 2ULL << b;
 
-      if (!unique_crashes) write_crash_readme();
+  return MAX(HANG_TMOUT_MIN, p99_us * HANG_TMOUT_MULT / 1000);
 
-// #ifndef SIMPLE_FILES
-      if(hnb) {
-        fn = alloc_printf("%s/crashes/id:%08llu_%d", out_dir, my_edge_crashes, filter_index);
-        FILE *edge_rare = fopen(rareness_log_edge, "a+");
-        flock(fileno(edge_rare), LOCK_EX);
-        fprintf(edge_rare, "%.8f,id:%08u_%d,ec\n", rareness, my_edge_crashes, filter_index);
-        flock(fileno(edge_rare), LOCK_UN);
-        fclose(edge_rare);
-        my_edge_crashes+=1;
-      } else if(ifnew){
-        fn = alloc_printf("%s-path/_crashes/id:%08llu_%d", out_dir, my_path_crashes, filter_index);  
-        FILE *path_rare = fopen(rareness_log_path, "a+");
-        flock(fileno(path_rare), LOCK_EX);
-        fprintf(path_rare, "%.8f,id:%08u_%d,pc\n", rareness, my_path_crashes, filter_index);
-        flock(fileno(path_rare), LOCK_UN);
-        fclose(path_rare);
-        my_path_crashes+=1;
-      } else {
-        return 0;
-      }
+}
 
-// #else
 
-//       fn = alloc_printf("%s/crashes/id_%08llu_%02u", out_dir, unique_crashes,
-//                         kill_signal);
+/* Signature of a seed for the hang cache: its length and first bytes. CE
+   siblings of a hanging input usually only differ further in. Never 0. */
 
-// #endif /* ^!SIMPLE_FILES */
+static u32 hang_sig(u8* mem, u32 len) {
 
-      if(unique_crashes == 0)
-      {
-        first_crash_time = get_cur_time();
-      }
+  return (hash32(mem, MIN(len, HANG_SIG_LEN), HASH_CONST) ^ len) | 1;
+
+}
 
-      //extra_blocks(unique_crashes, 1);
 
-      unique_crashes++;
+/* Pick the timeout for a seed from src (of task filter_index): the one for
+   its task, else for its producer, else -t; cut short if the seed looks
+   like a recent hang. */
 
-      last_crash_time = get_cur_time();
+static u32 sync_tmout(struct sync_src* src, u32 sig) {
 
-      break;
+  struct tmout_family* f = tmout_fam + (u32)filter_index % HANG_FAMILIES;
+  u32 ret = 0;
 
-    case FAULT_ERROR: FATAL("Unable to execute target application");
+  if (!adaptive_tmout) return exec_tmout;
 
-    default: return keeping;
+  if (f->task == filter_index) ret = tmout_pick(&f->tm);
+  if (!ret) ret = tmout_pick(&src->tm);
+  if (!ret || ret > exec_tmout) ret = exec_tmout;
 
+  if (hang_sigs[sig % HANG_CACHE_SIZE] == sig) {
+    ret = MAX(HANG_TMOUT_MIN, ret / HANG_FAST_DIV);
+    hang_cache_hits++;
   }
 
-  /* If we're here, we apparently want to save the crash or hang
-     test case, too. */
+  return MIN(ret, exec_tmout);
 
-  fd = open(fn, O_WRONLY | O_CREAT | O_EXCL, 0600);
-  if (fd < 0) PFATAL("Unable to create '%s'", fn);
-  ck_write(fd, mem, len, fn);
-  close(fd);
+}
 
-  ck_free(fn);
 
-  return keeping;
+/* Fold the outcome of a synced seed run with timeout tmout into the exec
+   time histograms, or into the hang cache. */
 
-}
+static void sync_tmout_note(struct sync_src* src, u32 sig, u32 tmout,
+                            u8 fault) {
 
+  struct tmout_family* f = tmout_fam + (u32)filter_index % HANG_FAMILIES;
 
-// /* When resuming, try to find the queue position to start from. This makes sense
-//    only when resuming, and when we can find the original fuzzer_stats. */
+  if (!adaptive_tmout) return;
 
-// static u32 find_start_position(void) {
+  if (f->task != filter_index) {
+    memset(f, 0, sizeof(struct tmout_family));
+    f->task = filter_index;
+  }
 
-//   static u8 tmp[4096]; /* Ought to be enough for anybody. */
+  if (fault == FAULT_HANG) {
 
-//   u8  *fn, *off;
-//   s32 fd, i;
-//   u32 ret;
+    hang_sigs[sig % HANG_CACHE_SIZE] = sig;
+    if (tmout < exec_tmout) short_hangs++;
+    return;
 
-//   if (!resuming_fuzz) return 0;
+  }
 
-//   if (in_place_resume) fn = alloc_printf("%s/fuzzer_stats", out_dir);
-//   else fn = alloc_printf("%s/../fuzzer_stats", in_dir);
+  tmout_add(&f->tm, last_exec_us);
+  tmout_add(&src->tm, last_exec_us);
 
-//   // fn = alloc_printf("%s/fuzzer_stats", remote_out_dir);
+}
 
-//   fd = open(fn, O_RDONLY);
-//   ck_free(fn);
 
-//   if (fd < 0) return 0;
+/* Read the score the scheduler left for the task feeding a producer, if
+   any. */
 
-//   i = read(fd, tmp, sizeof(tmp) - 1); (void)i; /* Ignore errors */
-//   close(fd);
+static double read_sync_score(u8* qd_path) {
 
-//   off = strstr(tmp, "cur_path       : ");
-//   if (!off) return 0;
+  u8* fn = arena_printf(&sync_arena, "%s/.score", qd_path);
+  FILE* f = fopen(fn, "r");
+  double ret = 0;
 
-//   ret = atoi(off + 17);
-//   if (ret >= queued_paths) ret = 0;
-//   return ret;
+  if (!f) return 0;
+  if (fscanf(f, "%lf", &ret) != 1) ret = 0;
+  fclose(f);
 
-// }
+  return ret;
 
+}
 
-/* Update stats file for unattended monitoring. */
 
-static void write_stats_file(double bitmap_cvg, double eps) {
+/* qsort() callback for sync_scan(). */
 
-  static double last_bcvg, last_eps;
+static int compare_names(const void* a, const void* b) {
 
-  u8* fn = alloc_printf("%s/fuzzer_stats", out_dir);
-  // u8* fn = alloc_printf("%s/fuzzer_stats", remote_out_dir);
-  s32 fd;
-  FILE* f;
+  return strcmp(*(char**)a, *(char**)b);
 
-  fd = open(fn, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+}
 
-  if (fd < 0) PFATAL("Unable to create '%s'", fn);
 
-  ck_free(fn);
+/* Called when a pass found nothing to sync and nothing else is pending:
+   give up the CPU token and sleep until a producer directory changes, or
+   for IDLE_WAIT_MS at most, so that the stats still get refreshed. */
 
-  f = fdopen(fd, "w");
+static void idle_wait(void) {
 
-  if (!f) PFATAL("fdopen() failed");
+  job_put();
 
-  /* Keep last values in case we're called from another context
-     where exec/sec stats and such are not readily available. */
+#ifdef __linux__
 
-  if (!bitmap_cvg && !eps) {
-    bitmap_cvg = last_bcvg;
-    eps        = last_eps;
-  } else {
-    last_bcvg = bitmap_cvg;
-    last_eps  = eps;
-  }
+  if (ino_fd >= 0) {
 
-  fprintf(f, "start_time            : %llu\n"
-             "last_update           : %llu\n"
-             "fuzzer_pid            : %u\n"
-             "first_crash_time      : %llu\n"
-             "last_crash_time       : %llu\n"
-             "cycles_done           : %llu\n"
-             "execs_done            : %llu\n"
-             "execs_per_sec         : %0.02f\n"
-             "paths_total           : %u\n"
-             "paths_found           : %u\n"
-             "paths_imported        : %u\n"
-             "max_depth             : %u\n"
-             "cur_path              : %u\n"
-             "pending_favs          : %u\n"
-             "pending_total         : %u\n"
-             "variable_paths        : %u\n"
-             "bitmap_cvg            : %0.02f%%\n"
-             "unique_crashes        : %llu\n"
-             "unique_hangs          : %llu\n"
-             "imported_paths        : %u\n"
-             "checked_paths         : %i\n"
-             "checked_crashes       : %i\n"
-             "sync_times            : %i\n"
-             "afl_banner            : %s\n"
-             "afl_version           : " VERSION "\n"
-             "command_line          : %s\n",
-             start_time / 1000, get_cur_time() / 1000, getpid(),
-             first_crash_time / 1000, last_crash_time /1000,
-             queue_cycle ? (queue_cycle - 1) : 0, total_execs, eps,
-             queued_paths, queued_discovered, queued_imported, max_depth,
-             current_entry, pending_favored, pending_not_fuzzed,
-             queued_variable, bitmap_cvg, unique_crashes, unique_hangs,
-             queued_imported, sync_count, sync_count_crashes, sync_times,
-             use_banner, orig_cmdline); /* ignore errors */
+    static u8 buf[4096] __attribute__((aligned(8)));
+    struct pollfd pfd;
 
-  fclose(f);
+    pfd.fd     = ino_fd;
+    pfd.events = POLLIN;
 
-}
+    if (poll(&pfd, 1, IDLE_WAIT_MS) > 0)
+      while (read(ino_fd, buf, sizeof(buf)) > 0);
 
+    return;
 
-/* Update the plot file if there is a reason to. */
+  }
 
-static void maybe_update_plot_file(double bitmap_cvg, double eps) {
+#endif /* __linux__ */
 
-  static u32 prev_qp, prev_pf, prev_pnf, prev_ce, prev_md;
-  static u64 prev_qc, prev_uc, prev_uh;
+  usleep(IDLE_POLL_MS * 1000);
 
-  if (prev_qp == queued_paths && prev_pf == pending_favored && 
-      prev_pnf == pending_not_fuzzed && prev_ce == current_entry &&
-      prev_qc == queue_cycle && prev_uc == unique_crashes &&
-      prev_uh == unique_hangs && prev_md == max_depth) return;
+}
 
-  prev_qp  = queued_paths;
-  prev_pf  = pending_favored;
-  prev_pnf = pending_not_fuzzed;
-  prev_ce  = current_entry;
-  prev_qc  = queue_cycle;
-  prev_uc  = unique_crashes;
-  prev_uh  = unique_hangs;
-  prev_md  = max_depth;
 
-  /* Fields in the file:
+/* Load the backlog of a producer: retrieve the ID of the last seen test
+   case and list what is in the directory right now. The (sorted) names of
+   the files are kept in sync_arena until the end of the pass; dot files are
+   left out. */
 
-     unix_time, cycles_done, cur_path, paths_total, paths_not_fuzzed,
-     favored_not_fuzzed, unique_crashes, unique_hangs, max_depth,
-     execs_per_sec */
+static void sync_scan(struct sync_src* src) {
 
-  fprintf(plot_file, 
-          "%llu, %llu, %u, %u, %u, %u, %0.02f%%, %llu, %llu, %u, %0.02f\n",
-          get_cur_time() / 1000, queue_cycle - 1, current_entry, queued_paths,
-          pending_not_fuzzed, pending_favored, bitmap_cvg, unique_crashes,
-          unique_hangs, max_depth, eps); /* ignore errors */
+  DIR* d;
+  struct dirent* de;
+  u8** old;
+  s32 cap = 0;
 
-  fflush(plot_file);
+  /* For the spool, check for the marker first: if it is there, so are all
+     the seeds. */
 
-}
+  if (src->done_path) src->drained = !access(src->done_path, F_OK);
 
+  src->names     = NULL;
+  src->names_cnt = 0;
+  src->names_pos = 0;
 
+#ifdef __linux__
 
-/* A helper function for maybe_delete_out_dir(), deleting all prefixed
-   files in a directory. */
+  /* Watch before reading, so that nothing added after the scan is missed
+     by idle_wait(). Watching a directory again is a no-op. */
 
-static u8 delete_files(u8* path, u8* prefix) {
+  if (ino_fd >= 0)
+    inotify_add_watch(ino_fd, src->qd_path,
+                      IN_CREATE | IN_MOVED_TO | IN_CLOSE_WRITE);
 
-  DIR* d;
-  struct dirent* d_ent;
+#endif /* __linux__ */
 
-  d = opendir(path);
+  d = opendir(src->qd_path);
+  if (!d) return;
 
-  if (!d) return 0;
+  while ((de = readdir(d))) {
 
-  while ((d_ent = readdir(d))) {
+    if (de->d_name[0] == '.') continue;
 
-    if (d_ent->d_name[0] != '.' && (!prefix ||
-        !strncmp(d_ent->d_name, prefix, strlen(prefix)))) {
+    if (src->names_cnt == cap) {
 
-      u8* fname = alloc_printf("%s/%s", path, d_ent->d_name);
-      if (unlink(fname)) PFATAL("Unable to delete '%s'", fname);
-      ck_free(fname);
+      old = src->names;
+      cap = cap ? cap * 2 : 64;
+
+      src->names = arena_alloc(&sync_arena, cap * sizeof(u8*));
+      if (old) memcpy(src->names, old, src->names_cnt * sizeof(u8*));
 
     }
 
+    src->names[src->names_cnt++] = arena_strdup(&sync_arena, (u8*)de->d_name);
+
   }
 
   closedir(d);
 
-  return !!rmdir(path);
+  qsort(src->names, src->names_cnt, sizeof(u8*), compare_names);
+
+  sync_backlog += src->names_cnt;
+
+  src->id_fd = open(src->synced_path, O_RDWR | O_CREAT, 0600);
+
+  if (src->id_fd < 0) PFATAL("Unable to create '%s'", src->synced_path);
+
+  src->min_accept = 0;
+
+  if (read(src->id_fd, &src->min_accept, sizeof(u32)) > 0) 
+    lseek(src->id_fd, 0, SEEK_SET);
+
+  src->next_min_accept = src->min_accept;
+
+  if (sync_policy == SYNC_POLICY_SCORE) src->score = read_sync_score(src->qd_path);
 
 }
 
 
-/* Get the number of runnable processes, with some simple smoothing. */
+/* Pick the next backlog entry of a producer that is worth running and
+   return its full path (in seed_arena), or NULL once the backlog is
+   exhausted. In spool mode,
+   file names also carry the index of the producing task (id:N,task:M),
+   which becomes filter_index. */
 
-static double get_runnable_processes(void) {
+static u8* sync_next(struct sync_src* src) {
 
-  static double res;
+  while (src->names_pos < src->names_cnt) {
 
-#if defined(__APPLE__) || defined(__FreeBSD__) || defined (__OpenBSD__)
+    u8* name = src->names[src->names_pos++];
+    s32 task;
 
-  /* I don't see any portable sysctl or so that would quickly give us the
-     number of runnable processes; the 1-minute load average can be a
-     semi-decent approximation, though. */
+    sync_backlog--;
 
-  if (getloadavg(&res, 1) != 1) return 0;
+    if (src->is_spool) {
 
-#else
+      /* Anything else in a slot would keep the scheduler from ever
+         reusing it, so it goes too. */
 
-  /* On Linux, /proc/stat is probably the best way; load averages are
-     computed in funny ways and sometimes don't reflect extremely short-lived
-     processes well. */
+      if (sscanf(name, CASE_PREFIX "%08u,task:%d", &syncing_case,
+                 &task) != 2) {
 
-  FILE* f = fopen("/proc/stat", "r");
-  u8 tmp[1024];
-  u32 val = 0;
+        u8* fn = arena_printf(&seed_arena, "%s/%s", src->qd_path, name);
 
-  if (!f) return 0;
+        WARNF("Removing stray file '%s' from the spool", fn);
+        if (unlink(fn) && errno != ENOENT) PFATAL("Unable to delete '%s'", fn);
+        continue;
 
-  while (fgets(tmp, sizeof(tmp), f)) {
+      }
 
-    if (!strncmp(tmp, "procs_running ", 14) ||
-        !strncmp(tmp, "procs_blocked ", 14)) val += atoi(tmp + 14);
+      /* Leftovers from before a restart were already run; just drop them. */
+
+      if (syncing_case < src->min_accept) {
+        unlink(arena_printf(&seed_arena, "%s/%s", src->qd_path, name));
+        continue;
+      }
+
+      /* A new task in the slot starts over with a fresh yield estimate. */
+
+      if (task != src->task) {
+        src->task  = task;
+        src->yield = 1.0;
+      }
+
+      filter_index = task;
+
+    } else {
+
+      if (sscanf(name, CASE_PREFIX "%08u", &syncing_case) != 1 ||
+          syncing_case < src->min_accept) continue;
+
+      filter_index = src->task;
+
+    }
+
+    if (syncing_case >= src->next_min_accept)
+      src->next_min_accept = syncing_case + 1;
+
+    return arena_printf(&seed_arena, "%s/%s", src->qd_path, name);
 
   }
- 
-  fclose(f);
 
-  if (!res) {
+  return NULL;
 
-    res = val;
+}
 
-  } else {
 
-    res = res * (1.0 - 1.0 / AVG_SMOOTHING) +
-          ((double)val) * (1.0 / AVG_SMOOTHING);
+/* Choose the producer to take the next seed from, according to
+   AFL_SYNC_POLICY. Returns -1 when all the backlogs are empty. */
+
+static s32 sync_pick(struct sync_src* srcs, u32 cnt) {
+
+  s32 best = -1;
+  u32 i;
+
+  for (i = 0; i < cnt; i++) {
+
+    u32 j = (sync_rr_cur + i) % cnt;
+    struct sync_src* src = srcs + j;
+
+    if (src->names_pos >= src->names_cnt) continue;
+
+    if (best < 0) { best = j; if (sync_policy == SYNC_POLICY_RR) break; }
+
+    else if (sync_policy == SYNC_POLICY_SCORE && src->score > srcs[best].score)
+      best = j;
+
+    else if (sync_policy == SYNC_POLICY_YIELD && src->yield > srcs[best].yield)
+      best = j;
 
   }
 
-#endif /* ^(__APPLE__ || __FreeBSD__ || __OpenBSD__) */
+  if (best >= 0) sync_rr_cur = best + 1;
 
-  return res;
+  return best;
 
 }
 
 
+/* Move a seed to deferred/. The sync dir may live on another file system
+   than the output, so fall back to a copy if rename() will not do. */
 
+static void defer_seed(u8* path) {
 
-/* Delete fuzzer output directory if we recognize it as ours, if the fuzzer
-   is not currently running, and if the last run time isn't too great. */
+  u8* fn = arena_printf(&seed_arena, "%s/id:%08u,task:%d", defer_src.qd_path,
+                        deferred_seq, filter_index);
 
-static void maybe_delete_out_dir(void) {
+  deferred_seq++;
 
-  FILE* f;
-  u8 *fn = alloc_printf("%s/fuzzer_stats", out_dir);
-  // u8* fn = alloc_printf("%s/fuzzer_stats", remote_out_dir);
+  if (rename(path, fn)) {
 
-  static s32 out_dir_fd;
+    struct stat st;
+    u8* mem;
+    s32 fd;
 
-  /* See if the output directory is locked. If yes, bail out. If not,
-     create a lock that will persist for the lifetime of the process
-     (this requires leaving the descriptor open).*/
+    if (errno != EXDEV) PFATAL("Unable to rename '%s'", path);
 
-  out_dir_fd = open(out_dir, O_RDONLY);
-  if (out_dir_fd < 0) PFATAL("Unable to open '%s'", out_dir);
+    fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st)) PFATAL("Unable to open '%s'", path);
 
-  if (flock(out_dir_fd, LOCK_EX | LOCK_NB) && errno == EWOULDBLOCK) {
+    mem = ck_alloc_nozero(st.st_size);
+    ck_read(fd, mem, st.st_size, path);
+    close(fd);
 
-    SAYF("\n" cLRD "[-] " cRST
-         "Looks like the job output directory is being actively used by another\n"
-         "    instance of afl-fuzz. You will need to choose a different %s\n"
-         "    or stop the other process first.\n",
-         sync_id ? "fuzzer ID" : "output location");
+    fd = open(fn, O_WRONLY | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) PFATAL("Unable to create '%s'", fn);
 
-    FATAL("Directory '%s' is in use", out_dir);
+    ck_write(fd, mem, st.st_size, fn);
+    close(fd);
+    ck_free(mem);
+
+    if (unlink(path)) PFATAL("Unable to delete '%s'", path);
 
   }
 
-  close(out_dir_fd); // j.h.
+  deferred_cnt++;
+  ovl_deferred++;
 
-  f = fopen(fn, "r");
+}
 
-  if (f) {
 
-    u64 start_time, last_update;
+/* Overload mode: decide whether the seed at path, just taken from src, is
+   run now. Above the backlog or latency threshold, the first ovl_keep seeds
+   of each task are always run. The others are sampled with odds following
+   the yield of their producer relative to the best one with a backlog,
+   scaled down by how far past the threshold we are (but never below
+   OVERLOAD_MIN_PERC); the ones not picked go to deferred/, or are dropped
+   once ovl_defer_max seeds wait there. Overload ends below half of both
+   thresholds. Returns 1 if the seed was shed. */
 
-    if (fscanf(f, "start_time     : %llu\n"
-                  "last_update    : %llu\n", &start_time, &last_update) != 2)
-      FATAL("Malformed data in '%s'", fn);
+static u8 sync_shed(struct sync_src* srcs, u32 cnt, struct sync_src* src,
+                    u8* path) {
 
-    fclose(f);
+  struct ovl_task* t = ovl_tasks + (u32)filter_index % OVERLOAD_TASKS;
+  double best = src->yield, load = 1;
+  struct stat st;
+  u32 i, perc;
 
-    /* Let's see how much work is at stake. */
+  if (t->task != filter_index) {
+    t->task = filter_index;
+    t->seen = 0;
+  }
 
-    if (!in_place_resume && last_update - start_time > OUTPUT_GRACE * 60) {
+  t->seen++;
 
-      SAYF("\n" cLRD "[-] " cRST
-           "The job output directory already exists and contains the results of more\n"
-           "    than %u minutes worth of fuzzing. To avoid data loss, afl-fuzz will *NOT*\n"
-           "    automatically delete this data for you.\n\n"
+  if (ovl_latency && !stat(path, &st)) {
 
-           "    If you wish to start a new session, remove or rename the directory manually,\n"
-           "    or specify a different output location for this job. To resume the old\n"
-           "    session, put '-' as the input directory in the command line ('-i -') and\n"
-           "    try again.\n", OUTPUT_GRACE);
+    u64 mtime = (u64)st.st_mtim.tv_sec * 1000 + st.st_mtim.tv_nsec / 1000000,
+        now   = get_cur_time();
 
-       FATAL("At-risk data found in in '%s'", out_dir);
+    sync_latency = now > mtime ? now - mtime : 0;
+
+  }
+
+  if (!overloaded) {
 
+    if ((ovl_backlog && sync_backlog >= ovl_backlog) ||
+        (ovl_latency && sync_latency >= ovl_latency)) {
+      overloaded = 1;
+      ovl_entered++;
     }
 
+  } else if ((!ovl_backlog || sync_backlog < ovl_backlog / 2) &&
+             (!ovl_latency || sync_latency < ovl_latency / 2)) {
+
+    overloaded = 0;
+
   }
 
-  ck_free(fn);
+  if (!overloaded || t->seen <= ovl_keep) return 0;
 
-  /* The idea for in-place resume is pretty simple: we temporarily move the old
-     queue/ to a new location that gets deleted once import to the new queue/
-     is finished. If _resume/ already exists, the current queue/ may be
-     incomplete due to an earlier abort, so we want to use the old _resume/
-     dir instead, and we let rename() fail silently. */
+  for (i = 0; i < cnt; i++)
+    if (srcs[i].names_pos < srcs[i].names_cnt && srcs[i].yield > best)
+      best = srcs[i].yield;
 
-  if (in_place_resume) {
+  if (ovl_backlog && sync_backlog > ovl_backlog)
+    load = MIN(load, (double)ovl_backlog / sync_backlog);
 
-    // u8* orig_q = alloc_printf("%s/queue", out_dir);
+  if (ovl_latency && sync_latency > ovl_latency)
+    load = MIN(load, (double)ovl_latency / sync_latency);
 
-    // in_dir = alloc_printf("%s/_resume", out_dir);
+  perc = (best > 0 ? src->yield / best : 1) * load * 100;
 
-    // rename(orig_q, in_dir); /* Ignore errors */
+  if (UR(100) < MAX(perc, OVERLOAD_MIN_PERC)) return 0;
 
-    // OKF("Output directory exists, will attempt session resume.");
+  if (deferred_cnt < ovl_defer_max) {
 
-    // ck_free(orig_q);
+    defer_seed(path);
 
   } else {
 
-    OKF("Output directory exists but deemed OK to reuse.");
+    if (unlink(path)) PFATAL("Unable to delete '%s'", path);
+    ovl_dropped++;
 
   }
 
-  ACTF("Deleting old session data...");
-
-  /* Okay, let's get the ball rolling! First, we need to get rid of the entries
-     in <out_dir>/.synced/.../id:*, if any are present. */
+  return 1;
 
-  fn = alloc_printf("%s/.synced", out_dir);
-  if (delete_files(fn, NULL)) goto dir_cleanup_failed;
-  ck_free(fn);
+}
 
-  /* Next, we need to clean up <out_dir>/queue/.state/ subdirectories: */
 
-  fn = alloc_printf("%s/queue/.state/deterministic_done", out_dir);
-  if (delete_files(fn, CASE_PREFIX)) goto dir_cleanup_failed;
-  ck_free(fn);
+/* Set up deferred/ and pick up where the last session left it. */
 
-  fn = alloc_printf("%s/queue/.state/auto_extras", out_dir);
-  if (delete_files(fn, "auto_")) goto dir_cleanup_failed;
-  ck_free(fn);
+static void setup_deferred(void) {
 
-  fn = alloc_printf("%s/queue/.state/redundant_edges", out_dir);
-  if (delete_files(fn, CASE_PREFIX)) goto dir_cleanup_failed;
-  ck_free(fn);
+  struct dirent* de;
+  u32 id;
+  DIR* d;
+  s32 fd;
 
-  fn = alloc_printf("%s/queue/.state/favored_edges", out_dir);
-  if(delete_files(fn, CASE_PREFIX)) goto dir_cleanup_failed;
-  ck_free(fn);
+  defer_src.qd_path     = alloc_printf("%s/deferred", out_dir);
+  defer_src.synced_path = alloc_printf("%s/.synced/deferred", out_dir);
+  defer_src.party       = "deferred";
+  defer_src.is_spool    = 1;
+  defer_src.task        = -1;
+  defer_src.id_fd       = -1;
+  defer_src.yield       = 1.0;
 
-  fn = alloc_printf("%s/queue/.state/variable_behavior", out_dir);
-  if (delete_files(fn, CASE_PREFIX)) goto dir_cleanup_failed;
-  ck_free(fn);
+  if (mkdir(defer_src.qd_path, 0700) && errno != EEXIST)
+    PFATAL("Unable to create '%s'", defer_src.qd_path);
 
-  /* Then, get rid of the .state subdirectory itself (should be empty by now)
-     and everything matching <out_dir>/queue/id:*. */
+  /* IDs must stay above the cursor, or new seeds would be taken for ones
+     that were already run. */
 
-  fn = alloc_printf("%s/queue/.state", out_dir);
-  if (rmdir(fn) && errno != ENOENT) goto dir_cleanup_failed;
-  ck_free(fn);
+  fd = open(defer_src.synced_path, O_RDONLY);
 
-  fn = alloc_printf("%s/queue", out_dir);
-  // if (delete_files(fn, CASE_PREFIX)) goto dir_cleanup_failed;
-  if (delete_files(fn, CASE_PREFIX) && delete_files(fn, "blocks,id:")) 
-  {
-    // erro_n = 1;
-    goto dir_cleanup_failed;
+  if (fd >= 0) {
+    if (read(fd, &id, sizeof(u32)) == sizeof(u32)) deferred_seq = id;
+    close(fd);
   }
-  ck_free(fn);
 
+  d = opendir(defer_src.qd_path);
+  if (!d) PFATAL("Unable to open '%s'", defer_src.qd_path);
 
+  while ((de = readdir(d))) {
 
-  /* All right, let's do <out_dir>/crashes/id:* and <out_dir>/hangs/id:*. */
+    if (sscanf(de->d_name, CASE_PREFIX "%08u", &id) != 1) continue;
 
-  fn = alloc_printf("%s/crashes/README.txt", out_dir);
-  unlink(fn); /* Ignore errors */
-  ck_free(fn);
+    deferred_cnt++;
+    if (id >= deferred_seq) deferred_seq = id + 1;
 
-  fn = alloc_printf("%s/crashes", out_dir);
+  }
 
-  /* Make backup of the crashes directory if it's not empty and if we're
-     doing in-place resume. */
+  closedir(d);
 
-  if (in_place_resume && rmdir(fn)) {
+}
 
-    time_t cur_t = time(0);
-    struct tm* t = localtime(&cur_t);
 
-    u8* nfn = alloc_printf("%s.%04u-%02u-%02u-%02u:%02u:%02u", fn,
-                           t->tm_year + 1900, t->tm_mon + 1, t->tm_mday,
-                           t->tm_hour, t->tm_min, t->tm_sec);
+/* Open and map a synced seed. Zero-sized and oversized files are just
+   removed, and NULL is returned for them. */
 
-    rename(fn, nfn); /* Ignore errors. */
-    ck_free(nfn);
+static u8* sync_load(u8* path, u32* len) {
 
-  }
+  struct stat st;
+  u8* mem;
+  s32 fd;
 
-  // if (delete_files(fn, CASE_PREFIX)) goto dir_cleanup_failed;
-  if (delete_files(fn, CASE_PREFIX) && delete_files(fn, "blocks,id:")) 
-  {
-    // erro_n = 1;
-    goto dir_cleanup_failed;
+  fd = open(path, O_RDONLY);
+  if (fd < 0) PFATAL("Unable to open '%s'", path);
+
+  if (fstat(fd, &st)) PFATAL("fstat() failed");
+
+  if (!st.st_size || st.st_size > MAX_FILE) {
+    unlink(path);
+    close(fd);
+    return NULL;
   }
-  ck_free(fn);
 
-  fn = alloc_printf("%s/hangs", out_dir);
+  sync_count++;
 
-  /* Backup hangs, too. */
+  mem = mmap(0, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
 
-  if (in_place_resume && rmdir(fn)) {
+  if (mem == MAP_FAILED) PFATAL("Unable to mmap '%s'", path);
 
-    time_t cur_t = time(0);
-    struct tm* t = localtime(&cur_t);
+  close(fd);
 
-    u8* nfn = alloc_printf("%s.%04u-%02u-%02u-%02u:%02u:%02u", fn,
-                           t->tm_year + 1900, t->tm_mon + 1, t->tm_mday,
-                           t->tm_hour, t->tm_min, t->tm_sec);
+  *len = st.st_size;
+  return mem;
 
-    rename(fn, nfn); /* Ignore errors. */
-    ck_free(nfn);
+}
 
-  }
 
-  if (delete_files(fn, CASE_PREFIX)) goto dir_cleanup_failed;
-  ck_free(fn);
+/* Fold the outcome of a synced seed, run with timeout tmout, into the queue
+   and the yield of its producer. We rely on save_if_interesting() to catch
+   major errors and save the test case. Returns 0 if we are stopping. */
 
-  /* And now, for some finishing touches. */
+static u8 sync_commit(char** argv, struct sync_src* src, u8* mem, u32 len,
+                      u8 fault, u32 sig, u32 tmout) {
 
-  fn = alloc_printf("%s/.cur_input", out_dir);
-  if (unlink(fn) && errno != ENOENT) goto dir_cleanup_failed;
-  ck_free(fn);
+  u64 prev_kept = queued_paths + unique_crashes + unique_hangs;
 
-  fn = alloc_printf("%s/.cur_code_block_info", out_dir);
-  if (unlink(fn) && errno != ENOENT) goto dir_cleanup_failed;
-  ck_free(fn);
+  sync_tmout_note(src, sig, tmout, fault);
 
-  fn = alloc_printf("%s/fuzz_bitmap", out_dir);
-  if (unlink(fn) && errno != ENOENT) goto dir_cleanup_failed;
-  ck_free(fn);
+  if (stop_soon) return 0;
 
-  if (!in_place_resume) {
-    fn  = alloc_printf("%s/fuzzer_stats", out_dir);
-    if (unlink(fn) && errno != ENOENT) goto dir_cleanup_failed;
-    ck_free(fn);
-  }
+  syncing_party = src->party;
 
-  fn = alloc_printf("%s/plot_data", out_dir);
-  if (unlink(fn) && errno != ENOENT) goto dir_cleanup_failed;
-  ck_free(fn);
+  queued_imported += save_if_interesting(argv, mem, len, fault);
+  syncing_party = 0;
 
-  OKF("Output dir cleanup successful.");
+  src->yield = src->yield * (1.0 - SYNC_YIELD_ALPHA) + SYNC_YIELD_ALPHA *
+               (queued_paths + unique_crashes + unique_hangs != prev_kept);
 
-  /* Wow... is that all? If yes, celebrate! */
+  return 1;
 
-  return;
+}
 
-dir_cleanup_failed:
 
-  SAYF("\n" cLRD "[-] " cRST
-       "Whoops, the fuzzer tried to reuse your output directory, but bumped into\n"
-       "    some files that shouldn't be there or that couldn't be removed - so it\n"
-       "    decided to abort! This happened while processing this path:\n\n"
+/* Execute a single seed from a producer and feed it to save_if_interesting().
+   The seed is removed once it has been looked at. */
 
-       "    %s\n\n"
-       "    Please examine and manually delete the files, or specify a different\n"
-       "    output location for the tool.\n", fn);
+static void sync_run(char** argv, struct sync_src* src, u8* path) {
 
-  FATAL("Output directory cleanup failed");
+  u32 old_tmout = exec_tmout, tmout, sig, len;
+  u8  fault, skip;
+  u8* mem = sync_load(path, &len);
 
-}
+  if (!mem) return;
 
+  job_get();
 
-/* A spiffy retro stats screen! This is called every stats_update_freq
-   execve() calls, plus in several other circumstances. */
+  /* With a native prefilter, only seeds that look new on the native build
+     get the (much slower) QEMU run. */
 
-static void show_stats(void) {
+  skip = prefilter.fsrv_pid && !prefilter_pass(mem, len);
 
-  static u64 last_stats_ms, last_plot_ms, last_ms, last_execs;
-  static double avg_exec;
-  double t_byte_ratio;
+  if (stop_soon) return;
 
-  u64 cur_ms;
-  u32 t_bytes, t_bits;
+  if (skip) {
 
-  u32 banner_len, banner_pad;
-  u8  tmp[256];
+    src->yield *= 1.0 - SYNC_YIELD_ALPHA;
 
-  cur_ms = get_cur_time();
+  } else {
 
-  /* If not enough time has passed since last UI update, bail out. */
+    sig   = hang_sig(mem, len);
+    tmout = exec_tmout = sync_tmout(src, sig);
 
-  if (cur_ms - last_ms < 1000 / UI_TARGET_HZ) return;
+    write_to_testcase(mem, len);
+    fault = run_target(argv, 1); //
 
-  /* Check if we're past the 10 minute mark. */
+    exec_tmout = old_tmout;
 
-  if (cur_ms - start_time > 10 * 60 * 1000) run_over10m = 1;
+    if (!sync_commit(argv, src, mem, len, fault, sig, tmout)) return;
 
-  /* Calculate smoothed exec speed stats. */
+  }
 
-  if (!last_execs) {
-  
-    avg_exec = ((double)total_execs) * 1000 / (cur_ms - start_time);
+  munmap(mem, len);
 
-  } else {
+  if (!(stage_cur++ % stats_update_freq)) show_stats();
 
-    double cur_avg = ((double)(total_execs - last_execs)) * 1000 /
-                     (cur_ms - last_ms);
+  unlink(path);
 
-    /* If there is a dramatic (5x+) jump in speed, reset the indicator
-       more quickly. */
+}
 
-    if (cur_avg * 5 < avg_exec || cur_avg / 5 > avg_exec)
-      avg_exec = cur_avg;
 
-    avg_exec = avg_exec * (1.0 - 1.0 / AVG_SMOOTHING) +
-               cur_avg * (1.0 / AVG_SMOOTHING);
+/* With an autoscaled pool, synced seeds are launched on the executors in
+   use one batch at a time, and then committed in the order they were
+   picked, so the outcome is the same as running them one by one. */
 
-  }
+struct sync_job {
 
-  last_ms = cur_ms;
-  last_execs = total_execs;
+  struct sync_src* src;               /* Producer of the seed             */
+  u8* path;                           /* Seed file (in seed_arena)        */
+  u8* mem;                            /* ...mapped                        */
+  u32 len,                            /* ...its length                    */
+      sig,                            /* Hang signature                   */
+      tmout,                          /* Timeout it was launched with     */
+      case_id;                        /* syncing_case for it              */
+  s32 task;                           /* filter_index for it              */
 
-  /* Tell the callers when to contact us (as measured in execs). */
+};
 
-  stats_update_freq = avg_exec / (UI_TARGET_HZ * 10);
-  if (!stats_update_freq) stats_update_freq = 1;
+static struct sync_job* sync_jobs;    /* One per executor in use          */
+static u32 sync_jobs_cnt;             /* Launched, not yet committed      */
 
-  /* Do some bitmap stats. */
 
-  t_bytes = count_non_255_bytes(virgin_bits);
-  t_byte_ratio = ((double)t_bytes * 100) / MAP_SIZE;
+/* Start a seed on the next free executor of the batch. */
 
-  /* Roughly every minute, update fuzzer stats and save auto tokens. */
+static void sync_launch(struct sync_src* src, u8* path) {
 
-  if (cur_ms - last_stats_ms > STATS_UPDATE_SEC * 1000) {
+  struct sync_job* j;
+  u32 old_tmout = exec_tmout, len;
+  u8* mem = sync_load(path, &len);
 
-    last_stats_ms = cur_ms;
-    write_stats_file(t_byte_ratio, avg_exec);
+  if (!mem) return;
 
-    write_bitmap();
+  job_get();
 
-  }
+  if (prefilter.fsrv_pid && !prefilter_pass(mem, len)) {
 
-  /* Every now and then, write plot data. */
+    munmap(mem, len);
+    if (stop_soon) return;
 
-  if (cur_ms - last_plot_ms > PLOT_UPDATE_SEC * 1000) {
+    src->yield *= 1.0 - SYNC_YIELD_ALPHA;
+    unlink(path);
+    return;
 
-    last_plot_ms = cur_ms;
-    maybe_update_plot_file(t_byte_ratio, avg_exec);
- 
   }
 
-  /* If we're not on TTY, bail out. */
-
-  if (not_on_tty) return;
+  if (stop_soon) return;
 
-  /* Compute some mildly useful bitmap stats. */
+  j = sync_jobs + sync_jobs_cnt;
 
-  t_bits = (MAP_SIZE << 3) - count_bits(virgin_bits);
+  j->src     = src;
+  j->path    = path;
+  j->mem     = mem;
+  j->len     = len;
+  j->task    = filter_index;
+  j->case_id = syncing_case;
+  j->sig     = hang_sig(mem, len);
+  j->tmout   = exec_tmout = sync_tmout(src, j->sig);
 
-  /* Now, for the visuals... */
+  exec_launch(exec_pool + sync_jobs_cnt, mem, len);
 
-  if (clear_screen) {
+  exec_tmout = old_tmout;
+  sync_jobs_cnt++;
 
-    SAYF(TERM_CLEAR CURSOR_HIDE);
-    clear_screen = 0;
+}
 
-  }
 
-  SAYF(TERM_HOME);
+/* Wait for the batch and commit it. Seeds not committed when we are asked
+   to stop stay where they are for the next run. */
 
-  /* Let's start by drawing a centered banner. */
+static void sync_reap(char** argv) {
 
-  banner_len = (crash_mode ? 24 : 22) + strlen(VERSION) + strlen(use_banner);
-  banner_pad = (80 - banner_len) / 2;
-  memset(tmp, ' ', banner_pad);
+  u32 i;
 
-  sprintf(tmp + banner_pad, "%s " cLCY VERSION cLGN
-          " (%s)",  crash_mode ? cPIN "peruvian were-rabbit" : 
-          cYEL "american fuzzy lop", use_banner);
+  for (i = 0; i < sync_jobs_cnt && !stop_soon; i++) {
 
-  SAYF("\n%s\n\n", tmp);
+    struct sync_job* j = sync_jobs + i;
+    struct executor* e = exec_pool + i;
+    u8 fault;
 
-  /* "Handy" shortcuts for drawing boxes... */
+    exec_wait(e);
+    if (stop_soon) break;
 
-#define bSTG    bSTART cGRA
-#define bH2     bH bH
-#define bH5     bH2 bH2 bH
-#define bH10    bH5 bH5
-#define bH20    bH10 bH10
-#define bH30    bH20 bH10
-#define SP5     "     "
-#define SP10    SP5 SP5
-#define SP20    SP10 SP10
+    memcpy(trace_bits, e->trace_bits, MAP_SIZE + 8);
+    memcpy(trace_bits + CRASH_REC_OFF, e->trace_bits + CRASH_REC_OFF, 16);
 
-  /* Lord, forgive me this. */
+    last_exec_us   = e->exec_us;
+    total_exec_us += e->exec_us;
 
-  SAYF(SET_G1 bSTG bLT bH bSTOP cCYA " process timing " bSTG bH30 bH5 bH2 bHB
-       bH bSTOP cCYA " overall results " bSTG bH5 bRT "\n");
+    rareness = get_rare(trace_bits);
 
-  if (dumb_mode) {
+#ifdef __x86_64__
+    classify_counts((u64*)trace_bits);
+#else
+    classify_counts((u32*)trace_bits);
+#endif /* ^__x86_64__ */
 
-    strcpy(tmp, cNOR);
+    fault = exec_fault(e);
 
-  } else {
+    filter_index = j->task;
+    syncing_case = j->case_id;
 
-    /* First queue cycle: don't stop now! */
-    if (queue_cycle == 1) strcpy(tmp, cMGN); else
+    if (!sync_commit(argv, j->src, j->mem, j->len, fault, j->sig, j->tmout))
+      break;
 
-    /* Subsequent cycles, but we're still making finds. */
-    if (cycles_wo_finds < 3) strcpy(tmp, cYEL); else
+    munmap(j->mem, j->len);
 
-    /* No finds for a long time and no test cases to try. */
-    if (cycles_wo_finds > 20 && !pending_not_fuzzed) strcpy(tmp, cLGN);
+    if (!(stage_cur++ % stats_update_freq)) show_stats();
 
-    /* Default: cautiously OK to stop? */
-    else strcpy(tmp, cLBL);
+    unlink(j->path);
 
   }
 
-  SAYF(bV bSTOP "        run time : " cNOR "%-34s " bSTG bV bSTOP
-       "  cycles done : %s%-5s  " bSTG bV "\n",
-       DTD(cur_ms, start_time), tmp, DI(queue_cycle - 1));
-
-  /* We want to warn people about not seeing new paths after a full cycle,
-     except when resuming fuzzing or running in non-instrumented mode. */
-
-  if (!dumb_mode && (last_path_time || resuming_fuzz || queue_cycle == 1 ||
-      in_bitmap || crash_mode)) {
+  sync_jobs_cnt = 0;
+  arena_reset(&seed_arena);
 
-    SAYF(bV bSTOP "   last new path : " cNOR "%-34s ",
-         DTD(cur_ms, last_path_time));
+}
 
-  } else {
 
-    if (dumb_mode)
+/* Resize the pool used for synced seeds, at most once every POOL_SCALE_MS.
+   Enough executors are taken into use to keep the backlog at or below
+   POOL_SEEDS_PER_EXEC seeds each, but only as many as there are cores left
+   after pool_reserve and everything else that is runnable; when the backlog
+   is gone or the box gets busier, the pool shrinks again one at a time. */
 
-      SAYF(bV bSTOP "   last new path : " cPIN "n/a" cNOR 
-           " (non-instrumented mode)        ");
+static void pool_scale(char** argv) {
 
-     else
+  static u64 last_ms;
 
-      SAYF(bV bSTOP "   last new path : " cNOR "none yet " cLRD
-           "(odd, check syntax!)      ");
+  u64 cur_ms = get_cur_time();
+  s32 others, room, want;
 
-  }
+  if (cur_ms - last_ms < POOL_SCALE_MS) return;
+  last_ms = cur_ms;
 
-  SAYF(bSTG bV bSTOP "  total paths : " cNOR "%-5s  " bSTG bV "\n",
-       DI(queued_paths));
+#ifdef __linux__
+  sample_core_idle();
+#endif /* __linux__ */
 
-  /* Highlight crashes in red if found, denote going over the KEEP_UNIQUE_CRASH
-     limit with a '+' appended to the count. */
+  /* The runnable count includes us, and our executors while there was a
+     backlog to keep them busy. */
 
-  sprintf(tmp, "%s%s", DI(unique_crashes),
-          (unique_crashes >= KEEP_UNIQUE_CRASH) ? "+" : "");
+  others = get_runnable_processes() + 0.5;
+  others -= 1 + (sync_backlog ? exec_pool_size : 0);
 
-  SAYF(bV bSTOP " last uniq crash : " cNOR "%-34s " bSTG bV bSTOP
-       " uniq crashes : %s%-6s " bSTG bV "\n",
-       DTD(cur_ms, last_crash_time), unique_crashes ? cLRD : cNOR,
-       tmp);
+  room = (s32)cpu_core_count - (s32)pool_reserve - MAX(others, 0);
 
-  sprintf(tmp, "%s%s", DI(unique_hangs),
-         (unique_hangs >= KEEP_UNIQUE_HANG) ? "+" : "");
+  want = (sync_backlog + POOL_SEEDS_PER_EXEC - 1) / POOL_SEEDS_PER_EXEC;
 
-  SAYF(bV bSTOP "  last uniq hang : " cNOR "%-34s " bSTG bV bSTOP 
-       "   uniq hangs : " cNOR "%-6s " bSTG bV "\n",
-       DTD(cur_ms, last_hang_time), tmp);
+  if (want < (s32)exec_pool_size) want = exec_pool_size - 1;
 
-  SAYF(bVR bH bSTOP cCYA " cycle progress " bSTG bH20 bHB bH bSTOP cCYA
-       " map coverage " bSTG bH bHT bH20 bH2 bH bVL "\n");
+  if (want > room)
+    want = room < (s32)exec_pool_size ? (s32)exec_pool_size - 1 : room;
 
-  /* This gets funny becuse we want to print several variable-length variables
-     together, but then cram them into a fixed-width field - so we need to
-     put them in a temporary buffer first. */
+  if (want < (s32)pool_min) want = pool_min;
+  if (want > (s32)pool_max) want = pool_max;
 
-  // sprintf(tmp, "%s%s (%0.02f%%)", DI(current_entry),
-  //         queue_cur->favored ? "" : "*",
-  //         ((double)current_entry * 100) / queued_paths);
-  sprintf(tmp, "%s%s%d (%0.02f%%)", DI(current_entry),
-        queue_cur && !queue_cur->favored ? "*" : ".",
-        queue_cur?queue_cur->fuzz_level:-1,
-        ((double)current_entry * 100) / queued_paths);
+  if (want == exec_pool_size) return;
 
+  pool_resizes++;
+  init_exec_pool(argv, want);
 
-  SAYF(bV bSTOP "  now processing : " cNOR "%-17s " bSTG bV bSTOP, tmp);
+  /* Starting fork servers prints to the terminal. */
 
+  clear_screen = 1;
 
-  sprintf(tmp, "%s (%0.02f%%)", DI(t_bytes), t_byte_ratio);
+}
 
-  SAYF("    map density : %s%-21s " bSTG bV "\n", t_byte_ratio > 70 ? cLRD : 
-       ((t_bytes < 200 && !dumb_mode) ? cPIN : cNOR), tmp);
 
-  sprintf(tmp, "%s (%0.02f%%)", DI(cur_skipped_paths),
-          ((double)cur_skipped_paths * 100) / queued_paths);
+/* Write back the cursor of a producer and release its backlog. For spool
+   slots, a pass that started with the .done marker present has drained the
+   slot, so we reset its cursor and remove the marker (and the task score)
+   to hand the slot back for the next task. */
 
-  SAYF(bV bSTOP " paths timed out : " cNOR "%-17s " bSTG bV, tmp);
+static void sync_finish(struct sync_src* src) {
 
-  sprintf(tmp, "%0.02f bits/tuple",
-          t_bytes ? (((double)t_bits) / t_bytes) : 0);
+  u8* fn;
 
-  SAYF(bSTOP " count coverage : " cNOR "%-21s " bSTG bV "\n", tmp);
+  if (src->id_fd < 0) return;
 
-  SAYF(bVR bH bSTOP cCYA " stage progress " bSTG bH20 bX bH bSTOP cCYA
-       " findings in depth " bSTG bH20 bVL "\n");
+  src->names     = NULL;
+  src->names_cnt = 0;
 
-  sprintf(tmp, "%s (%0.02f%%)", DI(queued_favored),
-          ((double)queued_favored) * 100 / queued_paths);
+  ck_write(src->id_fd, &src->next_min_accept, sizeof(u32), src->synced_path);
+  close(src->id_fd);
+  src->id_fd = -1;
 
-  /* Yeah... it's still going on... halp? */
+  if (src->drained) {
 
-  SAYF(bV bSTOP "  now trying : " cNOR "%-21s " bSTG bV bSTOP 
-       " favored paths : " cNOR "%-22s " bSTG bV "\n", stage_name, tmp);
+    if (unlink(src->synced_path) && errno != ENOENT)
+      PFATAL("Unable to delete '%s'", src->synced_path);
 
-  if (!stage_max) {
+    fn = arena_printf(&sync_arena, "%s/.score", src->qd_path);
 
-    sprintf(tmp, "%s/-", DI(stage_cur));
+    if (unlink(fn) && errno != ENOENT) PFATAL("Unable to delete '%s'", fn);
 
-  } else {
+    if (unlink(src->done_path)) PFATAL("Unable to delete '%s'", src->done_path);
 
-    sprintf(tmp, "%s/%s (%0.02f%%)", DI(stage_cur), DI(stage_max),
-            ((double)stage_cur) * 100 / stage_max);
+    src->drained = 0;
+    spool_drained++;
 
   }
 
-  SAYF(bV bSTOP " stage execs : " cNOR "%-21s " bSTG bV bSTOP, tmp);
+}
 
-  sprintf(tmp, "%s (%0.02f%%)", DI(queued_with_cov),
-          ((double)queued_with_cov) * 100 / queued_paths);
 
-  SAYF("  new edges on : " cNOR "%-22s " bSTG bV "\n", tmp);
+/* Once the load is back to normal, rerun up to OVERLOAD_DRAIN deferred
+   seeds per sync pass, oldest first. */
 
-  sprintf(tmp, "%s (%s%s unique)", DI(total_crashes), DI(unique_crashes),
-          (unique_crashes >= KEEP_UNIQUE_CRASH) ? "+" : "");
+static void sync_deferred(char** argv) {
 
-  if (crash_mode) {
+  u32 done = 0;
+  u8* path;
 
-    SAYF(bV bSTOP " total execs : " cNOR "%-21s " bSTG bV bSTOP
-         "   new crashes : %s%-22s " bSTG bV "\n", DI(total_execs),
-         unique_crashes ? cLRD : cNOR, tmp);
+  sync_scan(&defer_src);
+  deferred_cnt = defer_src.names_cnt;
 
-  } else {
+  while (done++ < OVERLOAD_DRAIN && (path = sync_next(&defer_src))) {
 
-    SAYF(bV bSTOP " total execs : " cNOR "%-21s " bSTG bV bSTOP
-         " total crashes : %s%-22s " bSTG bV "\n", DI(total_execs),
-         unique_crashes ? cLRD : cNOR, tmp);
+    sync_run(argv, &defer_src, path);
+    arena_reset(&seed_arena);
 
-  }
+    if (stop_soon) return;
 
-  /* Show a warning about slow execution. */
+    deferred_cnt--;
+    job_yield();
 
-  if (avg_exec < 100) {
+  }
 
-    sprintf(tmp, "%s/sec (%s)", DF(avg_exec), avg_exec < 20 ?
-            "zzzz..." : "slow!");
+  sync_finish(&defer_src);
 
-    SAYF(bV bSTOP "  exec speed : " cLRD "%-21s ", tmp);
+}
 
-  } else {
 
-    sprintf(tmp, "%s/sec", DF(avg_exec));
-    SAYF(bV bSTOP "  exec speed : " cNOR "%-21s ", tmp);
+/* Go through the backlogs of all producers, interleaving them according to
+   the configured policy, so that seeds from a valuable task do not have to
+   wait behind a long backlog from a poor one. */
 
-  }
+static void sync_sources(char** argv, struct sync_src* srcs, u32 cnt) {
 
-  sprintf(tmp, "%s (%s%s unique)", DI(total_hangs), DI(unique_hangs),
-          (unique_hangs >= KEEP_UNIQUE_HANG) ? "+" : "");
+  static u8 stage_tmp[32];
+  u32 i;
+  s32 cur;
 
-  SAYF (bSTG bV bSTOP "   total hangs : " cNOR "%-22s " bSTG bV "\n", tmp);
+  sync_backlog = 0;
 
-  /* Aaaalmost there... hold on! */
+  for (i = 0; i < cnt; i++) sync_scan(srcs + i);
 
-  SAYF(bVR bH cCYA bSTOP " fuzzing strategy yields " bSTG bH10 bH bHT bH10
-       bH5 bHB bH bSTOP cCYA " path geometry " bSTG bH5 bH2 bH bVL "\n");
+  write_backpressure();
 
-  if (skip_deterministic) {
+  if (pool_max) pool_scale(argv);
 
-    strcpy(tmp, "n/a, n/a, n/a");
+  sprintf(stage_tmp, "sync(%s)", sync_policy_names[sync_policy]);
+  stage_name = stage_tmp;
+  stage_cur  = 0;
+  stage_max  = 0;
 
-  } else {
+  while ((cur = sync_pick(srcs, cnt)) >= 0) {
 
-    sprintf(tmp, "%s/%s, %s/%s, %s/%s",
-            DI(stage_finds[STAGE_FLIP1]), DI(stage_cycles[STAGE_FLIP1]),
-            DI(stage_finds[STAGE_FLIP4]), DI(stage_cycles[STAGE_FLIP2]),
-            DI(stage_finds[STAGE_FLIP4]), DI(stage_cycles[STAGE_FLIP4]));
+    u8* path = sync_next(srcs + cur);
 
-  }
+    if (!path) continue;
 
-  SAYF(bV bSTOP "   bit flips : " cNOR "%-37s " bSTG bV bSTOP "    levels : "
-       cNOR "%-10s " bSTG bV "\n", tmp, DI(max_depth));
+    if ((ovl_backlog || ovl_latency) && sync_shed(srcs, cnt, srcs + cur, path))
+      continue;
 
-  if (!skip_deterministic)
-    sprintf(tmp, "%s/%s, %s/%s, %s/%s",
-            DI(stage_finds[STAGE_FLIP8]), DI(stage_cycles[STAGE_FLIP8]),
-            DI(stage_finds[STAGE_FLIP16]), DI(stage_cycles[STAGE_FLIP16]),
-            DI(stage_finds[STAGE_FLIP32]), DI(stage_cycles[STAGE_FLIP32]));
+    if (pool_max) {
 
-  SAYF(bV bSTOP "  byte flips : " cNOR "%-37s " bSTG bV bSTOP "   pending : "
-       cNOR "%-10s " bSTG bV "\n", tmp, DI(pending_not_fuzzed));
+      sync_launch(srcs + cur, path);
+      if (sync_jobs_cnt == exec_pool_size) sync_reap(argv);
 
-  if (!skip_deterministic)
-    sprintf(tmp, "%s/%s, %s/%s, %s/%s",
-            DI(stage_finds[STAGE_ARITH8]), DI(stage_cycles[STAGE_ARITH8]),
-            DI(stage_finds[STAGE_ARITH16]), DI(stage_cycles[STAGE_ARITH16]),
-            DI(stage_finds[STAGE_ARITH32]), DI(stage_cycles[STAGE_ARITH32]));
+    } else {
 
-  SAYF(bV bSTOP " arithmetics : " cNOR "%-37s " bSTG bV bSTOP "  pend fav : "
-       cNOR "%-10s " bSTG bV "\n", tmp, DI(pending_favored));
+      sync_run(argv, srcs + cur, path);
+      arena_reset(&seed_arena);
 
-  if (!skip_deterministic)
-    sprintf(tmp, "%s/%s, %s/%s, %s/%s",
-            DI(stage_finds[STAGE_INTEREST8]), DI(stage_cycles[STAGE_INTEREST8]),
-            DI(stage_finds[STAGE_INTEREST16]), DI(stage_cycles[STAGE_INTEREST16]),
-            DI(stage_finds[STAGE_INTEREST32]), DI(stage_cycles[STAGE_INTEREST32]));
+    }
 
-  SAYF(bV bSTOP "  known ints : " cNOR "%-37s " bSTG bV bSTOP " own finds : "
-       cNOR "%-10s " bSTG bV "\n", tmp, DI(queued_discovered));
+    if (stop_soon) return;
 
-  if (!skip_deterministic)
-    sprintf(tmp, "%s/%s, %s/%s, %s/%s",
-            DI(stage_finds[STAGE_EXTRAS_UO]), DI(stage_cycles[STAGE_EXTRAS_UO]),
-            DI(stage_finds[STAGE_EXTRAS_UI]), DI(stage_cycles[STAGE_EXTRAS_UI]),
-            DI(stage_finds[STAGE_EXTRAS_AO]), DI(stage_cycles[STAGE_EXTRAS_AO]));
+    if (!sync_jobs_cnt) job_yield();
 
-  u8 _tmp[256];
-  memset(_tmp, ' ', banner_pad);
-  if(sync_id)
-    sprintf(_tmp, "%s|%s[%s]", DI(queued_imported), DI(sync_count), DI(sync_times));
-  else
-    sprintf(_tmp, "%s", (u8*)"n/a");
+    write_backpressure();
+    maybe_checkpoint(0);
 
-  // SAYF(bV bSTOP "  dictionary : " cNOR "%-37s " bSTG bV bSTOP
-  //      "  imported : " cNOR "%-10s " bSTG bV "\n", tmp,
-  //      sync_id ? DI(queued_imported) : (u8*)"n/a");
-  SAYF(bV bSTOP "  dictionary : " cNOR "%-37s " bSTG bV bSTOP
-       "  imported : " cNOR "%-10s " bSTG bV "\n", tmp, _tmp);
-  
-  sprintf(tmp, "%s/%s, %s/%s",
-          DI(stage_finds[STAGE_HAVOC]), DI(stage_cycles[STAGE_HAVOC]),
-          DI(stage_finds[STAGE_SPLICE]), DI(stage_cycles[STAGE_SPLICE]));
+  }
 
-  SAYF(bV bSTOP "       havoc : " cNOR "%-37s " bSTG bV bSTOP 
-       "  variable : %s%-10s " bSTG bV "\n", tmp, queued_variable ? cLRD : cNOR,
-      no_var_check ? (u8*)"n/a" : DI(queued_variable));
+  if (sync_jobs_cnt) sync_reap(argv);
+  if (stop_soon) return;
 
-  if (!bytes_trim_out) {
+  for (i = 0; i < cnt; i++) sync_finish(srcs + i);
 
-    sprintf(tmp, "n/a, ");
+  if (deferred_cnt && !overloaded) sync_deferred(argv);
 
-  } else {
+  write_backpressure();
 
-    sprintf(tmp, "%0.02f%%/%s, ",
-            ((double)(bytes_trim_in - bytes_trim_out)) * 100 / bytes_trim_in,
-            DI(trim_execs));
+}
 
-  }
 
-  if (!blocks_eff_total) {
+/* Grab test cases from the fixed set of producer slots in <sync_dir>/spool/.
+   The scheduler renames finished seeds into a free slot and then drops a
+   .done marker there; see sync_finish() for how slots are handed back. */
 
-    u8 tmp2[128];
+static void sync_spool(char** argv) {
 
-    sprintf(tmp2, "n/a");
-    strcat(tmp, tmp2);
+  u32 k;
 
-  } else {
+  if (!spool_srcs[0].qd_path) {
 
-    u8 tmp2[128];
+    for (k = 0; k < SPOOL_SLOTS; k++) {
 
-    sprintf(tmp2, "%0.02f%%",
-            ((double)(blocks_eff_total - blocks_eff_select)) * 100 /
-            blocks_eff_total);
+      struct sync_src* src = spool_srcs + k;
 
-    strcat(tmp, tmp2);
+      src->qd_path     = alloc_printf("%s/spool/slot-%u", sync_dir, k);
+      src->synced_path = alloc_printf("%s/.synced/slot-%u", out_dir, k);
+      src->done_path   = alloc_printf("%s/.done", src->qd_path);
+      src->party       = alloc_printf("slot-%u", k);
+      src->is_spool    = 1;
+      src->task        = -1;
+      src->id_fd       = -1;
+
+    }
 
   }
 
-  SAYF(bV bSTOP "        trim : " cNOR "%-37s " bSTG bVR bH20 bH2 bH2 bRB "\n"
-       bLB bH30 bH20 bH2 bH bRB bSTOP cRST RESET_G1, tmp);
+  sync_sources(argv, spool_srcs, SPOOL_SLOTS);
 
-  /* Provide some CPU utilization stats. */
+}
 
-  if (cpu_core_count) {
 
-    double cur_runnable = get_runnable_processes();
-    u32 cur_utilization = cur_runnable * 100 / cpu_core_count;
+/* Grab interesting test cases from other fuzzers. */
 
-    u8* cpu_color = cCYA;
+static void sync_fuzzers(char** argv) {
 
-    /* If we could still run one or more processes, use green. */
+  static u8* spool_path;
 
-    if (cpu_core_count > 1 && cur_runnable + 1 <= cpu_core_count)
-      cpu_color = cLGN;
+  DIR* sd;
+  struct dirent* sd_ent;
 
-    /* If we're clearly oversubscribed, use red. */
+  sync_times++;
 
-    if (!no_cpu_meter_red && cur_utilization >= 150) cpu_color = cLRD;
+  stage_max = stage_cur = 0;
+  cur_depth = 0;
 
-    SAYF(SP10 cGRA "   [cpu:%s%3u%%" cGRA "]\r" cRST,
-         cpu_color, cur_utilization < 999 ? cur_utilization : 999);
+  arena_reset(&sync_arena);
 
-  } else SAYF("\r");
+  /* Prefer the producer spool when the scheduler has set one up. */
 
-  /* Hallelujah! */
+  if (!spool_path) spool_path = alloc_printf("%s/spool", sync_dir);
 
-  fflush(0);
+  if (!access(spool_path, F_OK)) {
+    sync_spool(argv);
+    return;
+  }
 
-}
+  sd = opendir(sync_dir);
+  if (!sd) PFATAL("Unable to open '%s'", sync_dir);
 
+  /* Look at the entries created for every other fuzzer in the sync directory.
+     Producers stay in fuzz_srcs for the whole run, so that their yield and
+     exec time stats carry over from one pass to the next; one that has gone
+     away just has nothing to scan. */
 
-static void show_stats__()
-{
-  return;
-}
+  while ((sd_ent = readdir(sd))) {
 
+    struct sync_src* src;
+    u32 i;
 
-/* Display quick statistics at the end of processing the input directory,
-   plus a bunch of warnings. Some calibration stuff also ended up here,
-   along with several hardcoded constants. Maybe clean up eventually. */
+    /* Skip dot files and our own output directory, and not fuzz dir. */
 
-static void show_init_stats(void) {
+    if (sd_ent->d_name[0] == '.' || !strcmp(sync_id, sd_ent->d_name) || !startswith(sd_ent->d_name, "kirenenko")) continue;
 
-  struct queue_entry* q = queue;
-  u32 min_bits = 0, max_bits = 0;
-  u64 min_us = 0, max_us = 0;
-  u64 avg_us = 0;
-  u32 max_len = 0;
+    for (i = 0; i < fuzz_srcs_cnt; i++)
+      if (!strcmp((char*)fuzz_srcs[i].party, sd_ent->d_name)) break;
 
-  if (total_cal_cycles) avg_us = total_cal_us / total_cal_cycles;
+    if (i < fuzz_srcs_cnt) continue;
 
-  while (q) {
+    fuzz_srcs = ck_realloc(fuzz_srcs, (fuzz_srcs_cnt + 1) *
+                           sizeof(struct sync_src));
+    src = fuzz_srcs + fuzz_srcs_cnt++;
 
-    if (!min_us || q->exec_us < min_us) min_us = q->exec_us;
-    if (q->exec_us > max_us) max_us = q->exec_us;
+    sscanf(sd_ent->d_name, "kirenenko-out-%d", &src->task);
 
-    if (!min_bits || q->bitmap_size < min_bits) min_bits = q->bitmap_size;
-    if (q->bitmap_size > max_bits) max_bits = q->bitmap_size;
+    src->qd_path     = alloc_printf("%s/%s/queue", sync_dir, sd_ent->d_name);
+    src->synced_path = alloc_printf("%s/.synced/%s_queue", out_dir,
+                                    sd_ent->d_name);
+    src->party       = ck_strdup((u8*)sd_ent->d_name);
+    src->yield       = 1.0;
+    src->id_fd       = -1;
 
-    if (q->len > max_len) max_len = q->len;
+  }  
 
-    q = q->next;
+  closedir(sd);
 
-  }
+  sync_sources(argv, fuzz_srcs, fuzz_srcs_cnt);
 
-  SAYF("\n");
+}
 
-  if (avg_us > (qemu_mode ? 50000 : 10000)) 
-    WARNF(cLRD "The target binary is pretty slow! See %s/perf_tips.txt.",
-          doc_path);
 
-  /* Let's keep things moving with slow binaries. */
+/* A seed to replay: either a file, or a record in the packed store. */
 
-  if (avg_us > 50000) havoc_div = 10;     /* 0-19 execs/sec   */
-  else if (avg_us > 20000) havoc_div = 5; /* 20-49 execs/sec  */
-  else if (avg_us > 10000) havoc_div = 2; /* 50-100 execs/sec */
+struct replay_item {
 
-  if (!resuming_fuzz) {
+  u8* path;                           /* File name, or NULL for a record  */
+  struct store_rec* rec;              /* Store record                     */
 
-    if (max_len > 50 * 1024)
-      WARNF(cLRD "Some test cases are huge (%s) - see %s/perf_tips.txt!",
-            DMS(max_len), doc_path);
-    else if (max_len > 10 * 1024)
-      WARNF("Some test cases are big (%s) - see %s/perf_tips.txt.",
-            DMS(max_len), doc_path);
+};
 
-    if (useless_at_start && !in_bitmap)
-      WARNF(cLRD "Some test cases look useless. Consider using a smaller set.");
 
-    if (queued_paths > 100)
-      WARNF(cLRD "You probably have far too many input files! Consider trimming down.");
-    else if (queued_paths > 20)
-      WARNF("You have lots of input files; try starting small.");
+/* Load the data of a replay item. */
 
-  }
+static u8* replay_load(struct replay_item* it, u32* len) {
 
-  OKF("Here are some useful stats:\n\n"
+  static s32 seg_fd = -1;
+  static u32 seg_num;
 
-      cGRA "    Test case count : " cNOR "%u favored, %u variable, %u total\n"
-      cGRA "       Bitmap range : " cNOR "%u to %u bits (average: %0.02f bits)\n"
-      cGRA "        Exec timing : " cNOR "%s to %s us (average: %s us)\n",
-      queued_favored, queued_variable, queued_paths, min_bits, max_bits, 
-      ((double)total_bitmap_size) / (total_bitmap_entries ? total_bitmap_entries : 1),
-      DI(min_us), DI(max_us), DI(avg_us));
+  struct stat st;
+  u8* mem;
+  s32 fd;
 
-  if (!timeout_given) {
+  if (it->path) {
+
+    fd = open(it->path, O_RDONLY);
+    if (fd < 0) PFATAL("Unable to open '%s'", it->path);
+
+    if (fstat(fd, &st)) PFATAL("fstat() failed");
+
+    *len = st.st_size;
+    mem  = ck_alloc_nozero(*len + 1);
+
+    ck_read(fd, mem, *len, it->path);
+    close(fd);
 
-    /* Figure out the appropriate timeout. The basic idea is: 5x average or
-       1x max, rounded up to EXEC_TM_ROUND ms and capped at 1 second.
+    return mem;
 
-       If the program is slow, the multiplier is lowered to 2x or 3x, because
-       random scheduler jitter is less likely to have any impact, and because
-       our patience is wearing thin =) */
+  }
 
-    if (avg_us > 50000) exec_tmout = avg_us * 2 / 1000;
-    else if (avg_us > 10000) exec_tmout = avg_us * 3 / 1000;
-    else exec_tmout = avg_us * 5 / 1000;
+  if (seg_fd < 0 || seg_num != it->rec->seg) {
 
-    exec_tmout = MAX(exec_tmout, max_us / 1000);
-    exec_tmout = (exec_tmout + EXEC_TM_ROUND) / EXEC_TM_ROUND * EXEC_TM_ROUND;
+    u8* fn = alloc_printf("%s/store/seg_%06u", out_dir, it->rec->seg);
 
-    if (exec_tmout > EXEC_TIMEOUT) exec_tmout = EXEC_TIMEOUT;
+    if (seg_fd >= 0) close(seg_fd);
 
-    ACTF("No -t option specified, so I'll use exec timeout of %u ms.", 
-         exec_tmout);
+    seg_fd = open(fn, O_RDONLY);
+    if (seg_fd < 0) PFATAL("Unable to open '%s'", fn);
 
-    timeout_given = 1;
+    seg_num = it->rec->seg;
+    ck_free(fn);
 
   }
 
-  OKF("All set and ready to roll!");
+  *len = it->rec->len;
+  mem  = ck_alloc_nozero(*len + 1);
+
+  if (pread(seg_fd, mem, *len, it->rec->off) != *len)
+    PFATAL("Short read from segment %u", it->rec->seg);
+
+  return mem;
 
 }
 
 
+/* Append the id:* files from a directory, in id order, to a replay list. */
 
+static void replay_add_dir(struct replay_item** items, u32* cnt, u8* dir) {
 
+  struct dirent** nl;
+  s32 n = scandir(dir, &nl, 0, alphasort), i;
 
+  if (n < 0) return;
 
+  for (i = 0; i < n; i++) {
+
+    if (!strncmp(nl[i]->d_name, CASE_PREFIX, strlen(CASE_PREFIX))) {
+
+      *items = ck_realloc(*items, (*cnt + 1) * sizeof(struct replay_item));
+      (*items)[(*cnt)++].path = alloc_printf("%s/%s", dir, nl[i]->d_name);
+
+    }
+
+    free(nl[i]);
+
+  }
+
+  free(nl);
 
-static int startswith(const char *str, const char *prefix)
-{
-    return strncmp(prefix, str, strlen(prefix)) == 0;
 }
 
-/* Grab interesting test cases from other fuzzers. */
 
-static void sync_fuzzers(char** argv) {
+/* Fold the result of a replayed seed into the novelty state, just like
+   save_if_interesting() would, minus saving anything or logging rareness.
+   trace_bits must hold the raw trace, and the crash record for crashes. */
 
-  sync_times++;
+static void replay_commit(u8 fault) {
 
-  DIR* sd;
-  struct dirent* sd_ent;
-  u32 sync_cnt = 0;
+  u32 key_cksum;
+  struct ckt_slot* slot;
 
-  sd = opendir(sync_dir);
-  if (!sd) PFATAL("Unable to open '%s'", sync_dir);
+  /* Crashes saved before the restart own their buckets. */
 
-  stage_max = stage_cur = 0;
-  cur_depth = 0;
+  if (fault == FAULT_CRASH) crash_seen();
 
-  /* Look at the entries created for every other fuzzer in the sync directory. */
+  rareness = get_rare(trace_bits);
 
-  while ((sd_ent = readdir(sd))) {
+#ifdef __x86_64__
+  classify_counts((u64*)trace_bits);
+#else
+  classify_counts((u32*)trace_bits);
+#endif /* ^__x86_64__ */
 
-    int num_checked_seeds = 0;
+  key_cksum = hash32(trace_bits, MAP_SIZE, HASH_CONST);
 
-    static u8 stage_tmp[128];
+  /* A shared path count table already has what other instances have seen,
+     so it is left alone. */
 
-    // DIR* qd;
-    struct dirent* qd_ent;
-    u8 *qd_path, *qd_synced_path;
-    u32 min_accept = 0, next_min_accept;
+  if (!ckt_shared) {
 
-    s32 id_fd;
+    slot = ckt_lookup(key_cksum, fault == FAULT_NONE);
+    if (slot) __sync_fetch_and_add(&slot->count, 1);
 
-    /* Skip dot files and our own output directory, and not fuzz dir. */
+  }
 
-    if (sd_ent->d_name[0] == '.' || !strcmp(sync_id, sd_ent->d_name) || !startswith(sd_ent->d_name, "kirenenko")) continue;
+  has_new_bits(virgin_bits);
+  set_add(hash_value_set, &path_log, *(u64*)(trace_bits + MAP_SIZE));
 
-    /* Skip anything that doesn't have a queue/ subdirectory. */
-    // ACTF("target_sync_dir: %s", sd_ent->d_name);
-    sscanf(sd_ent->d_name, "kirenenko-out-%d", &filter_index);
-    
+  /* Hangs are judged on the simplified trace, as in save_if_interesting(). */
 
-    int i;
-    char* q_or_c[2] = {"queue", "crashes"};
-    for(i=0; i<1; i++)
-    {
-      min_accept = 0;
-      // qd_path = alloc_printf("%s/%s/queue", sync_dir, sd_ent->d_name);
-      qd_path = alloc_printf("%s/%s/%s", sync_dir, sd_ent->d_name, q_or_c[i]);
+  if (fault == FAULT_HANG) {
 
-      // if (!(qd = opendir(qd_path))) {
-      //   ck_free(qd_path);
-      //   continue;
-      // }
+#ifdef __x86_64__
+    simplify_trace((u64*)trace_bits);
+#else
+    simplify_trace((u32*)trace_bits);
+#endif /* ^__x86_64__ */
 
-      /* Retrieve the ID of the last seen test case. */
+    has_new_bits(virgin_hang);
 
-      // qd_synced_path = alloc_printf("%s/.synced/%s", out_dir, sd_ent->d_name);
-      qd_synced_path = alloc_printf("%s/.synced/%s_%s", out_dir, sd_ent->d_name, q_or_c[i]);
+  }
 
-      id_fd = open(qd_synced_path, O_RDWR | O_CREAT, 0600);
+}
 
-      if (id_fd < 0) PFATAL("Unable to create '%s'", qd_synced_path);
 
-      if (read(id_fd, &min_accept, sizeof(u32)) > 0) 
-        lseek(id_fd, 0, SEEK_SET);
+/* Rebuild the novelty state from the seeds already in the output directory
+   by running them across replay_jobs executors. Results are folded in
+   strictly in the original order (store record order, or id order within
+   queue/, -path/_queue/, crashes/ and -path/_crashes/), so the outcome is
+   the same as replaying them one by one. */
 
-      next_min_accept = min_accept;
+static void replay_corpus(char** argv) {
 
-      /* Show stats */    
+  struct replay_item* items = NULL;
+  u32 cnt = 0, next = 0, done = 0, i;
+  u64 start_ms = get_cur_time();
+  u8* fn;
 
-      sprintf(stage_tmp, "sync(%s) %u", q_or_c[i], ++sync_cnt);
-      stage_name = stage_tmp;
-      stage_cur  = 0;
-      stage_max  = 0;
+  if (store_hdr) {
 
-      /* For every file queued by this fuzzer, parse ID and see if we have looked at
-         it before; exec a test case if not. */
+    items = ck_alloc(store_hdr->rec_count * sizeof(struct replay_item) + 1);
 
-      struct dirent ** namelist;
-      int dir_n = scandir(qd_path, &namelist, 0, alphasort);
-      if(dir_n < 0) {
-        ck_free(qd_path);
-        close(id_fd); // J.H.
-        continue;    
-      } 
-      // while ((qd_ent = readdir(qd))) {
-      int dir_i;
-      for(dir_i = 0; dir_i < dir_n; dir_i++){  
-        qd_ent = namelist[dir_i];
-        u8* path;
-        s32 fd;
-        struct stat st;
+    for (i = 0; i < store_hdr->rec_count; i++)
+      if (store_recs[i].kind != STORE_HANG &&
+          !(store_recs[i].flags & STORE_F_TRIMMED))
+        items[cnt++].rec = store_recs + i;
 
-        if (qd_ent->d_name[0] == '.' ||
-            sscanf(qd_ent->d_name, CASE_PREFIX "%08u", &syncing_case) != 1 || 
-            syncing_case < min_accept) continue;
+  }
 
-        // if(i == 0 && num_checked_seeds == sync_max_seeds_per)
-        //   break;
+  fn = alloc_printf("%s/queue", out_dir);
+  replay_add_dir(&items, &cnt, fn);
+  ck_free(fn);
 
-        /* OK, sounds like a new one. Let's give it a try. */
+  fn = alloc_printf("%s-path/_queue", out_dir);
+  replay_add_dir(&items, &cnt, fn);
+  ck_free(fn);
 
-        if (syncing_case >= next_min_accept)
-          next_min_accept = syncing_case + 1;
+  fn = alloc_printf("%s/crashes", out_dir);
+  replay_add_dir(&items, &cnt, fn);
+  ck_free(fn);
 
-        path = alloc_printf("%s/%s", qd_path, qd_ent->d_name);
+  fn = alloc_printf("%s-path/_crashes", out_dir);
+  replay_add_dir(&items, &cnt, fn);
+  ck_free(fn);
 
-        fd = open(path, O_RDONLY);
-        if (fd < 0) PFATAL("Unable to open '%s'", path);
+  ACTF("Replaying %u seeds with %u fork servers...", cnt, replay_jobs);
 
-        if (fstat(fd, &st)) PFATAL("fstat() failed");
+  stage_name = "replay";
+  stage_max  = cnt;
+  stage_cur  = 0;
 
-        /* Ignore zero-sized or oversized files. */
+  /* Seed n always goes to executor n % replay_jobs, so the oldest seed in
+     flight is the one to commit next. */
 
-        if (st.st_size && st.st_size <= MAX_FILE) {
+  job_get();
 
-          if(i == 0) 
-          {
-            sync_count++;
-            num_checked_seeds++;
-          }
-          else
-          {
-            sync_count_crashes++;
-          }
-          u8  fault;
-          u8* mem = mmap(0, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  while (done < cnt && !stop_soon) {
 
-          if (mem == MAP_FAILED) PFATAL("Unable to mmap '%s'", path);
+    struct executor* e;
 
-          /* See what happens. We rely on save_if_interesting() to catch major
-             errors and save the test case. */
+    while (next < cnt && next < done + replay_jobs) {
 
-          write_to_testcase(mem, st.st_size);
-          fault = run_target(argv); //
-          
+      u32 len;
+      u8* mem = replay_load(items + next, &len);
 
-          if (stop_soon) return;
+      exec_launch(exec_pool + next % replay_jobs, mem, len);
+      ck_free(mem);
+      next++;
 
-          syncing_party = sd_ent->d_name;
-          
-          queued_imported += save_if_interesting(argv, mem, st.st_size, fault);
-          syncing_party = 0;
+    }
 
-          munmap(mem, st.st_size);
+    e = exec_pool + done % replay_jobs;
 
-          if (!(stage_cur++ % stats_update_freq)) show_stats();
+    exec_wait(e);
+    if (stop_soon) break;
 
-        }
-	unlink(path);
-        ck_free(path);
-        close(fd);
+    memcpy(trace_bits, e->trace_bits, MAP_SIZE + 8);
+    memcpy(trace_bits + CRASH_REC_OFF, e->trace_bits + CRASH_REC_OFF, 16);
+    replay_commit(exec_fault(e));
 
-      }
+    done++;
+    stage_cur = done;
 
-      for(dir_i = 0; dir_i < dir_n; dir_i++)
-      {
-        free(namelist[dir_i]);
-      }
-      free(namelist);
+    if (next == done) job_yield();
 
-      ck_write(id_fd, &next_min_accept, sizeof(u32), qd_synced_path);
+    if (!(done % stats_update_freq)) show_stats();
 
-      close(id_fd);
-      // closedir(qd);
-      ck_free(qd_path);
-      ck_free(qd_synced_path);
-    }
-    
-  }  
+  }
 
-  closedir(sd);
+  for (i = 0; i < cnt; i++) ck_free(items[i].path);
+  ck_free(items);
+
+  OKF("Replayed %u seeds in %0.02f sec.", done,
+      (get_cur_time() - start_ms) / 1000.0);
 
 }
 
@@ -3995,9 +7877,12 @@ static void usage(u8* argv0) {
 
        "Other stuff:\n\n"
 
+       "  -i -          - resume from the checkpoint in the output directory\n"
+       "  -R jobs       - resume by replaying the output on that many fork servers\n"
        "  -T text       - text banner to show on the screen\n"
        "  -M / -S id    - distributed mode (see parallel_fuzzing.txt)\n"
-       "  -C            - crash exploration mode (the peruvian rabbit thing)\n\n"
+       "  -C            - crash exploration mode (the peruvian rabbit thing)\n"
+       "  -J file       - run the filters listed in file, sharing the CPUs\n\n"
 
        "For additional tips, please consult %s/README.\n\n",
 
@@ -4049,16 +7934,16 @@ static void setup_dirs_fds(void) {
 
   }
   tmp = alloc_printf("%s-path", out_dir);
-  if (mkdir(tmp, 0700)) PFATAL("Unable to create '%s'", tmp); 
+  if (mkdir(tmp, 0700) && (!resuming || errno != EEXIST)) PFATAL("Unable to create '%s'", tmp); 
   ck_free(tmp);
 
 
   tmp = alloc_printf("%s-path/_queue", out_dir);
-  if (mkdir(tmp, 0700)) PFATAL("Unable to create '%s'", tmp); 
+  if (mkdir(tmp, 0700) && (!resuming || errno != EEXIST)) PFATAL("Unable to create '%s'", tmp); 
   ck_free(tmp);
 
   tmp = alloc_printf("%s-path/_crashes", out_dir);
-  if (mkdir(tmp, 0700)) PFATAL("Unable to create '%s'", tmp); 
+  if (mkdir(tmp, 0700) && (!resuming || errno != EEXIST)) PFATAL("Unable to create '%s'", tmp); 
   ck_free(tmp);
 
 
@@ -4066,7 +7951,7 @@ static void setup_dirs_fds(void) {
   /* Queue directory for any starting & discovered paths. */
 
   tmp = alloc_printf("%s/queue", out_dir);
-  if (mkdir(tmp, 0700)) PFATAL("Unable to create '%s'", tmp);
+  if (mkdir(tmp, 0700) && (!resuming || errno != EEXIST)) PFATAL("Unable to create '%s'", tmp);
   ck_free(tmp);
 
 
@@ -4074,38 +7959,40 @@ static void setup_dirs_fds(void) {
      resume and related tasks. */
 
   tmp = alloc_printf("%s/queue/.state/", out_dir);
-  if (mkdir(tmp, 0700)) PFATAL("Unable to create '%s'", tmp);
+  if (mkdir(tmp, 0700) && (!resuming || errno != EEXIST)) PFATAL("Unable to create '%s'", tmp);
   ck_free(tmp);
 
   /* Directory for flagging queue entries that went through
      deterministic fuzzing in the past. */
 
   tmp = alloc_printf("%s/queue/.state/deterministic_done/", out_dir);
-  if (mkdir(tmp, 0700)) PFATAL("Unable to create '%s'", tmp);
+  if (mkdir(tmp, 0700) && (!resuming || errno != EEXIST)) PFATAL("Unable to create '%s'", tmp);
   ck_free(tmp);
 
   /* Directory with the auto-selected dictionary entries. */
 
   tmp = alloc_printf("%s/queue/.state/auto_extras/", out_dir);
-  if (mkdir(tmp, 0700)) PFATAL("Unable to create '%s'", tmp);
+  if (mkdir(tmp, 0700) && (!resuming || errno != EEXIST)) PFATAL("Unable to create '%s'", tmp);
   ck_free(tmp);
 
-  /* The set of paths currently deemed redundant. */
+  /* The set of paths currently deemed redundant. With the flags now kept in
+     the state file, this and favored_edges/ are only populated by
+     afl-export -M. */
 
   tmp = alloc_printf("%s/queue/.state/redundant_edges/", out_dir);
-  if (mkdir(tmp, 0700)) PFATAL("Unable to create '%s'", tmp);
+  if (mkdir(tmp, 0700) && (!resuming || errno != EEXIST)) PFATAL("Unable to create '%s'", tmp);
   ck_free(tmp);
 
   /* Favored queue directory for any starting & discovered paths. */
   tmp = alloc_printf("%s/queue/.state/favored_edges", out_dir);
-  if (mkdir(tmp, 0700)) PFATAL("Unable to create '%s'", tmp);
+  if (mkdir(tmp, 0700) && (!resuming || errno != EEXIST)) PFATAL("Unable to create '%s'", tmp);
   ck_free(tmp);
 
 
   /* The set of paths showing variable behavior. */
 
   tmp = alloc_printf("%s/queue/.state/variable_behavior/", out_dir);
-  if (mkdir(tmp, 0700)) PFATAL("Unable to create '%s'", tmp);
+  if (mkdir(tmp, 0700) && (!resuming || errno != EEXIST)) PFATAL("Unable to create '%s'", tmp);
   ck_free(tmp);
 
   /* Sync directory for keeping track of cooperating fuzzers. */
@@ -4113,7 +8000,7 @@ static void setup_dirs_fds(void) {
   if (sync_id) {
 
     tmp = alloc_printf("%s/.synced/", out_dir);
-    if (mkdir(tmp, 0700)) PFATAL("Unable to create '%s'", tmp);
+    if (mkdir(tmp, 0700) && (!resuming || errno != EEXIST)) PFATAL("Unable to create '%s'", tmp);
     ck_free(tmp);
 
   }
@@ -4121,13 +8008,13 @@ static void setup_dirs_fds(void) {
   /* All recorded crashes. */
 
   tmp = alloc_printf("%s/crashes", out_dir);
-  if (mkdir(tmp, 0700)) PFATAL("Unable to create '%s'", tmp);
+  if (mkdir(tmp, 0700) && (!resuming || errno != EEXIST)) PFATAL("Unable to create '%s'", tmp);
   ck_free(tmp);
 
   /* All recorded hangs. */
 
   tmp = alloc_printf("%s/hangs", out_dir);
-  if (mkdir(tmp, 0700)) PFATAL("Unable to create '%s'", tmp);
+  if (mkdir(tmp, 0700) && (!resuming || errno != EEXIST)) PFATAL("Unable to create '%s'", tmp);
   ck_free(tmp);
 
   /* Generally useful file descriptors. */
@@ -4141,14 +8028,17 @@ static void setup_dirs_fds(void) {
   /* Gnuplot output file. */
 
   tmp = alloc_printf("%s/plot_data", out_dir);
-  fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL, 0600);
+
+  if (resuming) fd = open(tmp, O_WRONLY | O_CREAT | O_APPEND, 0600);
+  else fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL, 0600);
+
   if (fd < 0) PFATAL("Unable to create '%s'", tmp);
   ck_free(tmp);
 
   plot_file = fdopen(fd, "w");
   if (!plot_file) PFATAL("fdopen() failed");
 
-  fprintf(plot_file, "# unix_time, cycles_done, cur_path, paths_total, "
+  if (!resuming) fprintf(plot_file, "# unix_time, cycles_done, cur_path, paths_total, "
                      "pending_total, pending_favs, map_size, unique_crashes, "
                      "unique_hangs, max_depth, execs_per_sec\n");
                      /* ignore errors */
@@ -4646,6 +8536,155 @@ static void save_cmdline(u32 argc, char** argv) {
 
 }
 
+/* Supervisor mode (-J): run one filter per line of jobs_file, each line
+   being a weight followed by the afl-fuzz options and target command line
+   for that filter (no quoting, '#' starts a comment). The filters share a
+   pool of CPU tokens (AFL_JOBS, one per core by default) handed out
+   through a pipe: a filter takes one before running anything, keeps it for
+   weight * JOB_SLICE_MS while it has a backlog, and gives it back while it
+   is idle. Never returns. */
+
+static void supervise(u8* own_path, u8* jobs_file) {
+
+  struct sigaction sa;
+  FILE* f = fopen(jobs_file, "r");
+  u8    line[4096];
+  s32   job_pipe[2], *pids = NULL, status;
+  u32   tokens, cnt = 0, alive, i;
+
+  if (!f) PFATAL("Unable to open '%s'", jobs_file);
+
+  get_core_count();
+
+  tokens = cpu_core_count ? cpu_core_count : 1;
+
+  if (getenv("AFL_JOBS")) {
+
+    tokens = atoi(getenv("AFL_JOBS"));
+    if (!tokens) FATAL("Bad value of AFL_JOBS");
+
+  }
+
+  if (pipe(job_pipe)) PFATAL("pipe() failed");
+
+  for (i = 0; i < tokens; i++) ck_write(job_pipe[1], "+", 1, "job pipe");
+
+  setenv("AFL_JOBSERVER", alloc_printf("%d,%d", job_pipe[0], job_pipe[1]), 1);
+  setenv("AFL_NO_UI", "1", 1);
+
+  /* Stop on the usual signals, but without SA_RESTART, so that waitpid()
+     below gets interrupted. */
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = handle_stop_sig;
+  sigemptyset(&sa.sa_mask);
+
+  sigaction(SIGHUP, &sa, NULL);
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+
+  while (fgets(line, sizeof(line), f)) {
+
+    char** cargv = ck_alloc(sizeof(char*));
+    u32    cargc = 1;
+    double weight;
+    u8    *tok, *desc;
+
+    if ((tok = strchr(line, '#'))) *tok = 0;
+    line[strcspn(line, "\r\n")] = 0;
+
+    desc = ck_strdup(line);
+
+    tok = strtok(line, " \t");
+    if (!tok) { ck_free(desc); continue; }
+
+    weight = atof(tok);
+    if (weight <= 0) FATAL("Bad weight '%s' in '%s'", tok, jobs_file);
+
+    cargv[0] = own_path;
+
+    while ((tok = strtok(NULL, " \t"))) {
+      cargv = ck_realloc(cargv, (cargc + 2) * sizeof(char*));
+      cargv[cargc++] = ck_strdup(tok);
+    }
+
+    cargv[cargc] = NULL;
+
+    setenv("AFL_JOB_SLICE", alloc_printf("%u", MAX((u32)(weight *
+           JOB_SLICE_MS), 1)), 1);
+
+    pids = ck_realloc(pids, (cnt + 1) * sizeof(s32));
+    pids[cnt] = fork();
+
+    if (pids[cnt] < 0) PFATAL("fork() failed");
+
+    if (!pids[cnt]) {
+      execvp(own_path, cargv);
+      PFATAL("Unable to execute '%s'", own_path);
+    }
+
+    OKF("Filter %u (pid %d): %s", cnt, pids[cnt], desc);
+    ck_free(desc);
+
+    cnt++;
+
+  }
+
+  fclose(f);
+
+  if (!cnt) FATAL("No filters in '%s'", jobs_file);
+
+  OKF("Supervising %u filter%s on %u CPU token%s.", cnt, cnt == 1 ? "" : "s",
+      tokens, tokens == 1 ? "" : "s");
+
+  alive = cnt;
+
+  while (alive) {
+
+    s32 pid = waitpid(-1, &status, 0);
+
+    if (pid < 0) {
+
+      if (errno != EINTR) PFATAL("waitpid() failed");
+
+      if (stop_soon == 1) {
+
+        /* Pass the signal on, and wake up whoever is waiting for a token. */
+
+        for (i = 0; i < cnt; i++) if (pids[i] > 0) kill(pids[i], SIGINT);
+        for (i = 0; i < cnt; i++) ck_write(job_pipe[1], "+", 1, "job pipe");
+
+        stop_soon = 2;
+
+      }
+
+      continue;
+
+    }
+
+    for (i = 0; i < cnt; i++) if (pids[i] == pid) break;
+    if (i == cnt) continue;
+
+    pids[i] = 0;
+    alive--;
+
+    /* A filter that did not get to exit cleanly (SIGKILL, say) may have
+       taken a token with it; put one back, so the budget does not shrink
+       for good. */
+
+    if (!WIFEXITED(status)) ck_write(job_pipe[1], "+", 1, "job pipe");
+
+    if (!stop_soon)
+      WARNF("Filter %u exited (status %d) - %u still running.", i, status,
+            alive);
+
+  }
+
+  OKF("All filters are done.");
+  exit(0);
+
+}
+
 // void backup_stat(char** stat_vector, int cnt)
 // {
 //   char filepath[] = "/home/vagrant/cc_server/afl_fuzz_stat.txt";
@@ -4665,14 +8704,20 @@ static void save_cmdline(u32 argc, char** argv) {
 
 int main(int argc, char** argv) {
 
-  s32 opt;
+  s32 opt, prev_synced;
   // u64 prev_queued = 0;
   // u32 sync_interval_cnt = 0; 
 
   u8  mem_limit_given = 0;
+  u8* jobs_file = NULL;
   // Allocate memory for hashmaps
-  cksum2paths = kh_init(32); 
-  hash_value_set = kh_init(p64);
+  hash_value_set   = kh_init(p64);
+  var_cksum_set    = kh_init(p64);
+  crash_bucket_set = kh_init(p64);
+
+  memset(top_rated, 0xff, sizeof(top_rated));
+
+  setup_maps();
 
   char** use_argv;
 
@@ -4683,19 +8728,26 @@ int main(int argc, char** argv) {
 
   
 
-  while ((opt = getopt(argc, argv, "+o:f:m:t:T:dnCB:S:M:QLs:r")) > 0)
+  while ((opt = getopt(argc, argv, "+i:o:f:m:t:T:dnCB:S:M:QLs:rR:J:")) > 0)
   {
     // ACTF("opt: %c", opt);
     switch (opt) {
 
-      // case 'i':
+      case 'R': /* rebuild state by replaying the output */
+
+        replay_jobs = atoi(optarg);
+        if (!replay_jobs) FATAL("Bad syntax used for -R");
 
-      //   if (in_dir) FATAL("Multiple -i options not supported");
-      //   in_dir = optarg;
+        in_place_resume = 1;
+        break;
 
-      //   if (!strcmp(in_dir, "-")) in_place_resume = 1;
+      case 'i': /* resume */
 
-      //   break;
+        if (strcmp(optarg, "-"))
+          FATAL("Only '-i -' (resume from the output directory) is supported");
+
+        in_place_resume = 1;
+        break;
 
       case 'o': /* output dir */
 
@@ -4854,6 +8906,11 @@ int main(int argc, char** argv) {
         is_trim_case = 1;
         break;
 
+      case 'J':
+        if (jobs_file) FATAL("Multiple -J options not supported");
+        jobs_file = optarg;
+        break;
+
 
       default:
 
@@ -4866,6 +8923,8 @@ int main(int argc, char** argv) {
   }
   
 
+  if (jobs_file) supervise(argv[0], jobs_file);
+
   if (optind == argc || /*!in_dir ||*/ !out_dir) usage(argv[0]);
 
   setup_signal_handlers();
@@ -4886,10 +8945,152 @@ int main(int argc, char** argv) {
   if (getenv("AFL_NO_FORKSRV"))   no_forkserver    = 1;
   if (getenv("AFL_NO_CPU_RED"))   no_cpu_meter_red = 1;
   if (getenv("AFL_NO_VAR_CHECK")) no_var_check     = 1;
+  if (getenv("AFL_PACKED_STORE")) packed_store     = 1;
+
+  if (qemu_mode && !getenv("AFL_NO_EARLY_EXIT")) early_exit = 1;
+
+  if (getenv("AFL_NO_ADAPTIVE_TMOUT")) adaptive_tmout = 0;
+  if (getenv("AFL_NO_CRASH_BUCKETS"))  crash_buckets  = 0;
+
+  if (getenv("AFL_JOBSERVER")) {
+
+    if (sscanf(getenv("AFL_JOBSERVER"), "%d,%d", &job_rfd, &job_wfd) != 2)
+      FATAL("Bad value of AFL_JOBSERVER");
+
+    /* Keep the token pipe away from the targets. */
+
+    fcntl(job_rfd, F_SETFD, FD_CLOEXEC);
+    fcntl(job_wfd, F_SETFD, FD_CLOEXEC);
+
+    if (getenv("AFL_JOB_SLICE")) job_slice = atoi(getenv("AFL_JOB_SLICE"));
+
+    atexit(job_put);
+
+  }
+
+  if (getenv("AFL_PREFILTER")) {
+
+    if (!qemu_mode || dumb_mode || no_forkserver)
+      FATAL("AFL_PREFILTER needs QEMU mode (-Q) and the fork server");
+
+    prefilter_path = getenv("AFL_PREFILTER");
+
+    if (access(prefilter_path, X_OK))
+      PFATAL("Unable to execute '%s'", prefilter_path);
+
+  }
+
+  if (getenv("AFL_CAL_CYCLES")) {
+
+    cal_cycles = atoi(getenv("AFL_CAL_CYCLES"));
+    if (!cal_cycles) FATAL("Bad value of AFL_CAL_CYCLES");
+
+  }
+
+  if (getenv("AFL_CAL_BUDGET")) {
+
+    cal_budget = atoi(getenv("AFL_CAL_BUDGET"));
+    if (!cal_budget || cal_budget > 100) FATAL("Bad value of AFL_CAL_BUDGET");
+
+  }
+
+  if (getenv("AFL_BACKLOG_HWM")) {
+
+    backlog_hwm = atoi(getenv("AFL_BACKLOG_HWM"));
+    if (!backlog_hwm) FATAL("Invalid value of AFL_BACKLOG_HWM");
+
+  }
+
+  if (getenv("AFL_OVERLOAD_BACKLOG")) {
+
+    ovl_backlog = atoi(getenv("AFL_OVERLOAD_BACKLOG"));
+    if (!ovl_backlog) FATAL("Invalid value of AFL_OVERLOAD_BACKLOG");
+
+  }
+
+  if (getenv("AFL_OVERLOAD_LATENCY")) {
+
+    ovl_latency = atoi(getenv("AFL_OVERLOAD_LATENCY"));
+    if (!ovl_latency) FATAL("Invalid value of AFL_OVERLOAD_LATENCY");
+
+  }
+
+  if ((ovl_backlog || ovl_latency) && !sync_id)
+    FATAL("Overload mode needs -S or -M");
+
+  if (getenv("AFL_OVERLOAD_KEEP"))
+    ovl_keep = atoi(getenv("AFL_OVERLOAD_KEEP"));
+
+  if (getenv("AFL_OVERLOAD_DEFER"))
+    ovl_defer_max = atoi(getenv("AFL_OVERLOAD_DEFER"));
+
+  if (getenv("AFL_SYNC_POLICY")) {
+
+    u8* pol = getenv("AFL_SYNC_POLICY");
+
+    for (sync_policy = 0; sync_policy < 3; sync_policy++)
+      if (!strcmp(pol, sync_policy_names[sync_policy])) break;
+
+    if (sync_policy == 3) FATAL("AFL_SYNC_POLICY must be rr, score or yield");
+
+  }
 
   if (dumb_mode == 2 && no_forkserver)
     FATAL("AFL_DUMB_FORKSRV and AFL_NO_FORKSRV are mutually exclusive");
 
+  if (replay_jobs && (dumb_mode || no_forkserver))
+    FATAL("-R needs the fork server (no -n or AFL_NO_FORKSRV)");
+
+  if (getenv("AFL_POOL")) {
+
+    if (dumb_mode || no_forkserver)
+      FATAL("AFL_POOL needs the fork server (no -n or AFL_NO_FORKSRV)");
+
+    if (sscanf(getenv("AFL_POOL"), "%u,%u", &pool_min, &pool_max) != 2 ||
+        !pool_min || pool_min > pool_max)
+      FATAL("AFL_POOL must be min,max with 1 <= min <= max");
+
+    if (getenv("AFL_POOL_RESERVE"))
+      pool_reserve = atoi(getenv("AFL_POOL_RESERVE"));
+
+    if (getenv("AFL_NO_AFFINITY")) pool_pin = 0;
+
+  }
+
+  if (is_trim_case && !dumb_mode && !no_forkserver) {
+
+    u8* x = getenv("AFL_TRIM_JOBS");
+
+    trim_jobs = x ? atoi(x) : TRIM_JOBS;
+    if (!trim_jobs) FATAL("Bad value of AFL_TRIM_JOBS");
+
+    x = getenv("AFL_TRIM_BUDGET");
+
+    if (x) {
+      trim_budget = atoi(x);
+      if (!trim_budget || trim_budget > 100)
+        FATAL("Bad value of AFL_TRIM_BUDGET");
+    }
+
+  }
+
+  /* Under -J, we only ever hold a single CPU token, so we get a single
+     executor for the replay, the minimizer and the pool alike; more would
+     run more targets than the supervisor gave us. */
+
+  if (job_rfd >= 0) {
+
+    if (replay_jobs > 1 || pool_max > 1 ||
+        (getenv("AFL_TRIM_JOBS") && trim_jobs > 1))
+      WARNF("-R, AFL_TRIM_JOBS and AFL_POOL are capped at one executor under -J");
+
+    replay_jobs = MIN(replay_jobs, 1);
+    trim_jobs   = MIN(trim_jobs, 1);
+
+    if (pool_max) pool_min = pool_max = 1;
+
+  }
+
   save_cmdline(argc, argv);
 
   fix_up_banner(argv[optind]);
@@ -4904,6 +9105,28 @@ int main(int argc, char** argv) {
 
   setup_dirs_fds();
 
+#ifdef __linux__
+
+  /* New producer directories (and the spool) show up in sync_dir; the
+     producer directories themselves are watched from sync_scan(). */
+
+  ino_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (ino_fd >= 0) inotify_add_watch(ino_fd, sync_dir, IN_CREATE | IN_MOVED_TO);
+
+#endif /* __linux__ */
+
+  if (ovl_backlog || ovl_latency) setup_deferred();
+  setup_state();
+  setup_queue_files();
+  setup_ckt();
+
+  if (packed_store) setup_store();
+
+  if (resuming) {
+    if (!replay_jobs) load_checkpoint();
+    resume_counters();
+  }
+
   if(is_qemu_log)
     setup_qemu_log_fd();
 
@@ -4935,6 +9158,31 @@ int main(int argc, char** argv) {
   if (!dumb_mode && !no_forkserver && !forksrv_pid)
     init_forkserver(use_argv);
 
+  if (prefilter_path) init_prefilter(argv + optind);
+
+  /* One pool serves both the replay and the minimizer; a single trim job
+     just means the serial minimizer. */
+
+  if (replay_jobs || trim_jobs > 1 || pool_max)
+    init_exec_pool(use_argv, MAX(MAX(replay_jobs, trim_jobs), pool_min));
+
+  if (pool_max) sync_jobs = ck_alloc(pool_max * sizeof(struct sync_job));
+
+  if (replay_jobs) {
+
+    replay_corpus(use_argv);
+    if (stop_soon) goto stop_fuzzing;
+
+    maybe_checkpoint(1);
+
+  }
+
+  /* The replay and the minimizer may have asked for more executors than
+     AFL_POOL allows, and sync_jobs only has room for pool_max. */
+
+  if (pool_max && exec_pool_size > pool_max)
+    init_exec_pool(use_argv, pool_max);
+
   
 
 
@@ -4960,14 +9208,23 @@ int main(int argc, char** argv) {
         fflush(stdout);
       }
 
+    prev_synced = sync_count;
+
     sync_fuzzers(use_argv);
     write_stats_file(0,0);
     show_stats();
 
-    //cull_queue();
+    maybe_checkpoint(0);
+
+    cull_queue();
+
+    calibrate_pending(use_argv, sync_count == prev_synced);
+    trim_pending(use_argv, sync_count == prev_synced);
 
     if (stop_soon) break;
 
+    if (sync_count == prev_synced && !cal_cnt && !trim_cnt) idle_wait();
+
 
   }
 
@@ -4992,13 +9249,13 @@ stop_fuzzing:
 
   // }
 
+  maybe_checkpoint(1);
+
   fclose(plot_file);
   destroy_queue();
 
   ck_free(target_path);
-  
-  // De-allocate memory for hashmaps
-  kh_destroy(32, cksum2paths);
+
 
   alloc_report();
 
@@ -330,6 +330,128 @@ static inline u8* DFL_ck_memdup_str(u8* mem, u32 size) {
 }
 
 
+/* Arena (bump) allocator for scratch memory that only lives as long as some
+   unit of work: memory is carved out of large blocks, never freed one by
+   one, and handed back all at once with arena_reset(). Allocations are not
+   zeroed and have no canaries. If a unit of work overflows the first block,
+   the reset replaces all blocks with one that fits everything, so that the
+   arena settles on a single block. */
+
+struct arena_blk {
+
+  struct arena_blk* next;             /* Older block, if any              */
+  u32 size,                           /* Usable size of data[]            */
+      used;                           /* Bytes handed out so far          */
+  u8  data[];
+
+};
+
+struct arena {
+
+  struct arena_blk* head;             /* Block currently allocated from   */
+
+};
+
+
+/* Allocate a fresh arena block with room for at least size bytes. */
+
+static inline struct arena_blk* arena_new_blk(u32 size) {
+
+  struct arena_blk* b;
+
+  size = MAX(size, ARENA_BLK_SIZE);
+
+  b = malloc(sizeof(struct arena_blk) + size);
+  ALLOC_CHECK_RESULT(b, size);
+
+  b->next = NULL;
+  b->size = size;
+  b->used = 0;
+
+  return b;
+
+}
+
+
+/* Allocate scratch memory from an arena (8-byte aligned). */
+
+static inline void* arena_alloc(struct arena* a, u32 size) {
+
+  struct arena_blk* b = a->head;
+  void* ret;
+
+  ALLOC_CHECK_SIZE(size);
+
+  size = (size + 7) & ~7;
+
+  if (!b || b->size - b->used < size) {
+
+    b = arena_new_blk(size);
+    b->next = a->head;
+    a->head = b;
+
+  }
+
+  ret = b->data + b->used;
+  b->used += size;
+
+  return ret;
+
+}
+
+
+/* Release everything allocated from an arena. */
+
+static inline void arena_reset(struct arena* a) {
+
+  struct arena_blk* b = a->head;
+  u32 total = 0;
+
+  if (!b) return;
+
+  if (!b->next) {
+    b->used = 0;
+    return;
+  }
+
+  while (b) {
+
+    struct arena_blk* next = b->next;
+
+    total += b->size;
+    free(b);
+    b = next;
+
+  }
+
+  a->head = arena_new_blk(total);
+
+}
+
+
+/* Copy a string into an arena. */
+
+static inline u8* arena_strdup(struct arena* a, u8* str) {
+
+  u32 size = strlen((char*)str) + 1;
+
+  return memcpy(arena_alloc(a, size), str, size);
+
+}
+
+
+/* Like alloc_printf(), but allocating from an arena. */
+
+#define arena_printf(_a, _str...) ({ \
+    u8* _tmp; \
+    s32 _len = snprintf(NULL, 0, _str); \
+    if (_len < 0) FATAL("Whoa, snprintf() fails?!"); \
+    _tmp = arena_alloc(_a, _len + 1); \
+    snprintf((char*)_tmp, _len + 1, _str); \
+    _tmp; \
+  })
+
+
 #ifndef DEBUG_BUILD
 
 /* In non-debug mode, we just do straightforward aliasing of the above functions
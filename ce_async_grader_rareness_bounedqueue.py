@@ -65,6 +65,41 @@ class OutTask(object):
 		return "category: "+str(self.category) + " idx: " + str(self.idx);
 
 
+# Producer spool shared with the filter: a fixed set of slots under
+# size_src/spool/. Must match SPOOL_SLOTS in config.h.
+SPOOL_SLOTS = 16
+spool_dir = os.getcwd()+'/size_src/spool'
+spool_busy = set()
+spool_lock = threading.Lock()
+
+def acquire_slot():
+	# A slot is free once the filter has removed our .done marker and
+	# every seed we put there.
+	while True:
+		with spool_lock:
+			for k in range(SPOOL_SLOTS):
+				slot = spool_dir+'/slot-'+str(k)
+				if k in spool_busy or os.path.exists(slot+'/.done'):
+					continue
+				if os.listdir(slot):
+					continue
+				spool_busy.add(k)
+				return k
+		time.sleep(0.1)
+
+def publish_slot(stage_dir,slot,index,score):
+	# Leave the task score for AFL_SYNC_POLICY=score, move the seeds in,
+	# in order, then mark the task as complete.
+	slot_dir = spool_dir+'/slot-'+str(slot)
+	with open(slot_dir+'/.score','w') as f:
+		f.write(str(score)+'\n')
+	for seq,name in enumerate(sorted(os.listdir(stage_dir))):
+		os.rename(stage_dir+'/'+name, slot_dir+'/id:%08d,task:%d' % (seq,index))
+	open(slot_dir+'/.done','w').close()
+	os.rmdir(stage_dir)
+	with spool_lock:
+		spool_busy.discard(slot)
+
 def process_task(taskitem,process_id):
 	task = taskitem.path
 	index = next(outindex)
@@ -72,7 +107,8 @@ def process_task(taskitem,process_id):
 	idx = taskitem.idx
 	score = taskitem.score
 	print ("@"+str(process_id)+" processing "+task + " score "+str(score))
-	output_dir = os.getcwd()+'/'+'size_src/kirenenko-out-'+str(index)+'/queue'
+	slot = acquire_slot()
+	output_dir = spool_dir+'/.stage-'+str(index)
 	if not os.path.exists(output_dir):
 		os.makedirs(output_dir)
 	program_path = os.getcwd() + '/size_pp '
@@ -84,6 +120,7 @@ def process_task(taskitem,process_id):
 		output = subprocess.call([ceCmd], shell=True, stderr=subprocess.DEVNULL, stdout=subprocess.DEVNULL)
 	except subprocess.CalledProcessError:
 		print ("something goes wrong, but continue")
+	publish_slot(output_dir,slot,index,score)
 	#print("push to out pq")
 	#out_pq.put(OutTask(category,idx,score,index))
 	#if (out_pq.qsize()>16):
@@ -184,8 +221,32 @@ def syncPath(path_file_position):
 
 
 	
+backpressure_path = os.getcwd()+"/size_dst/MQfilter/backpressure"
+
+def read_backpressure():
+	# Backlog, ingest rate and throttle flag published by the filter.
+	bp = {}
+	try:
+		with open(backpressure_path) as f:
+			for line in f:
+				k,_,v = line.partition(':')
+				bp[k.strip()] = float(v)
+	except (IOError, ValueError):
+		pass
+	return bp
+
 def process(process_id):
 	while True:
+		# While the filter is over its high-water mark, hold back the
+		# filter-fed (EQ/PQ) tasks and only run seeds from the AFL queue.
+		if read_backpressure().get('throttle',0) and not pq.empty():
+			task = pq.get()
+			if task.category != 0:
+				pq.put(task)
+				time.sleep(1)
+				continue
+			process_task(task,process_id)
+			continue
 		if not pq.empty():
 			print("PQ items total "+str(pq.qsize()))
 			process_task(pq.get(),process_id)
@@ -193,6 +254,8 @@ def process(process_id):
 
 
 def main():
+	for k in range(SPOOL_SLOTS):
+		os.makedirs(spool_dir+'/slot-'+str(k), exist_ok=True)
 	executor = concurrent.futures.ThreadPoolExecutor(max_workers=8)
 
 	#executor.submit(writer,1)
@@ -63,6 +63,33 @@
 
 #define CAL_CYCLES_NO_VAR   4
 
+/* Reruns per seed for the deferred calibration of saved seeds (default for
+   AFL_CAL_CYCLES, and once variable behavior shows up), the most seeds kept
+   waiting for it, and the default share of the wall clock time (percent,
+   AFL_CAL_BUDGET) it may take while there are still seeds to sync: */
+
+#define CAL_DEFER_CYCLES    4
+#define CAL_DEFER_LONG      16
+#define CAL_QUEUE_SIZE      4096
+#define CAL_BUDGET          10
+
+/* Adaptive timeouts for synced seeds: once a task or a producer has had
+   HANG_MIN_SAMPLES runs that did not hang, its seeds get HANG_TMOUT_MULT
+   times the 99th percentile of their exec times (at least HANG_TMOUT_MIN
+   ms, at most -t). Exec time histograms are halved every HANG_HIST_MAX
+   runs to follow recent behavior, and up to HANG_FAMILIES tasks are
+   tracked at a time. Seeds whose length and first HANG_SIG_LEN bytes match
+   one of the last HANG_CACHE_SIZE hangs get HANG_FAST_DIV times less: */
+
+#define HANG_MIN_SAMPLES    32
+#define HANG_TMOUT_MULT     10
+#define HANG_TMOUT_MIN      20
+#define HANG_HIST_MAX       4096
+#define HANG_FAMILIES       1024
+#define HANG_CACHE_SIZE     4096
+#define HANG_SIG_LEN        64
+#define HANG_FAST_DIV       8
+
 /* Number of subsequent hangs before abandoning an input file: */
 
 #define HANG_LIMIT          250
@@ -138,6 +165,103 @@
 
 #define TMIN_MAX_FILE       (10 * 1024 * 1024)
 
+/* Packed corpus store (AFL_PACKED_STORE): maximum size of a single segment
+   file, and the number of index records to grow the index by at a time: */
+
+#define STORE_SEG_SIZE      (64 * 1024 * 1024)
+#define STORE_IDX_GROW      4096
+
+/* Number of producer slots in <sync_dir>/spool/ (the CE scheduler must use
+   the same value): */
+
+#define SPOOL_SLOTS         16
+
+/* Smoothing factor for the per-producer yield estimate used by
+   AFL_SYNC_POLICY=yield (weight of the most recent seed): */
+
+#define SYNC_YIELD_ALPHA    0.1
+
+/* Default sync backlog (seeds) at which producers are asked to back off
+   (AFL_BACKLOG_HWM), and how often to refresh <out_dir>/backpressure (ms): */
+
+#define BACKLOG_HWM         10000
+#define BACKPRESSURE_MS     1000
+
+/* Overload mode (AFL_OVERLOAD_BACKLOG, AFL_OVERLOAD_LATENCY): seeds of each
+   task that are always run (AFL_OVERLOAD_KEEP), the lowest sampling odds of
+   a producer (percent), seeds kept in <out_dir>/deferred/ before the rest
+   are dropped (AFL_OVERLOAD_DEFER), deferred seeds rerun per sync pass once
+   the load is back to normal, and slots in the per-task seed counts: */
+
+#define OVERLOAD_KEEP       16
+#define OVERLOAD_MIN_PERC   5
+#define OVERLOAD_DEFER_MAX  100000
+#define OVERLOAD_DRAIN      256
+#define OVERLOAD_TASKS      1024
+
+/* Longest sleep once a pass found nothing to sync and nothing else is
+   pending (ms); new files in a producer directory end it early where
+   inotify is available, and IDLE_POLL_MS is slept instead where it is not: */
+
+#define IDLE_WAIT_MS        1000
+#define IDLE_POLL_MS        20
+
+/* Supervisor mode (-J): how long a filter of weight 1 holds on to a CPU
+   token before handing it on to the next one with a backlog (ms), and how
+   long a filter handing its token on waits for another to pick it up (us): */
+
+#define JOB_SLICE_MS        100
+#define JOB_HANDOFF_US      1000
+
+/* Executor pool autoscaling (AFL_POOL=min,max): how often the pool may be
+   resized (ms), the sync backlog per executor in use that justifies another
+   one, and cores left to other processes such as the concolic workers
+   (AFL_POOL_RESERVE): */
+
+#define POOL_SCALE_MS       1000
+#define POOL_SEEDS_PER_EXEC 32
+#define POOL_RESERVE        1
+
+/* Interval between checkpoints of the novelty state (seconds): */
+
+#define CHECKPOINT_SEC      60
+
+/* Block size for the scratch arenas used while processing a seed or a sync
+   pass (arena_alloc() in alloc-inl.h): */
+
+#define ARENA_BLK_SIZE      (64 * 1024)
+
+/* Huge page size assumed when AFL_HUGE_PAGES asks for the trace SHM and the
+   virgin maps to be backed by huge pages: */
+
+#define HUGE_PAGE_SIZE      (2 * 1024 * 1024)
+
+/* Default size of a newly created path count table (log2 of the number of
+   slots, AFL_CKSUM_BITS), and the fill ratio past which no new checksums
+   are added to it: */
+
+#define CKT_SIZE_POW2       20
+#define CKT_MAX_LOAD        0.9
+
+/* Default budget for the resident memory the queue may add (MB,
+   AFL_QUEUE_MEM), past which blocks of entries that can no longer become
+   favored are dropped from memory, and the step in which the queue's
+   backing files grow (bytes): */
+
+#define QUEUE_MEM_MB        64
+#define QUEUE_FILE_GROW     (1024 * 1024)
+
+/* Largest seed that -r will minimize, and the default number of fork servers
+   (AFL_TRIM_JOBS) that block deletion candidates are spread across: */
+
+#define TRIM_MAX_LEN        (10 * 1024)
+#define TRIM_JOBS           4
+
+/* Default share of the wall clock time (percent, AFL_TRIM_BUDGET) that -r
+   may spend trimming queued seeds while there are still seeds to sync: */
+
+#define TRIM_BUDGET         20
+
 /* Maximum dictionary token size (-x), in bytes: */
 
 #define MAX_DICT_FILE       128
@@ -268,6 +392,27 @@
 
 #define MSAN_ERROR          86
 
+/* Layout of the trace SHM region past the MAP_SIZE trace and the 8-byte path
+   hash. afl-fuzz can hand the target a set of expected edges (one bit per
+   map entry); while the word at EXPECT_ON_OFF is set, the QEMU shim stops
+   the target with EXPECT_EXIT_CODE as soon as it logs an edge outside that
+   set, and sets the word at EXPECT_HIT_OFF. The shim only looks at the
+   trailer if the region is at least TRACE_SHM_SIZE bytes long: */
+
+#define EXPECT_HIT_OFF      (MAP_SIZE + 8)
+#define EXPECT_ON_OFF       (MAP_SIZE + 12)
+#define EXPECT_MAP_OFF      (MAP_SIZE + 16)
+
+#define EXPECT_EXIT_CODE    93
+
+/* After that comes the crash record: when the guest dies from a signal, the
+   QEMU shim stores the signal number (u32, written last), a hash of the
+   return addresses found on its stack (u32) and the faulting PC (u64), so
+   that afl-fuzz can bucket crashes: */
+
+#define CRASH_REC_OFF       (EXPECT_MAP_OFF + MAP_SIZE / 8)
+#define TRACE_SHM_SIZE      (CRASH_REC_OFF + 16)
+
 /* Designated file descriptors for forkserver commands (the application will
    use FORKSRV_FD and FORKSRV_FD + 1): */
 
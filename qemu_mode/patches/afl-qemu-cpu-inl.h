@@ -61,6 +61,16 @@
 /* This is equivalent to afl-as.h: */
 
 static unsigned char *afl_area_ptr;
+
+/* Expected edge set handed over by afl-fuzz (see EXPECT_* in config.h), if
+   the SHM region is large enough to have one: */
+
+static unsigned char *afl_expect_map;
+static volatile unsigned int *afl_expect_on, *afl_expect_hit;
+
+/* Crash record for afl-fuzz (see CRASH_REC_OFF), under the same condition: */
+
+static unsigned char *afl_crash_rec;
 //FILE *fptr = fopen("./debug.log", "a+");
 
 /* Exported variables populated by the code patched into elfload.c: */
@@ -84,6 +94,7 @@ static void afl_setup(void);
 static void afl_forkserver(CPUArchState*);
 // static inline void afl_maybe_log(abi_ulong);
 void afl_maybe_log(abi_ulong, abi_ulong);
+void afl_note_crash(int, uint64_t, uint32_t);
 
 static void afl_wait_tsl(CPUArchState*, int);
 static void afl_request_tsl(target_ulong, target_ulong, uint64_t);
@@ -130,11 +141,25 @@ static void afl_setup(void) {
 
   if (id_str) {
 
+    struct shmid_ds ds;
+
     shm_id = atoi(id_str);
     afl_area_ptr = shmat(shm_id, NULL, 0);
 
     if (afl_area_ptr == (void*)-1) exit(1);
 
+    /* Older tools (and afl-showmap, afl-tmin) only allocate the trace
+       itself, so check before touching the trailer. */
+
+    if (!shmctl(shm_id, IPC_STAT, &ds) && ds.shm_segsz >= TRACE_SHM_SIZE) {
+
+      afl_expect_hit = (unsigned int*)(afl_area_ptr + EXPECT_HIT_OFF);
+      afl_expect_on  = (unsigned int*)(afl_area_ptr + EXPECT_ON_OFF);
+      afl_expect_map = afl_area_ptr + EXPECT_MAP_OFF;
+      afl_crash_rec  = afl_area_ptr + CRASH_REC_OFF;
+
+    }
+
     /* With AFL_INST_RATIO set to a low value, we want to touch the bitmap
        so that the parent doesn't give up on us. */
 
@@ -293,6 +318,17 @@ void afl_maybe_log(abi_ulong next_pc, abi_ulong cur_loc) {
     afl_area_ptr[acc] ++;
   }
 
+  /* An edge the caller did not expect means the trace can no longer match,
+     so there is no point in running any further. */
+
+  if (afl_expect_on && *afl_expect_on &&
+      !(afl_expect_map[acc >> 3] & (1 << (acc & 7)))) {
+
+    *afl_expect_hit = 1;
+    _exit(EXPECT_EXIT_CODE);
+
+  }
+
   n_pair[N_GRAM-1] = cur;
   // afl_area_ptr[cur_loc ^ prev_loc]++;
   // prev_loc = cur_loc >> 1;
@@ -300,6 +336,23 @@ void afl_maybe_log(abi_ulong next_pc, abi_ulong cur_loc) {
 }
 
 
+/* Called from force_sig() in linux-user/signal.c when the guest is about to
+   die from a signal. The signal number goes in last, so afl-fuzz never
+   sees a half-written record. */
+
+void afl_note_crash(int sig, uint64_t pc, uint32_t stack_hash) {
+
+  if (!afl_crash_rec) return;
+
+  memcpy(afl_crash_rec + 4, &stack_hash, 4);
+  memcpy(afl_crash_rec + 8, &pc, 8);
+
+  __sync_synchronize();
+  *(volatile unsigned int*)afl_crash_rec = sig;
+
+}
+
+
 /* This code is invoked whenever QEMU decides that it doesn't have a
    translation of a particular block and needs to compute it. When this happens,
    we tell the parent to mirror the operation, so that the next fork() has a
@@ -437,6 +437,42 @@ static inline void free_sigqueue(CPUArchState *env, struct sigqueue *q)
     ts->first_free = q;
 }
 
+/* AFL: record the faulting PC and a hash of the return addresses found on
+   the guest stack, so that afl-fuzz can bucket crashes (see CRASH_REC_OFF
+   in AFL's config.h). Without frame pointers to rely on, any of the first
+   AFL_CRASH_STACK_SCAN stack words that points into the instrumented code
+   counts as a return address. */
+
+#define AFL_CRASH_STACK_SCAN  256
+#define AFL_CRASH_STACK_DEPTH 8
+
+extern abi_ulong afl_start_code, afl_end_code;
+extern void afl_note_crash(int, uint64_t, uint32_t);
+
+static void afl_crash_record(CPUArchState *env, int target_sig)
+{
+#if defined(TARGET_I386) || defined(TARGET_X86_64)
+    abi_ulong sp = env->regs[R_ESP], val;
+    uint64_t pc = env->eip;
+    uint32_t hash = 2166136261u;
+    int i, found = 0;
+
+    for (i = 0; i < AFL_CRASH_STACK_SCAN && found < AFL_CRASH_STACK_DEPTH;
+         i++, sp += sizeof(abi_ulong)) {
+        if (get_user_ual(val, sp)) {
+            break;
+        }
+        if (val < afl_start_code || val > afl_end_code) {
+            continue;
+        }
+        hash = (hash ^ (uint32_t)val) * 16777619;
+        found++;
+    }
+
+    afl_note_crash(target_sig, pc, hash);
+#endif
+}
+
 /* abort execution with signal */
 static void QEMU_NORETURN force_sig(int target_sig)
 {
@@ -447,6 +483,7 @@ static void QEMU_NORETURN force_sig(int target_sig)
     struct sigaction act;
     host_sig = target_to_host_signal(target_sig);
     gdb_signalled(env, target_sig);
+    afl_crash_record(env, target_sig);
 
     /* dump core if supported by target binary format */
     if (core_dump_signal(target_sig) && (ts->bprm->core_dump != NULL)) {
@@ -23,4 +23,10 @@ AFL_SKIP_CPUFREQ=1 ./afl-fuzz -Q -m 1024 -t 90 -k $COVERG_DIR -S $FILTER_NAME -s
 #AFL_SKIP_CPUFREQ=1 ./afl-fuzz -Q -m 1024 -t 90 -S $FILTER_NAME -s $ROOT_CHECK -o $ROOT_WRITE -- $MD5_BIN -c @@
 
 # for base64 -d
-#AFL_SKIP_CPUFREQ=1 ./afl-fuzz -Q -m 1024 -t 90 -S $FILTER_NAME -s $ROOT_CHECK -o $ROOT_WRITE -- $BASE64_BIN -d @@
\ No newline at end of file
+#AFL_SKIP_CPUFREQ=1 ./afl-fuzz -Q -m 1024 -t 90 -S $FILTER_NAME -s $ROOT_CHECK -o $ROOT_WRITE -- $BASE64_BIN -d @@
+
+# several of the above in one supervisor, sharing the cores (AFL_JOBS tokens,
+# one per core by default); each line of the file is a weight followed by the
+# options and command line for one filter, e.g.
+#   2 -Q -m 1024 -t 90 -S MQfilter -s /data/who/sync -o /data/who/out -- /bin/who @@
+#AFL_SKIP_CPUFREQ=1 ./afl-fuzz -J filters.txt
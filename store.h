@@ -0,0 +1,167 @@
+/*
+   american fuzzy lop - on-disk formats shared with the export tools
+   -----------------------------------------------------------------
+
+   Copyright 2013, 2014, 2015 Google Inc. All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at:
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Layouts of the files that afl-fuzz keeps mmap()ed in the output directory
+   and that other tools read back (packed corpus store, queue state, path
+   count table). Everything is fixed-size and host-endian; the files are not
+   meant to be moved between machines.
+
+ */
+
+#ifndef _HAVE_STORE_H
+#define _HAVE_STORE_H
+
+#include "types.h"
+
+/*************************
+ * Packed corpus store   *
+ *************************/
+
+/* With AFL_PACKED_STORE set, saved seeds are appended to <out_dir>/store/
+   segment files (seg_NNNNNN) instead of being written out one file each.
+   The index file is an array of fixed-size records behind a small header;
+   records are only ever appended, and rec_count is bumped after the record
+   is complete, so readers can follow the file while afl-fuzz is running.
+
+   Hangs are named after the operation that found them (id:N,<op>); that
+   part of the name (tag) is kept in the segment right after the data. */
+
+#define STORE_MAGIC         0x534c4641 /* "AFLS" */
+#define STORE_VERSION       2
+
+/* Kinds of saved seeds; mirrors the directories used without the store. */
+
+enum {
+  /* 00 */ STORE_EQ,                  /* queue/                           */
+  /* 01 */ STORE_PQ,                  /* -path/_queue/                    */
+  /* 02 */ STORE_EC,                  /* crashes/                         */
+  /* 03 */ STORE_PC,                  /* -path/_crashes/                  */
+  /* 04 */ STORE_HANG,                /* hangs/                           */
+  STORE_KINDS
+};
+
+struct store_hdr {
+
+  u32 magic,                          /* STORE_MAGIC                      */
+      version,                        /* STORE_VERSION                    */
+      rec_count,                      /* Committed records                */
+      rec_cap,                        /* Records the file has room for    */
+      cur_seg,                        /* Segment currently appended to    */
+      reserved;
+
+  u64 cur_seg_off;                    /* Append offset in cur_seg         */
+
+};
+
+struct store_rec {
+
+  u32 id;                             /* Per-kind seed ID (id:NNNNNNNN)   */
+  u8  kind,                           /* STORE_*                          */
+      flags;                          /* STORE_F_*                        */
+  u16 tag_len;                        /* Name tag following the data      */
+  s32 source;                         /* Producer index (filter_index)    */
+  u32 seg;                            /* Segment number                   */
+  u64 off;                            /* Offset within the segment        */
+  u32 len;                            /* Length of the test case          */
+  float rareness;                     /* Rareness score at save time      */
+  u64 path_hash;                      /* Path hash reported by the target */
+
+};
+
+/* Record flags: */
+
+#define STORE_F_TRIMMED     1         /* Trimmed copy of an earlier record
+                                         with the same kind and id, which it
+                                         supersedes                       */
+
+#define STORE_REC_OFF(_n)   (sizeof(struct store_hdr) + \
+                             (u64)(_n) * sizeof(struct store_rec))
+
+/*************************
+ * Queue state file      *
+ *************************/
+
+/* Favored / redundant flags and trace ref counts for queue entries, kept in
+   <out_dir>/queue/.state/markers instead of as empty marker files. Entries
+   are addressed by their position in the queue and grouped in chunks, so the
+   file only has to be grown (and remapped) once every STATE_CHUNK entries.
+   The kind, id and source fields let afl-export rebuild the marker names. */
+
+#define STATE_MAGIC         0x4d534641 /* "AFSM" */
+#define STATE_VERSION       1
+
+#define STATE_CHUNK         4096
+
+struct state_hdr {
+
+  u32 magic,                          /* STATE_MAGIC                      */
+      version,                        /* STATE_VERSION                    */
+      entries,                        /* Queue entries registered         */
+      chunks;                         /* Chunks the file has room for     */
+
+};
+
+struct state_chunk {
+
+  u8  favored[STATE_CHUNK / 8],       /* Currently favored (bit per entry) */
+      redundant[STATE_CHUNK / 8];     /* Redundant (bit per entry)         */
+
+  u32 ref[STATE_CHUNK],               /* tc_ref of favored entries         */
+      id[STATE_CHUNK];                /* Per-kind seed ID                  */
+
+  s32 source[STATE_CHUNK];            /* Producer index                    */
+  u8  kind[STATE_CHUNK];              /* STORE_EQ or STORE_PQ              */
+
+};
+
+#define STATE_CHUNK_OFF(_n) (sizeof(struct state_hdr) + \
+                             (u64)(_n) * sizeof(struct state_chunk))
+
+/*************************
+ * Path count table      *
+ *************************/
+
+/* Number of times each edge-set checksum (hash32() of the classified trace)
+   has been seen, used to break ties between top_rated[] contenders. Kept in
+   <out_dir>/cksum_paths, or in a file named by AFL_CKSUM_TABLE that several
+   afl-fuzz instances grading the same target can share.
+
+   Open addressing with linear probing over 2^size_pow2 slots, indexed by the
+   low bits of the checksum. A zero cksum marks a free slot; a checksum of 0
+   is stored as 1. Slots are claimed with an atomic compare-and-swap on
+   cksum and counts only ever go up (atomically), so readers need no
+   locking. Slots are never freed and the table never grows; the number of
+   slots is picked when the table is created (AFL_CKSUM_BITS). */
+
+#define CKT_MAGIC           0x504b4641 /* "AFKP" */
+#define CKT_VERSION         1
+
+struct ckt_hdr {
+
+  u32 magic,                          /* CKT_MAGIC                        */
+      version,                        /* CKT_VERSION                      */
+      size_pow2,                      /* log2 of the number of slots      */
+      used;                           /* Slots claimed so far             */
+
+};
+
+struct ckt_slot {
+
+  u32 cksum,                          /* Trace checksum, 0 if free        */
+      count;                          /* Times seen                       */
+
+};
+
+#define CKT_OFF(_n)         (sizeof(struct ckt_hdr) + \
+                             (u64)(_n) * sizeof(struct ckt_slot))
+
+#endif /* ! _HAVE_STORE_H */